@@ -1,31 +1,85 @@
 #include "cache.hpp"
 
+#include "compression.hpp"
 #include "directory_iterator.hpp"
 #include "event.hpp"
 #include "exception.hpp"
 #include "filesystem.hpp"
 #include "hash.hpp"
 #include "inode.hpp"
+#include "inode_arena.hpp"
+#include "manifest.hpp"
 #include "thread_pool.hpp"
 #include "wait_group.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <cstring>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace fs = std::filesystem;
 
 namespace fstree {
 
+// File objects up to this size are stored in packs when packing is enabled
+static const size_t g_pack_object_size_limit = 64 * 1024;
+
+// Smaller file objects are never compressed, the savings are within a block
+static const uint64_t g_compress_min_size = 4096;
+
+// Compressibility is probed on this much of the start of a file
+static const size_t g_compress_probe_size = 64 * 1024;
+
+// The catalog is rebuilt from the object directories after this period,
+// to pick up objects written or removed without being recorded
+static const std::chrono::hours g_catalog_rescan_period = std::chrono::hours(24 * 7);
+
+// The catalog log is compacted into the table beyond this size
+static const uint64_t g_catalog_log_limit = 16 * 1024 * 1024;
+
+// Eviction starts above the size limit and stops at this percentage of it
+static const uint64_t g_low_watermark_percent = 90;
+
+// The cache shrinks to keep this percentage of its filesystem free
+static const uint64_t g_min_free_percent = 5;
+
+// The share of the low watermark that objects used more than once may
+// keep when others are evicted
+static const uint64_t g_protected_percent = 80;
+
+// Evicted objects are moved out of the way and settled in batches of this size
+static const size_t g_evict_batch_size = 256;
+
+// Trees written, pulled or checked out are live roots for this period
+static const std::chrono::hours g_root_lifetime = std::chrono::hours(24 * 7);
+
+// Returns true if a catalog created at the given time must be rebuilt
+static bool catalog_expired(catalog::time_type created) {
+  auto now = std::chrono::system_clock::now().time_since_epoch();
+  return std::chrono::nanoseconds(created) + g_catalog_rescan_period < now;
+}
+
 std::filesystem::path cache::default_path() { return fstree::cache_path(); }
 
 cache::cache()
     : _objectdir(default_path() / "objects"),
       _tmpdir(default_path() / "tmp"),
       _max_size(default_max_size),
-      _max_size_slice(default_max_size >> 8),
       _retention_period(default_retention),
-      _lock(default_path() / "objects" / "lock") {
+      _lock(default_path() / "objects" / "lock"),
+      _evict_lock(default_path() / "objects" / "evict.lock"),
+      _catalog(default_path() / "objects"),
+      _packs(default_path() / "objects" / "pack", default_path() / "tmp") {
   std::error_code ec;
 
   std::filesystem::create_directories(_objectdir, ec);
@@ -43,9 +97,11 @@ cache::cache(const std::filesystem::path& path, size_t max_size, std::chrono::se
     : _objectdir(path / "objects"),
       _tmpdir(path / "tmp"),
       _max_size(max_size),
-      _max_size_slice(max_size >> 8),
       _retention_period(retention_period),
-      _lock(path / "objects" / "lock") {
+      _lock(path / "objects" / "lock"),
+      _evict_lock(path / "objects" / "evict.lock"),
+      _catalog(path / "objects"),
+      _packs(path / "objects" / "pack", path / "tmp") {
   std::error_code ec;
 
   std::filesystem::create_directories(_objectdir, ec);
@@ -59,6 +115,71 @@ cache::cache(const std::filesystem::path& path, size_t max_size, std::chrono::se
   }
 }
 
+cache::~cache() {
+  try {
+    flush_catalog();
+  }
+  catch (const std::exception& e) {
+    // Unrecorded objects are picked up by the next rescan
+  }
+}
+
+void cache::set_pack_objects(bool enabled) { _pack_objects = enabled; }
+
+void cache::set_inline_size(size_t size) { _inline_size = size; }
+
+void cache::set_copy_method(copy_method method) { _copy_method = method; }
+
+void cache::set_ingest_method(copy_method method) { _ingest_method = method; }
+
+void cache::set_compression(bool enabled) {
+  if (enabled && !compression_supported()) {
+    throw std::invalid_argument("compression is not supported by this build");
+  }
+  _compress = enabled;
+}
+
+void cache::set_secondary(const std::filesystem::path& path) {
+  if (path.empty()) {
+    _secondary_objectdir.clear();
+    _secondary_packs.reset();
+    return;
+  }
+
+  _secondary_objectdir = path / "objects";
+  _secondary_packs = std::make_unique<pack_store>(_secondary_objectdir / "pack", _tmpdir, true);
+}
+
+// Reads a file smaller than the inline size into its inode and hashes it.
+// Returns false if the file has grown since it was scanned.
+static bool read_inline(const std::filesystem::path& root, const inode::ptr& inode) {
+  std::ifstream file(root / inode->path(), std::ios::binary);
+  std::string data(inode->size() + 1, '\0');
+  file.read(&data[0], data.size());
+  if (!file && !file.eof()) {
+    throw std::runtime_error("failed to read file: " + inode->path() + ": " + std::strerror(errno));
+  }
+  if (static_cast<size_t>(file.gcount()) > inode->size()) {
+    return false;
+  }
+
+  data.resize(file.gcount());
+  inode->set_hash(hashsum_hex(data));
+  inode->set_size(data.size());
+  inode->set_inline_data(data);
+  return true;
+}
+
+// Updates the total size and file count of all directories below a tree
+static void update_totals(inode& tree) {
+  for (inode* child : tree) {
+    if (child->is_directory() && !child->is_ignored()) {
+      update_totals(*child);
+    }
+  }
+  tree.update_totals();
+}
+
 void cache::add(fstree::index& index) {
   event("cache::add", index.root_path());
 
@@ -68,27 +189,61 @@ void cache::add(fstree::index& index) {
   // List of dirty directory inodes
   std::vector<inode::ptr> dirty_dirs;
 
+  // Files and directories whose objects were already in the cache. Files
+  // are collected by the jobs, directories by this thread.
+  std::mutex reused_mutex;
+  std::vector<inode::ptr> reused;
+  std::vector<inode::ptr> reused_dirs;
+
+  // The tree of a clean directory records which files were inlined. When the
+  // inline size has changed since, directories with files moving in or out
+  // of their entries must be written again.
+  for (const auto& inode : index) {
+    if (inode->is_file() && !inode->is_dirty() && inode->parent() &&
+        inode->has_inline_data() != (inode->size() < _inline_size)) {
+      inode->parent()->set_dirty();
+    }
+  }
+
   for (const auto& inode : index) {
     if (inode->is_file()) {
       wg.add(1);
-      pool.enqueue([this, &index, inode, &wg]() {
+      pool.enqueue([this, &index, inode, &wg, &reused_mutex, &reused]() {
         try {
           std::error_code ec;
 
+          // Tiny files are stored in their tree entry instead of an object.
+          // The choice only depends on the size, so that identical content
+          // gives identical trees. Unchanged files reuse the inline contents
+          // from the previous index when they are inlined again.
+          if (inode->size() >= _inline_size) {
+            inode->clear_inline_data();
+          }
+          else if ((inode->is_dirty() || !inode->has_inline_data()) && read_inline(index.root_path(), inode)) {
+            event("cache::add", inode->path(), "inline");
+          }
+
+          if (inode->has_inline_data()) {
+            wg.done();
+            return;
+          }
+
+          // Objects are moved into place atomically, so concurrent writers
+          // of the same object need no lock
+#ifdef _WIN32
+          auto context = _lock.lock();
+#endif
+
           if (inode->is_dirty()) {
             inode->rehash(index.root_path());
-            auto context = _lock.lock();
-            if (!has_object(inode->hash())) {
-              event("cache::add", inode->path(), "dirty");
-              create_file(index.root_path(), inode);
-            }
+          }
+          if (!has_object(inode->hash())) {
+            event("cache::add", inode->path(), inode->is_dirty() ? "dirty" : "missing");
+            create_file(index.root_path(), inode);
           }
           else {
-            auto context = _lock.lock();
-            if (!has_object(inode->hash())) {
-              event("cache::add", inode->path(), "missing");
-              create_file(index.root_path(), inode);
-            }
+            std::lock_guard<std::mutex> lock(reused_mutex);
+            reused.push_back(inode);
           }
 
           wg.done();
@@ -105,53 +260,245 @@ void cache::add(fstree::index& index) {
       else if (!has_tree(inode->hash())) {
         dirty_dirs.push_back(inode);
       }
+      else {
+        reused_dirs.push_back(inode);
+      }
     }
   }
 
   wg.wait_rethrow();
+  std::move(reused_dirs.begin(), reused_dirs.end(), std::back_inserter(reused));
 
 #ifdef _WIN32
   auto context = _lock.lock();
 #endif
 
-  // Create directory nodes in reverse order
-  for (auto it = dirty_dirs.rbegin(); it != dirty_dirs.rend(); ++it) {
-    if ((*it)->is_dirty()) {
-      event("cache::add", (*it)->path(), "dirty");
+  // Tree entries record the total size and file count of directories
+  update_totals(*index.root());
+
+  // Create directory nodes bottom-up in parallel. Each directory counts its
+  // pending child directories and becomes ready when the last one is done.
+  std::vector<inode*> dirs;
+  dirs.reserve(dirty_dirs.size() + 1);
+  for (const auto& dir : dirty_dirs) {
+    dirs.push_back(dir.get());
+  }
+  if (std::find(dirs.begin(), dirs.end(), index.root().get()) == dirs.end()) {
+    dirs.push_back(index.root().get());
+  }
+
+  std::unordered_map<const inode*, size_t> positions;
+  positions.reserve(dirs.size());
+  for (size_t i = 0; i < dirs.size(); i++) {
+    positions.emplace(dirs[i], i);
+  }
+
+  std::vector<size_t> parents(dirs.size(), SIZE_MAX);
+  std::vector<std::atomic<size_t>> pending(dirs.size());
+  for (size_t i = 0; i < dirs.size(); i++) {
+    auto it = positions.find(dirs[i]->parent().get());
+    if (it != positions.end()) {
+      parents[i] = it->second;
+      pending[it->second]++;
     }
-    else {
-      event("cache::add", (*it)->path(), "missing");
+  }
+
+  std::atomic<bool> failed = false;
+  std::function<void(size_t)> build = [&](size_t i) {
+    // Schedules the parent directory once all of its children are done
+    auto release_parent = [&]() {
+      size_t parent = parents[i];
+      if (parent != SIZE_MAX && --pending[parent] == 0) {
+        pool.enqueue([&build, parent]() { build(parent); });
+      }
+    };
+
+    try {
+      // Once a directory has failed, its ancestors are skipped
+      if (!failed) {
+        inode::ptr dir(dirs[i]);
+        if (dir.get() != index.root().get()) {
+          event("cache::add", dir->path(), dir->is_dirty() ? "dirty" : "missing");
+        }
+        create_dirtree(dir);
+      }
+    }
+    catch (const std::exception& e) {
+      failed = true;
+      release_parent();
+      wg.exception(e);
+      return;
+    }
+
+    release_parent();
+    wg.done();
+  };
+
+  // Collect the leaves first, since scheduled directories may already
+  // release their parents while the leaves are being enqueued
+  std::vector<size_t> leaves;
+  for (size_t i = 0; i < dirs.size(); i++) {
+    if (pending[i] == 0) {
+      leaves.push_back(i);
     }
+  }
+
+  wg.add(static_cast<int>(dirs.size()));
+  for (size_t i : leaves) {
+    pool.enqueue([&build, i]() { build(i); });
+  }
+
+  wg.wait_rethrow();
+  _packs.flush();
+
+  if (_manifests) {
+    save_manifest(*index.root());
+  }
+
+  flush_catalog();
 
-    create_dirtree(*it);
+  // Reused objects may have been evicted before their use was logged.
+  // Eviction keeps objects used in the log written above, so objects that
+  // still exist now stay, and missing ones are written again. Trees of
+  // dirty directories may have been found in the cache as well.
+  for (inode* dir : dirs) {
+    reused.push_back(inode::ptr(dir));
+  }
+  for (auto& inode : reused) {
+    wg.add(1);
+    pool.enqueue([this, &index, inode, &wg]() mutable {
+      try {
+        if (inode->is_file() && !has_object(inode->hash())) {
+          event("cache::add", inode->path(), "evicted");
+          create_file(index.root_path(), inode);
+        }
+        else if (inode->is_directory() && !has_tree(inode->hash())) {
+          event("cache::add", inode->path(), "evicted");
+          create_dirtree(inode);
+        }
+        wg.done();
+      }
+      catch (const std::exception& e) {
+        wg.exception(e);
+      }
+    });
   }
 
-  create_dirtree(index.root());
+  wg.wait_rethrow();
+  _packs.flush();
+  flush_catalog();
+
+  record_root(index.root()->hash());
 }
 
+void cache::set_manifests(bool enabled) { _manifests = enabled; }
+
 void cache::read_tree(const fstree::digest& hash, inode::ptr& inode) {
-  std::error_code ec;
+  inode->set_hash(hash);
+
+  if (auto object = _trees.get(hash)) {
+    object->materialize(*inode);
+    inode->update_totals();
+    return;
+  }
 
 #ifdef _WIN32
   auto lock = _lock.lock();
 #endif
 
-  inode->set_hash(hash);
-
-  std::filesystem::path object = tree_path(inode);
-  if (!std::filesystem::exists(object, ec)) {
+  std::string data;
+  if (!read_tree_object(hash, data)) {
     throw std::runtime_error("tree object not found in local cache: " + hash.string());
   }
 
+  std::vector<fstree::digest> shards;
+  {
+    std::istringstream stream(std::move(data), std::ios::binary);
+    fstree::read_tree(stream, *inode, shards);
+  }
+
+  // The entries of a sharded tree are spread over its shards. All shards
+  // are read first, so that a missing shard leaves the inode unchanged.
+  if (!shards.empty()) {
+    std::vector<std::string> shard_data(shards.size());
+    for (size_t i = 0; i < shards.size(); i++) {
+      if (!read_tree_object(shards[i], shard_data[i])) {
+        throw std::runtime_error("tree object not found in local cache: " + shards[i].string());
+      }
+    }
+
+    for (auto& data : shard_data) {
+      std::vector<fstree::digest> nested;
+      std::istringstream stream(std::move(data), std::ios::binary);
+      fstree::read_tree(stream, *inode, nested);
+      if (!nested.empty()) {
+        throw std::runtime_error("failed reading tree: " + hash.string() + ": nested shards");
+      }
+    }
+
+    inode->sort();
+  }
+
+  inode->update_totals();
+  _trees.put(hash, std::make_shared<const tree_object>(*inode));
+}
+
+bool cache::read_tree_object(const fstree::digest& hash, std::string& data) {
+  if (_packs.read(hash, pack_store::kind::tree, data)) {
+    return true;
+  }
+
+  std::filesystem::path object = tree_path(hash);
   std::ifstream file(object, std::ios::binary);
   if (!file) {
-    throw std::runtime_error("failed to open tree object: " + object.string() + ": " + ec.message());
+    return false;
+  }
+
+  data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  if (file.bad()) {
+    throw std::runtime_error("failed to read tree object: " + object.string() + ": " + std::strerror(errno));
+  }
+  return true;
+}
+
+void cache::tree_shards(const fstree::digest& hash, std::vector<fstree::digest>& shards) {
+  std::string data;
+  if (!read_tree_object(hash, data)) {
+    throw std::runtime_error("tree object not found in local cache: " + hash.string());
+  }
+
+  if (!is_sharded_tree(data)) {
+    return;
+  }
+
+  inode_arena::ptr arena = make_intrusive<inode_arena>();
+  inode::ptr tree = arena->make();
+  tree->set_hash(hash);
+
+  std::istringstream stream(std::move(data), std::ios::binary);
+  fstree::read_tree(stream, *tree, shards);
+}
+
+void cache::store_tree(const fstree::digest& hash, std::string_view data) {
+  if (has_tree(hash)) {
+    return;
   }
 
-  file >> *inode;
+  if (_pack_objects) {
+    _packs.write(hash, pack_store::kind::tree, data);
+  }
+  else {
+    write_loose(tree_path(hash), data);
+  }
 }
 
 void cache::index_from_tree(const fstree::digest& hash, fstree::index& index) {
+  record_root(hash);
+
+  if (load_manifest(hash, index)) {
+    return;
+  }
+
   std::vector<inode::ptr> trees;
   pool& pool = get_pool();
   std::mutex mutex;
@@ -173,12 +520,12 @@ void cache::index_from_tree(const fstree::digest& hash, fstree::index& index) {
         try {
           read_tree(tree->hash(), tree);
 
-          for (auto& inode : *tree) {
+          for (inode* inode : *tree) {
             std::lock_guard<std::mutex> lock(mutex);
-            index.push_back(inode);
+            index.push_back(inode::ptr(inode));
 
             if (inode->is_directory()) {
-              new_trees.push_back(inode);
+              new_trees.push_back(inode::ptr(inode));
             }
           }
 
@@ -200,25 +547,42 @@ void cache::index_from_tree(const fstree::digest& hash, fstree::index& index) {
 void cache::create_file(const std::filesystem::path& root, const inode::ptr& inode) {
   std::error_code ec;
 
-  std::filesystem::path object_path = file_path(inode);
-
-  if (!std::filesystem::create_directories(object_path.parent_path(), ec)) {
-    // If the directory already exists, it's fine.
-    if (ec) {
-      throw std::runtime_error(
-          "failed to create directory: " + object_path.parent_path().string() + ": " + ec.message());
+  if (_pack_objects && inode->size() <= g_pack_object_size_limit) {
+    std::ifstream file(root / inode->path(), std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (!file && !file.eof()) {
+      throw std::runtime_error("failed to read file: " + inode->path() + ": " + std::strerror(errno));
     }
+
+    _packs.write(inode->hash(), pack_store::kind::file, data);
+    return;
   }
 
-  std::filesystem::copy_file(root / inode->path(), object_path, std::filesystem::copy_options::update_existing, ec);
-  if (ec) {
-    throw std::runtime_error("failed to copy file: " + inode->path() + ": " + ec.message());
+  // Copy to a temporary file first and move it to the object directory.
+  // Concurrent writers of the same object write identical contents, and
+  // the last rename wins.
+  std::filesystem::path tmp = _tmpdir;
+  FILE* fp = fstree::mkstemp(tmp);
+  if (!fp) {
+    throw std::runtime_error("failed to create temporary file: " + tmp.string() + ": " + std::strerror(errno));
+  }
+  fclose(fp);
+
+  try {
+    fstree::copy_file(root / inode->path(), tmp, _ingest_method);
+  }
+  catch (...) {
+    std::filesystem::remove(tmp, ec);
+    throw;
   }
 
-  std::filesystem::permissions(object_path, std::filesystem::perms(0600), ec);
+  std::filesystem::permissions(tmp, std::filesystem::perms(0600), ec);
   if (ec) {
+    std::filesystem::remove(tmp, ec);
     throw std::runtime_error("failed to set file permissions: " + inode->path() + ": " + ec.message());
   }
+
+  install_file(tmp, inode->hash());
 }
 
 void cache::create_dirtree(inode::ptr& node) {
@@ -226,22 +590,32 @@ void cache::create_dirtree(inode::ptr& node) {
 
   node->sort();
 
-  // Create ostream from file pointer
+  // Serialize and hash the tree in memory. The shards of a large directory
+  // are stored before its shard index.
   std::ostringstream file(std::ios::binary);
+  write_tree(file, *node, [this](const fstree::digest& hash, std::string_view data) { store_tree(hash, data); });
   if (!file) {
-    throw std::runtime_error(std::string("failed to create temporary file: ") + std::strerror(errno));
+    throw std::runtime_error("failed to serialize tree: " + node->path());
   }
 
-  file << *node;
-  file.flush();
+  std::string_view data = file.view();
+  fstree::digest hash = hashsum_hex(data);
+  node->set_hash(hash);
+
+  // Most trees of an incremental write already exist
+  store_tree(hash, data);
+}
+
+void cache::write_loose(const std::filesystem::path& object_path, std::string_view data) {
+  std::error_code ec;
 
-  // Create temporary file using mkstemp, without knowing its hash yet, and write direntries.
+  // Write to a temporary file first and move it to the object directory.
   std::filesystem::path tmp = _tmpdir;
   FILE* fp = fstree::mkstemp(tmp);
   if (!fp) {
     throw std::runtime_error("failed to create temporary file: " + tmp.string() + ": " + std::strerror(errno));
   }
-  if (fwrite(file.str().data(), 1, file.str().size(), fp) != file.str().size()) {
+  if (fwrite(data.data(), 1, data.size(), fp) != data.size()) {
     int err = errno;
     fclose(fp);
     std::filesystem::remove(tmp, ec);
@@ -249,16 +623,66 @@ void cache::create_dirtree(inode::ptr& node) {
   }
   fclose(fp);
 
-  // Then calculate the hash of the file and move it to the object directory.
-  fstree::digest hash = hashsum_hex_file(tmp);
-  node->set_hash(hash);
+  install_object(tmp, object_path);
+}
 
-  std::filesystem::path object_path = tree_path(node);
-  if (std::filesystem::exists(object_path, ec)) {
-    std::filesystem::remove(tmp, ec);
+void cache::install_file(const std::filesystem::path& tmp, const fstree::digest& hash) {
+  std::error_code ec;
+  uint64_t size = std::filesystem::file_size(tmp, ec);
+  if (!_compress || ec || size < g_compress_min_size) {
+    install_object(tmp, file_path(hash));
+    return;
+  }
+
+  std::ifstream file(tmp, std::ios::binary);
+  std::string sample(g_compress_probe_size, '\0');
+  file.read(sample.data(), sample.size());
+  sample.resize(file.gcount());
+  if (!is_compressible(sample)) {
+    file.close();
+    install_object(tmp, file_path(hash));
     return;
   }
 
+  std::filesystem::path compressed = _tmpdir;
+  FILE* fp = fstree::mkstemp(compressed);
+  if (!fp) {
+    std::filesystem::remove(tmp, ec);
+    throw std::runtime_error(
+        "failed to create temporary file: " + compressed.string() + ": " + std::strerror(errno));
+  }
+  fclose(fp);
+
+  try {
+    file.clear();
+    file.seekg(0);
+    std::ofstream out(compressed, std::ios::binary | std::ios::trunc);
+    fstree::compress(file, out);
+    out.close();
+    if (!out) {
+      throw std::runtime_error("failed to write compressed object: " + compressed.string());
+    }
+  }
+  catch (...) {
+    std::filesystem::remove(compressed, ec);
+    std::filesystem::remove(tmp, ec);
+    throw;
+  }
+
+  file.close();
+  std::filesystem::remove(tmp, ec);
+  install_object(compressed, compressed_path(hash));
+}
+
+void cache::install_object(const std::filesystem::path& tmp, const std::filesystem::path& object_path) {
+  std::error_code ec;
+
+  uint64_t size = std::filesystem::file_size(tmp, ec);
+  if (ec) {
+    std::filesystem::remove(tmp, ec);
+    throw std::runtime_error("failed to stat temporary file: " + tmp.string() + ": " + ec.message());
+  }
+
   if (!std::filesystem::create_directories(object_path.parent_path(), ec)) {
     // If the directory already exists, it's fine.
     if (ec) {
@@ -273,6 +697,119 @@ void cache::create_dirtree(inode::ptr& node) {
     std::filesystem::remove(tmp, ec);
     throw std::runtime_error("failed to rename temporary file: " + tmp.string() + ": " + ec.message());
   }
+
+  record_object(object_path, size);
+}
+
+std::string cache::catalog_path(const std::filesystem::path& object_path) {
+  return object_path.lexically_relative(_objectdir).generic_string();
+}
+
+void cache::record_object(const std::filesystem::path& object_path, uint64_t size) {
+  auto now = std::chrono::system_clock::now().time_since_epoch();
+  _catalog.add(catalog_path(object_path), size, std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+}
+
+bool cache::use_object(const std::filesystem::path& object_path) {
+  // The access is logged with the next flush instead of touching the
+  // object, so lookups don't write to the filesystem
+  if (!fstree::file_exists(object_path)) {
+    return false;
+  }
+
+  auto now = std::chrono::system_clock::now().time_since_epoch();
+  _catalog.access(catalog_path(object_path), std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+  return true;
+}
+
+void cache::flush_catalog() {
+  if (!_catalog.has_pending()) {
+    return;
+  }
+
+  auto lock = _lock.lock();
+  _catalog.flush();
+}
+
+std::filesystem::path cache::manifest_path(const fstree::digest& tree) {
+  auto hex = tree.hexdigest();
+  return _objectdir / hex.substr(0, 2) / (hex.substr(2) + ".manifest");
+}
+
+bool cache::load_manifest(const fstree::digest& tree, fstree::index& index) {
+  std::filesystem::path path = manifest_path(tree);
+  if (!use_object(path)) {
+    return false;
+  }
+
+  try {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+      throw std::runtime_error("failed to open manifest: " + path.string() + ": " + std::strerror(errno));
+    }
+
+    // Tree objects may have been evicted while the manifest was kept
+    read_manifest(file, tree, index, [this](const fstree::digest& hash, std::string_view data) { store_tree(hash, data); });
+  }
+  catch (const std::exception& e) {
+    event("warning", path.string(), e.what());
+    index.clear();
+    return false;
+  }
+
+  return true;
+}
+
+bool cache::pull_manifest(fstree::remote& remote, const fstree::digest& tree, fstree::index& index) {
+  if (load_manifest(tree, index)) {
+    return true;
+  }
+
+  std::error_code ec;
+  std::filesystem::path path = manifest_path(tree);
+  std::filesystem::path tmp;
+  if (copy_secondary(path, tmp)) {
+    event("cache::promote_manifest", tree.string());
+    install_object(tmp, path);
+  }
+  else {
+    tmp = _tmpdir;
+    FILE* fp = fstree::mkstemp(tmp);
+    if (!fp) {
+      throw std::runtime_error("failed to create temporary file: " + tmp.string() + ": " + std::strerror(errno));
+    }
+    fclose(fp);
+
+    // Manifests are optional, so a remote without one is not an error
+    try {
+      remote.read_object(manifest_key(tree), tmp, _tmpdir);
+    }
+    catch (const std::exception& e) {
+      std::filesystem::remove(tmp, ec);
+      return false;
+    }
+
+    event("cache::pull_manifest", tree.string());
+    install_object(tmp, path);
+  }
+
+  if (!load_manifest(tree, index)) {
+    std::filesystem::remove(path, ec);
+    return false;
+  }
+
+  return true;
+}
+
+void cache::save_manifest(const inode& root) {
+  std::filesystem::path path = manifest_path(root.hash());
+  if (use_object(path)) {
+    return;
+  }
+
+  std::ostringstream data(std::ios::binary);
+  write_manifest(data, root);
+  write_loose(path, data.view());
 }
 
 std::filesystem::path cache::file_path(const fstree::digest& hash) {
@@ -282,6 +819,11 @@ std::filesystem::path cache::file_path(const fstree::digest& hash) {
 
 std::filesystem::path cache::file_path(const inode::ptr& inode) { return file_path(inode->hash()); }
 
+std::filesystem::path cache::compressed_path(const fstree::digest& hash) {
+  auto hex = hash.hexdigest();
+  return _objectdir / hex.substr(0, 2) / (hex.substr(2) + ".file.zst");
+}
+
 std::filesystem::path cache::tree_path(const fstree::digest& hash) {
   auto hex = hash.hexdigest();
   return _objectdir / hex.substr(0, 2) / (hex.substr(2) + ".tree");
@@ -294,55 +836,367 @@ void cache::pull_object(fstree::remote& remote, const fstree::digest& hash) {
   auto lock = _lock.lock();
 #endif
   if (!has_object(hash)) {
+    if (promote_object(hash)) {
+      return;
+    }
+
     event("cache::pull_object", hash.string());
+    if (_pack_objects) {
+      pull_packed(remote, hash, pack_store::kind::file);
+      return;
+    }
+    if (_compress) {
+      pull_compressed(remote, hash);
+      return;
+    }
     std::filesystem::path object_path = file_path(hash);
     remote.read_object(hash, object_path, _tmpdir);
+    record_object(object_path, std::filesystem::file_size(object_path));
   }
 }
 
-void cache::pull_tree(fstree::remote& remote, const fstree::digest& hash) {
-#ifdef _WIN32
-  auto lock = _lock.lock();
-#endif
-  if (!has_tree(hash)) {
-    event("cache::pull_tree", hash.string());
-    std::filesystem::path object_path = tree_path(hash);
-    remote.read_object(hash, object_path, _tmpdir);
+bool cache::read_secondary_pack(const fstree::digest& hash, pack_store::kind kind, std::string& data) {
+  // A pack of the other cache may be corrupt or cut short, and the remote
+  // still has the object
+  try {
+    return _secondary_packs->read(hash, kind, data);
+  }
+  catch (const std::exception& e) {
+    event("warning", _secondary_objectdir.string(), e.what());
+    return false;
   }
 }
 
-bool cache::has_object(const fstree::digest& hash) {
-  std::filesystem::path object = file_path(hash);
-  // Check if the object exists and is a regular file
-  // by opening it for reading. This modifies the
-  // access time so that the eviction algorithm can
-  // take it into account.
+bool cache::copy_secondary(const std::filesystem::path& object_path, std::filesystem::path& tmp) {
+  if (_secondary_objectdir.empty()) {
+    return false;
+  }
 
-  return fstree::touch(object);
-}
+  std::filesystem::path from = _secondary_objectdir / object_path.lexically_relative(_objectdir);
+  if (!fstree::file_exists(from)) {
+    return false;
+  }
 
-bool cache::has_tree(const fstree::digest& hash) {
-  std::filesystem::path object = tree_path(hash);
-  // Check if the object exists and is a regular file
-  // by opening it for reading. This modifies the
-  // access time so that the eviction algorithm can
-  // take it into account.
+  tmp = _tmpdir;
+  FILE* fp = fstree::mkstemp(tmp);
+  if (!fp) {
+    throw std::runtime_error("failed to create temporary file: " + tmp.string() + ": " + std::strerror(errno));
+  }
+  fclose(fp);
+
+  // The object may be evicted from the secondary tier while it's copied,
+  // and the remote still has it
+  try {
+    fstree::copy_file(from, tmp, _ingest_method);
+  }
+  catch (const std::exception& e) {
+    std::error_code ec;
+    std::filesystem::remove(tmp, ec);
+    event("warning", from.string(), e.what());
+    return false;
+  }
+
+  return true;
+}
+
+bool cache::promote_object(const fstree::digest& hash) {
+  if (!_secondary_packs) {
+    return false;
+  }
+
+  std::string data;
+  if (read_secondary_pack(hash, pack_store::kind::file, data)) {
+    event("cache::promote_object", hash.string());
+    if (_pack_objects && data.size() <= g_pack_object_size_limit) {
+      _packs.write(hash, pack_store::kind::file, data);
+    }
+    else {
+      write_loose(file_path(hash), data);
+    }
+    return true;
+  }
+
+  std::filesystem::path tmp;
+  if (copy_secondary(file_path(hash), tmp)) {
+    event("cache::promote_object", hash.string());
+    install_file(tmp, hash);
+    return true;
+  }
+
+  // Compressed objects can only be promoted by builds that can read them
+  if (compression_supported() && copy_secondary(compressed_path(hash), tmp)) {
+    event("cache::promote_object", hash.string());
+    install_object(tmp, compressed_path(hash));
+    return true;
+  }
+
+  return false;
+}
+
+bool cache::promote_tree(const fstree::digest& hash) {
+  if (!_secondary_packs) {
+    return false;
+  }
+
+  std::string data;
+  if (read_secondary_pack(hash, pack_store::kind::tree, data)) {
+    event("cache::promote_tree", hash.string());
+    if (_pack_objects) {
+      _packs.write(hash, pack_store::kind::tree, data);
+    }
+    else {
+      write_loose(tree_path(hash), data);
+    }
+    return true;
+  }
+
+  std::filesystem::path tmp;
+  if (copy_secondary(tree_path(hash), tmp)) {
+    event("cache::promote_tree", hash.string());
+    install_object(tmp, tree_path(hash));
+    return true;
+  }
+
+  return false;
+}
+
+void cache::pull_compressed(fstree::remote& remote, const fstree::digest& hash) {
+  std::error_code ec;
+
+  std::filesystem::path tmp = _tmpdir;
+  FILE* fp = fstree::mkstemp(tmp);
+  if (!fp) {
+    throw std::runtime_error("failed to create temporary file: " + tmp.string() + ": " + std::strerror(errno));
+  }
+  fclose(fp);
+
+  try {
+    remote.read_object(hash, tmp, _tmpdir);
+  }
+  catch (...) {
+    std::filesystem::remove(tmp, ec);
+    throw;
+  }
+
+  install_file(tmp, hash);
+}
+
+void cache::pull_tree(fstree::remote& remote, const fstree::digest& hash) {
+#ifdef _WIN32
+  auto lock = _lock.lock();
+#endif
+  if (!has_tree(hash)) {
+    if (promote_tree(hash)) {
+      return;
+    }
+
+    event("cache::pull_tree", hash.string());
+    if (_pack_objects) {
+      pull_packed(remote, hash, pack_store::kind::tree);
+      return;
+    }
+    std::filesystem::path object_path = tree_path(hash);
+    remote.read_object(hash, object_path, _tmpdir);
+    record_object(object_path, std::filesystem::file_size(object_path));
+  }
+}
+
+void cache::pull_packed(fstree::remote& remote, const fstree::digest& hash, pack_store::kind kind) {
+  std::error_code ec;
+
+  std::filesystem::path tmp = _tmpdir;
+  FILE* fp = fstree::mkstemp(tmp);
+  if (!fp) {
+    throw std::runtime_error("failed to create temporary file: " + tmp.string() + ": " + std::strerror(errno));
+  }
+  fclose(fp);
+
+  try {
+    remote.read_object(hash, tmp, _tmpdir);
+  }
+  catch (...) {
+    std::filesystem::remove(tmp, ec);
+    throw;
+  }
+
+  // Large file objects are kept as loose files
+  size_t size = std::filesystem::file_size(tmp, ec);
+  if (kind == pack_store::kind::file && (ec || size > g_pack_object_size_limit)) {
+    install_file(tmp, hash);
+    return;
+  }
+
+  std::ifstream file(tmp, std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  bool failed = !file && !file.eof();
+  file.close();
+  std::filesystem::remove(tmp, ec);
+  if (failed) {
+    throw std::runtime_error("failed to read temporary file: " + tmp.string() + ": " + std::strerror(errno));
+  }
+
+  _packs.write(hash, kind, data);
+}
+
+bool cache::extract_packed(const fstree::digest& hash, pack_store::kind kind, std::filesystem::path& tmp) {
+  std::string data;
+  if (!_packs.read(hash, kind, data)) {
+    return false;
+  }
+
+  tmp = _tmpdir;
+  FILE* fp = fstree::mkstemp(tmp);
+  if (!fp) {
+    throw std::runtime_error("failed to create temporary file: " + tmp.string() + ": " + std::strerror(errno));
+  }
+  if (fwrite(data.data(), 1, data.size(), fp) != data.size()) {
+    int err = errno;
+    fclose(fp);
+    std::error_code ec;
+    std::filesystem::remove(tmp, ec);
+    throw std::runtime_error("failed to write to temporary file: " + tmp.string() + ": " + std::strerror(err));
+  }
+  fclose(fp);
+  return true;
+}
+
+bool cache::has_object(const fstree::digest& hash) {
+  if (_packs.contains(hash, pack_store::kind::file)) {
+    return true;
+  }
+
+  return use_object(file_path(hash)) || use_object(compressed_path(hash));
+}
+
+bool cache::has_tree(const fstree::digest& hash) {
+  if (_packs.contains(hash, pack_store::kind::tree)) {
+    return true;
+  }
 
-  return fstree::touch(object);
+  return use_object(tree_path(hash));
 }
 
 void cache::copy_file(const fstree::digest& hash, const std::filesystem::path& to) {
-  std::filesystem::copy_file(file_path(hash), to, std::filesystem::copy_options::overwrite_existing);
+  std::string data;
+  if (_packs.read(hash, pack_store::kind::file, data)) {
+    std::ofstream file(to, std::ios::binary | std::ios::trunc);
+    file.write(data.data(), data.size());
+    if (!file) {
+      throw std::runtime_error("failed to write file: " + to.string() + ": " + std::strerror(errno));
+    }
+    return;
+  }
+
+  // Compressed objects are decompressed while they're written
+  std::filesystem::path compressed = compressed_path(hash);
+  if (!fstree::file_exists(file_path(hash)) && fstree::file_exists(compressed)) {
+    std::ifstream file(compressed, std::ios::binary);
+    std::ofstream out(to, std::ios::binary | std::ios::trunc);
+    if (!file || !out) {
+      throw std::runtime_error("failed to copy file: " + compressed.string() + ": " + std::strerror(errno));
+    }
+    fstree::decompress(file, out);
+    return;
+  }
+
+  fstree::copy_file(file_path(hash), to, _copy_method);
+}
+
+void cache::read_file(const fstree::digest& hash, std::string& data) {
+  if (_packs.read(hash, pack_store::kind::file, data)) {
+    return;
+  }
+
+  std::ostringstream out(std::ios::binary);
+  std::ifstream file(file_path(hash), std::ios::binary);
+  if (file) {
+    out << file.rdbuf();
+  }
+  else {
+    std::filesystem::path compressed = compressed_path(hash);
+    file.open(compressed, std::ios::binary);
+    if (!file) {
+      throw std::runtime_error("file object not found in local cache: " + hash.string());
+    }
+    fstree::decompress(file, out);
+  }
+
+  data = std::move(out).str();
 }
 
 void cache::push_object(fstree::remote& remote, const fstree::digest& hash) {
   event("cache::push_object", hash.string());
+
+  std::filesystem::path tmp;
+  if (extract_packed(hash, pack_store::kind::file, tmp)) {
+    std::error_code ec;
+    try {
+      remote.write_object(hash, tmp);
+    }
+    catch (...) {
+      std::filesystem::remove(tmp, ec);
+      throw;
+    }
+    std::filesystem::remove(tmp, ec);
+    return;
+  }
+
+  // Remotes store objects uncompressed
+  std::filesystem::path compressed = compressed_path(hash);
+  if (!fstree::file_exists(file_path(hash)) && fstree::file_exists(compressed)) {
+    std::error_code ec;
+    tmp = _tmpdir;
+    FILE* fp = fstree::mkstemp(tmp);
+    if (!fp) {
+      throw std::runtime_error("failed to create temporary file: " + tmp.string() + ": " + std::strerror(errno));
+    }
+    fclose(fp);
+
+    try {
+      std::ifstream file(compressed, std::ios::binary);
+      std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+      fstree::decompress(file, out);
+      out.close();
+      remote.write_object(hash, tmp);
+    }
+    catch (...) {
+      std::filesystem::remove(tmp, ec);
+      throw;
+    }
+    std::filesystem::remove(tmp, ec);
+    return;
+  }
+
   std::filesystem::path object_path = file_path(hash);
   remote.write_object(hash, object_path);
 }
 
 void cache::push_tree(fstree::remote& remote, const fstree::digest& hash) {
   event("cache::push_tree", hash.string());
+
+  // Shards go first, so that the remote never has an incomplete sharded tree
+  std::vector<fstree::digest> shards;
+  tree_shards(hash, shards);
+  for (const auto& shard : shards) {
+    if (!remote.has_object(shard)) {
+      push_tree(remote, shard);
+    }
+  }
+
+  std::filesystem::path tmp;
+  if (extract_packed(hash, pack_store::kind::tree, tmp)) {
+    std::error_code ec;
+    try {
+      remote.write_object(hash, tmp);
+    }
+    catch (...) {
+      std::filesystem::remove(tmp, ec);
+      throw;
+    }
+    std::filesystem::remove(tmp, ec);
+    return;
+  }
+
   std::filesystem::path object_path = tree_path(hash);
   remote.write_object(hash, object_path);
 }
@@ -362,6 +1216,18 @@ void cache::push(const fstree::index& index, fstree::remote& remote) {
   // First add the root tree to be checked
   check_trees.push_back(index.root()->hash());
 
+  // Files with inline contents have no object, so their hashes are not
+  // pushed unless another file in the tree is stored as an object.
+  std::unordered_set<fstree::digest, fstree::digest_hash> inline_objects, file_objects;
+  for (const auto& inode : index) {
+    if (inode->is_file()) {
+      (inode->has_inline_data() ? inline_objects : file_objects).insert(inode->hash());
+    }
+  }
+  for (const auto& hash : file_objects) {
+    inline_objects.erase(hash);
+  }
+
   do {
     // Lists of missing child trees and objects for the checked tree
     std::vector<fstree::digest> missing_trees, missing_objects;
@@ -389,6 +1255,8 @@ void cache::push(const fstree::index& index, fstree::remote& remote) {
 
       // Check all objects in the index
       for (const auto& inode : index) {
+        if (inode->has_inline_data()) continue;
+
         bool found = remote.has_object(inode->hash());
         if (!found) {
           if (inode->is_directory()) {
@@ -403,6 +1271,8 @@ void cache::push(const fstree::index& index, fstree::remote& remote) {
 
     // Write missing objects in parallel
     for (const auto& hash : missing_objects) {
+      if (inline_objects.count(hash) > 0) continue;
+
       event("cache::remote_missing_object", hash.string());
 
       wg.add(1);
@@ -447,6 +1317,15 @@ void cache::push(const fstree::index& index, fstree::remote& remote) {
 
     wg.wait_rethrow();
   } while (!check_trees.empty());
+
+  // The manifest is pushed last, once everything it refers to is present
+  if (_manifests && use_object(manifest_path(index.root()->hash()))) {
+    fstree::digest key = manifest_key(index.root()->hash());
+    if (!remote.has_object(key)) {
+      event("cache::push_manifest", index.root()->hash().string());
+      remote.write_object(key, manifest_path(index.root()->hash()));
+    }
+  }
 }
 
 void cache::pull(fstree::index& index, fstree::remote& remote, const fstree::digest& tree_hash) {
@@ -455,6 +1334,41 @@ void cache::pull(fstree::index& index, fstree::remote& remote, const fstree::dig
   pool& pool = get_pool();
   wait_group wg;
 
+  // Bytes of file objects pulled so far, for progress events
+  std::atomic<size_t> pulled = 0;
+
+  // With a manifest, all tree objects arrive at once and the objects can
+  // be pulled in a single pass.
+  if (_manifests && pull_manifest(remote, tree_hash, index)) {
+    event("cache::pull_size", tree_hash.string(), index.root()->size());
+
+    for (const auto& inode : index) {
+      if (!inode->is_file() || inode->has_inline_data()) continue;
+
+      wg.add(1);
+      pool.enqueue([this, &wg, &remote, &pulled, hash = inode->hash(), size = inode->size()]() {
+        try {
+          pull_object(remote, hash);
+          event("cache::pull_progress", hash.string(), pulled += size);
+          wg.done();
+        }
+        catch (const std::exception& e) {
+          wg.exception(e);
+        }
+      });
+    }
+
+    wg.wait_rethrow();
+    _packs.flush();
+    flush_catalog();
+    record_root(tree_hash);
+    return;
+  }
+
+  // Trees marked complete are read without checking their objects
+  uint64_t generation = load_markers();
+  std::vector<fstree::digest> verified;
+
   // List of missing objects
   std::vector<inode::ptr> trees;
 
@@ -471,8 +1385,33 @@ void cache::pull(fstree::index& index, fstree::remote& remote, const fstree::dig
       wg.add(1);
       pool.enqueue([this, &wg, &remote, &tree]() {
         try {
-          pull_tree(remote, tree->hash());
-          read_tree(tree->hash(), tree);
+          auto pull_sharded_tree = [&]() {
+            pull_tree(remote, tree->hash());
+
+            std::vector<fstree::digest> shards;
+            tree_shards(tree->hash(), shards);
+            for (const auto& shard : shards) {
+              pull_tree(remote, shard);
+            }
+          };
+
+          if (!is_complete(tree->hash())) {
+            pull_sharded_tree();
+            read_tree(tree->hash(), tree);
+          }
+          else {
+            // A tree marked complete may still have been removed from the
+            // cache, e.g. by hand. Its marker is dropped and the tree pulled.
+            try {
+              read_tree(tree->hash(), tree);
+            }
+            catch (const std::exception& e) {
+              event("cache::pull", tree->hash().string(), std::string("stale marker: ") + e.what());
+              drop_marker(tree->hash());
+              pull_sharded_tree();
+              read_tree(tree->hash(), tree);
+            }
+          }
           wg.done();
         }
         catch (const std::exception& e) {
@@ -484,30 +1423,48 @@ void cache::pull(fstree::index& index, fstree::remote& remote, const fstree::dig
     // Wait for all jobs to finish
     wg.wait_rethrow();
 
+    // The root tree knows the total size of the whole tree
+    if (trees.front() == index.root()) {
+      event("cache::pull_size", tree_hash.string(), index.root()->size());
+    }
+
     // Pull all objects in parallel, add trees to list of trees to pull
     std::mutex mutex;
     std::vector<inode::ptr> new_trees;
     for (auto& tree : trees) {
       wg.add(1);
-      pool.enqueue([this, &index, &wg, &remote, tree, &new_trees, &pool, &mutex]() {
-        for (auto& inode : *tree) {
+      pool.enqueue([this, &index, &wg, &remote, tree, &new_trees, &verified, &pool, &mutex, &pulled]() {
+        // The closure of a complete tree includes all of its subtrees
+        bool complete = is_complete(tree->hash());
+        if (!complete) {
+          std::lock_guard<std::mutex> lock(mutex);
+          verified.push_back(tree->hash());
+        }
+
+        for (inode* inode : *tree) {
           {
             std::lock_guard<std::mutex> lock(mutex);
-            index.push_back(inode);
+            index.push_back(inode::ptr(inode));
           }
 
-          if (inode->is_symlink()) continue;
+          if (inode->is_symlink() || inode->has_inline_data()) continue;
 
           if (inode->is_directory()) {
+            if (complete) {
+              set_complete(inode->hash());
+            }
             std::lock_guard<std::mutex> lock(mutex);
-            new_trees.push_back(inode);
+            new_trees.push_back(inode::ptr(inode));
             continue;
           }
 
+          if (complete) continue;
+
           wg.add(1);
-          pool.enqueue([this, &wg, &remote, inode]() {
+          pool.enqueue([this, &wg, &remote, &pulled, hash = inode->hash(), size = inode->size()]() {
             try {
-              pull_object(remote, inode->hash());
+              pull_object(remote, hash);
+              event("cache::pull_progress", hash.string(), pulled += size);
               wg.done();
             }
             catch (const std::exception& e) {
@@ -525,77 +1482,945 @@ void cache::pull(fstree::index& index, fstree::remote& remote, const fstree::dig
 
     trees = std::move(new_trees);
   }
+
+  _packs.flush();
+
+  if (_manifests) {
+    save_manifest(*index.root());
+  }
+
+  flush_catalog();
+  save_markers(generation, verified);
+  record_root(tree_hash);
 }
 
-void cache::evict() {
-  fstree::wait_group wg;
+bool cache::needs_evict() {
+  flush_catalog();
 
-  for (const auto& entry : sorted_directory_iterator(_objectdir, glob_list(), false)) {
-    if (entry->is_directory()) {
-      wg.add(1);
-      get_pool().enqueue([this, entry, &wg]() {
-        try {
-          evict_subdir(_objectdir / entry->path());
-          wg.done();
-        }
-        catch (const std::exception& e) {
-          wg.exception(e);
-        }
-      });
-    }
+  uint64_t loose_size = 0;
+  catalog::time_type created = 0;
+  if (!_catalog.read_size(loose_size, created) || catalog_expired(created) ||
+      _catalog.log_size() > g_catalog_log_limit) {
+    return true;
   }
 
-  wg.wait_rethrow();
+  uint64_t used = loose_size + _packs.size();
+  return used > size_limit(used);
 }
 
-void cache::evict_subdir(const std::filesystem::path& dir) {
-  const auto sort_by_mtime = [](const inode::ptr& a, const inode::ptr& b) {
-    return a->last_write_time() < b->last_write_time();
-  };
-  sorted_directory_iterator objects(dir, glob_list(), sort_by_mtime, false);
+uint64_t cache::size_limit(uint64_t used) {
+  uint64_t capacity, available;
+  if (!fstree::disk_space(_objectdir, capacity, available)) {
+    return _max_size;
+  }
 
-  // Summarize the size of all objects in the directory
-  size_t size = 0;
-  for (const auto& inode : objects) {
-    size += inode->size();
+  uint64_t reserve = capacity / 100 * g_min_free_percent;
+  if (available >= reserve) {
+    return _max_size;
   }
 
-  // Evict objects until the size is below the cache limit
-  for (const auto& inode : objects) {
-    if (size < _max_size_slice) {
-      break;
-    }
+  // Shrink by the missing free space
+  uint64_t shortfall = reserve - available;
+  return std::min<uint64_t>(_max_size, used > shortfall ? used - shortfall : 0);
+}
+
+void cache::evict() {
+  // Only one evictor runs per cache
+  if (!_evict_lock.try_lock()) {
+    event("cache::evict", _objectdir.string(), "already running");
+    return;
+  }
+  lock_file::context evicting(_evict_lock);
 
+  uint64_t loose_size = 0;
+  bool loaded = false;
+  {
     auto lock = _lock.lock();
 
-    // First check if the object is still present and if it is, check the access time
-    // with the cache lock held.
-    fstree::stat status;
+    // Objects added by this process are logged before the size is read
+    _catalog.flush();
 
-    try {
-      fstree::lstat(dir / inode->path(), status);
+    catalog::time_type created = 0;
+    if (!_catalog.read_size(loose_size, created) || catalog_expired(created)) {
+      rebuild_catalog();
+      loose_size = _catalog.size();
+      loaded = true;
     }
-    catch (const std::exception& e) {
-      // The object has likely been removed by another thread, continue with the next object.
-      continue;
+  }
+
+  uint64_t used = loose_size + _packs.size();
+  uint64_t limit = size_limit(used);
+  if (used <= limit) {
+    if (_catalog.log_size() > g_catalog_log_limit) {
+      auto lock = _lock.lock();
+      if (_catalog.load()) {
+        _catalog.compact();
+      }
+      else {
+        rebuild_catalog();
+      }
     }
+    return;
+  }
 
-    // Skip objects that have been accessed recently.
-    auto mtime = std::chrono::nanoseconds(status.last_write_time);
-    auto curtime = std::chrono::system_clock::now().time_since_epoch();
-    if (mtime + _retention_period > curtime) {
-      continue;
+  // Over the high watermark, evict down to the low watermark
+  uint64_t target = limit / 100 * g_low_watermark_percent;
+  size_t evicted = 0;
+
+  // The closures of pinned trees are kept, loose or packed
+  std::unordered_set<std::string> pinned;
+  tree_times pins;
+  read_tree_times(_objectdir / "pins", std::chrono::seconds(0), pins);
+  if (!pins.empty()) {
+    std::vector<fstree::digest> roots;
+    std::transform(pins.begin(), pins.end(), std::back_inserter(roots), [](const auto& pin) { return pin.first; });
+    mark(roots, pinned);
+  }
+
+  if (loose_size > target) {
+    {
+      auto lock = _lock.lock();
+      if (loaded) {
+        // Uses logged while the pinned trees were marked
+        _catalog.replay();
+      }
+      else if (!_catalog.load()) {
+        rebuild_catalog();
+      }
     }
 
-    std::error_code ec;
-    std::filesystem::remove(dir / inode->path(), ec);
-    if (ec) {
-      throw std::runtime_error("failed to remove cache object: " + inode->hash().string() + ": " + ec.message());
+    for (const auto& path : pinned) {
+      _catalog.pin(path);
     }
 
-    size -= inode->size();
+    // Objects are removed without the cache lock, so writers can log new
+    // objects in the meantime. Their records are replayed before the
+    // catalog is compacted.
+    evicted = evict_loose(target);
+
+    auto lock = _lock.lock();
+    _catalog.replay();
+    _catalog.compact();
+    loose_size = _catalog.size();
+  }
+
+  // Packs may use whatever the loose objects leave of the target size
+  std::function<bool(const fstree::digest&, pack_store::kind)> keep;
+  if (!pinned.empty()) {
+    keep = [&](const fstree::digest& hash, pack_store::kind kind) {
+      std::filesystem::path path = kind == pack_store::kind::tree ? tree_path(hash) : file_path(hash);
+      return pinned.count(catalog_path(path)) > 0;
+    };
+  }
 
-    event("cache::evict", (dir / inode->path()).string());
+  auto lock = _lock.lock();
+  size_t pack_size = _packs.size();
+  if (_packs.evict(target > loose_size ? target - loose_size : 0, _retention_period, keep) < pack_size) {
+    evicted++;
+  }
+
+  if (evicted > 0) {
+    invalidate_markers();
+  }
+}
+
+void cache::rebuild_catalog() {
+  event("cache::rebuild_catalog", _objectdir.string());
+
+  fstree::wait_group wg;
+  std::mutex mutex;
+  std::vector<catalog::object> objects;
+
+  for (const auto& entry : sorted_directory_iterator(_objectdir, glob_list(), false)) {
+    // Packs are evicted separately
+    if (entry->is_directory() && entry->name() != "pack") {
+      wg.add(1);
+      get_pool().enqueue([this, entry, &wg, &mutex, &objects]() {
+        try {
+          std::vector<catalog::object> found;
+          for (const auto& inode : sorted_directory_iterator(_objectdir / entry->path(), glob_list(), false)) {
+            if (inode->is_file()) {
+              found.push_back(catalog::object{entry->name() + "/" + inode->name(), inode->size(), inode->last_write_time()});
+            }
+          }
+
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::move(found.begin(), found.end(), std::back_inserter(objects));
+          }
+          wg.done();
+        }
+        catch (const std::exception& e) {
+          wg.exception(e);
+        }
+      });
+    }
+  }
+
+  wg.wait_rethrow();
+
+  // Access times logged since the last rebuild are kept
+  _catalog.load();
+  _catalog.reset(objects);
+  _catalog.compact();
+}
+
+size_t cache::evict_loose(uint64_t target) {
+  size_t evicted = 0;
+  auto now = std::chrono::system_clock::now().time_since_epoch();
+  auto before = std::chrono::duration_cast<std::chrono::nanoseconds>(now - _retention_period).count();
+  uint64_t protected_limit = target / 100 * g_protected_percent;
+
+  // Victims moved out of the way but not removed yet, and their size
+  std::vector<moved_object> moved;
+  uint64_t moved_size = 0;
+
+  while (_catalog.size() - moved_size > target) {
+    const catalog::object* victim = _catalog.victim(before, protected_limit);
+    if (!victim) {
+      break;
+    }
+
+#ifdef _WIN32
+    auto lock = _lock.lock();
+#endif
+
+    // Catalog times are lower bounds, since objects may be touched by older
+    // versions without being logged. The object is checked on disk before
+    // eviction.
+    std::string path = victim->path;
+    uint64_t size = victim->size;
+    catalog::time_type time = victim->time;
+    std::filesystem::path object_path = _objectdir / path;
+    fstree::stat status;
+    try {
+      fstree::lstat(object_path, status);
+    }
+    catch (const std::exception& e) {
+      _catalog.remove(path);
+      continue;
+    }
+
+    if (status.last_write_time > time) {
+      _catalog.touch(path, status.last_write_time);
+      continue;
+    }
+
+    // Writers don't take the lock, so one may use the object right before
+    // it's removed. The object is moved out of the way first, and writers
+    // that look for it afterwards write a new copy. Writers log their use
+    // under the lock before they rely on it, so it's visible when the moved
+    // objects are settled.
+    std::filesystem::path tmp = _tmpdir;
+    FILE* fp = fstree::mkstemp(tmp);
+    if (!fp) {
+      throw std::runtime_error("failed to create temporary file: " + tmp.string() + ": " + std::strerror(errno));
+    }
+    fclose(fp);
+
+    std::error_code ec;
+    std::filesystem::rename(object_path, tmp, ec);
+    if (ec) {
+      // The object has likely been removed by another process
+      std::filesystem::remove(tmp, ec);
+      _catalog.remove(path);
+      continue;
+    }
+
+    // The object is no victim again until it's settled
+    _catalog.pin(path);
+    moved.push_back(moved_object{path, tmp, time});
+    moved_size += size;
+
+#ifdef _WIN32
+    // Writers hold the lock while they use objects
+    evicted += settle_evicted(moved);
+    moved_size = 0;
+#else
+    if (moved.size() >= g_evict_batch_size) {
+      auto lock = _lock.lock();
+      evicted += settle_evicted(moved);
+      moved_size = 0;
+    }
+#endif
+  }
+
+  if (!moved.empty()) {
+    auto lock = _lock.lock();
+    evicted += settle_evicted(moved);
+  }
+
+  return evicted;
+}
+
+size_t cache::settle_evicted(std::vector<moved_object>& moved) {
+  size_t evicted = 0;
+
+  // Uses logged since the objects were selected
+  _catalog.replay();
+
+  for (const auto& object : moved) {
+    std::filesystem::path object_path = _objectdir / object.path;
+    const catalog::object* logged = _catalog.find(object.path);
+    catalog::time_type used = logged ? logged->time : object.time;
+
+    fstree::stat status;
+    try {
+      fstree::lstat(object.tmp, status);
+      used = std::max(used, status.last_write_time);
+    }
+    catch (const std::exception& e) {
+    }
+
+    // Moving back replaces a copy written in the meantime, which has the
+    // same contents
+    std::error_code ec;
+    if (used > object.time) {
+      std::filesystem::rename(object.tmp, object_path, ec);
+      if (!ec) {
+        _catalog.touch(object.path, used);
+        continue;
+      }
+    }
+
+    std::filesystem::remove(object.tmp, ec);
+    if (ec) {
+      throw std::runtime_error("failed to remove cache object: " + object_path.string() + ": " + ec.message());
+    }
+
+    _catalog.remove(object.path);
+    evicted++;
+
+    event("cache::evict", object_path.string());
+  }
+
+  moved.clear();
+  return evicted;
+}
+
+void cache::pin(const fstree::digest& tree, std::chrono::seconds duration) {
+  auto lock = _lock.lock();
+
+  tree_times pins;
+  read_tree_times(_objectdir / "pins", std::chrono::seconds(0), pins);
+
+  auto expiry = std::chrono::system_clock::now().time_since_epoch() + duration;
+  pins[tree] = std::chrono::duration_cast<std::chrono::nanoseconds>(expiry).count();
+  write_tree_times(_objectdir / "pins", pins);
+}
+
+void cache::unpin(const fstree::digest& tree) {
+  auto lock = _lock.lock();
+
+  tree_times pins;
+  read_tree_times(_objectdir / "pins", std::chrono::seconds(0), pins);
+  if (pins.erase(tree) > 0) {
+    write_tree_times(_objectdir / "pins", pins);
+  }
+}
+
+void cache::record_root(const fstree::digest& tree) {
+  auto lock = _lock.lock();
+
+  tree_times roots;
+  read_tree_times(_objectdir / "roots", g_root_lifetime, roots);
+
+  auto now = std::chrono::system_clock::now().time_since_epoch();
+  roots[tree] = std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+  write_tree_times(_objectdir / "roots", roots);
+}
+
+void cache::live_roots(std::vector<fstree::digest>& roots) {
+  tree_times pins;
+  read_tree_times(_objectdir / "pins", std::chrono::seconds(0), pins);
+  for (const auto& [tree, expiry] : pins) {
+    roots.push_back(tree);
+  }
+
+  tree_times used;
+  read_tree_times(_objectdir / "roots", g_root_lifetime, used);
+  for (const auto& [tree, time] : used) {
+    roots.push_back(tree);
+  }
+}
+
+void cache::read_tree_times(const std::filesystem::path& path, std::chrono::seconds lifetime, tree_times& trees) {
+  auto now = std::chrono::system_clock::now().time_since_epoch();
+
+  // Each line is a tree digest and a time in nanoseconds
+  std::ifstream file(path);
+  std::string hash;
+  catalog::time_type time;
+  while (file >> hash >> time) {
+    fstree::digest tree = fstree::digest::parse(hash);
+    if (!tree.empty() && std::chrono::nanoseconds(time) + lifetime > now) {
+      trees[tree] = time;
+    }
+  }
+}
+
+void cache::write_tree_times(const std::filesystem::path& path, const tree_times& trees) {
+  std::error_code ec;
+  std::filesystem::path tmp = _tmpdir;
+  FILE* fp = fstree::mkstemp(tmp);
+  if (!fp) {
+    throw std::runtime_error("failed to create temporary file: " + tmp.string() + ": " + std::strerror(errno));
+  }
+
+  for (const auto& [tree, time] : trees) {
+    fprintf(fp, "%s %lld\n", tree.string().c_str(), static_cast<long long>(time));
+  }
+
+  if (ferror(fp)) {
+    int err = errno;
+    fclose(fp);
+    std::filesystem::remove(tmp, ec);
+    throw std::runtime_error("failed to write to temporary file: " + tmp.string() + ": " + std::strerror(err));
+  }
+  fclose(fp);
+
+  // The list isn't a cache object, so it isn't recorded in the catalog
+  std::filesystem::rename(tmp, path, ec);
+  if (ec) {
+    std::filesystem::remove(tmp, ec);
+    throw std::runtime_error("failed to rename temporary file: " + tmp.string() + ": " + ec.message());
+  }
+}
+
+void cache::mark(const std::vector<fstree::digest>& roots, std::unordered_set<std::string>& live) {
+  auto& pool = get_pool();
+  fstree::wait_group wg;
+  std::mutex mutex;
+  std::unordered_set<fstree::digest, fstree::digest_hash> visited;
+
+  // Each tree is read by its own task, which schedules the subtrees that
+  // haven't been visited yet
+  std::function<void(const fstree::digest&)> visit = [&](const fstree::digest& hash) {
+    try {
+      std::vector<std::string> objects{catalog_path(tree_path(hash))};
+      std::vector<fstree::digest> subtrees;
+
+      inode_arena::ptr arena = make_intrusive<inode_arena>();
+      inode::ptr tree = arena->make();
+      try {
+        std::vector<fstree::digest> shards;
+        tree_shards(hash, shards);
+        for (const auto& shard : shards) {
+          objects.push_back(catalog_path(tree_path(shard)));
+        }
+        read_tree(hash, tree);
+      }
+      catch (const std::exception& e) {
+        // The missing parts of a closure are pulled again on use
+      }
+
+      for (const inode* child : *tree) {
+        if (child->is_directory()) {
+          subtrees.push_back(child->hash());
+        }
+        else if (child->is_file() && !child->has_inline_data()) {
+          objects.push_back(catalog_path(file_path(child->hash())));
+          objects.push_back(catalog_path(compressed_path(child->hash())));
+        }
+      }
+
+      // The lock is released before the task is done, since the mutex goes
+      // away once the last task is
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::move(objects.begin(), objects.end(), std::inserter(live, live.end()));
+        for (const auto& subtree : subtrees) {
+          if (visited.insert(subtree).second) {
+            wg.add(1);
+            pool.enqueue([&visit, subtree]() { visit(subtree); });
+          }
+        }
+      }
+      wg.done();
+    }
+    catch (const std::exception& e) {
+      wg.exception(e);
+    }
+  };
+
+  for (const auto& root : roots) {
+    std::lock_guard<std::mutex> lock(mutex);
+    live.insert(catalog_path(manifest_path(root)));
+    if (visited.insert(root).second) {
+      wg.add(1);
+      pool.enqueue([&visit, root]() { visit(root); });
+    }
+  }
+
+  wg.wait_rethrow();
+}
+
+void cache::gc(const std::vector<fstree::digest>& roots) {
+  // Collection excludes eviction and other collections
+  if (!_evict_lock.try_lock()) {
+    event("cache::gc", _objectdir.string(), "eviction already running");
+    return;
+  }
+  lock_file::context evicting(_evict_lock);
+
+  {
+    auto lock = _lock.lock();
+    _catalog.flush();
+
+    catalog::time_type created = 0;
+    uint64_t size = 0;
+    if (!_catalog.read_size(size, created) || catalog_expired(created) || !_catalog.load()) {
+      rebuild_catalog();
+    }
+  }
+
+  std::vector<fstree::digest> live_trees = roots;
+  live_roots(live_trees);
+
+  std::unordered_set<std::string> live;
+  mark(live_trees, live);
+
+  // Objects used while the trees were marked are within the retention period
+  {
+    auto lock = _lock.lock();
+    _catalog.replay();
+  }
+  for (const auto& path : live) {
+    _catalog.pin(path);
+  }
+  event("cache::gc", _objectdir.string(), live.size());
+
+  // Unreachable objects are swept whole, except those written within the
+  // retention period that may belong to a tree that isn't recorded yet
+  size_t evicted = evict_loose(0);
+
+  // Packs are removed whole, so a pack is kept while any of its objects is live
+  auto keep = [&](const fstree::digest& hash, pack_store::kind kind) {
+    std::filesystem::path path = kind == pack_store::kind::tree ? tree_path(hash) : file_path(hash);
+    return live.count(catalog_path(path)) > 0;
+  };
+
+  auto lock = _lock.lock();
+  _catalog.replay();
+  _catalog.compact();
+
+  size_t pack_size = _packs.size();
+  if (_packs.evict(0, _retention_period, keep) < pack_size) {
+    evicted++;
+  }
+
+  if (evicted > 0) {
+    invalidate_markers();
+  }
+}
+
+// Parses a tree object, throwing if it's malformed
+static void parse_tree(std::string data) {
+  inode_arena::ptr arena(new inode_arena());
+  auto root = arena->make();
+  std::vector<fstree::digest> shards;
+  std::istringstream stream(std::move(data), std::ios::binary);
+  fstree::read_tree(stream, *root, shards);
+}
+
+std::vector<std::string> cache::fsck(uint64_t max_bytes, uint64_t rate) {
+  std::error_code ec;
+  std::filesystem::path quarantine = _objectdir.parent_path() / "quarantine";
+  std::filesystem::create_directories(quarantine, ec);
+  if (ec) {
+    throw std::runtime_error("failed to create quarantine directory: " + quarantine.string() + ": " + ec.message());
+  }
+
+  // The cursor is the name of the last object checked by an unfinished pass
+  std::filesystem::path cursor_path = _objectdir / "fsck";
+  std::string cursor;
+  if (max_bytes > 0) {
+    std::ifstream file(cursor_path);
+    std::getline(file, cursor);
+  }
+
+  // Loose objects are checked in name order, followed by the packs
+  std::vector<std::pair<std::string, uint64_t>> objects;
+  uint64_t selected = 0;
+  auto select = [&](std::string path, uint64_t size) {
+    if (max_bytes > 0 && selected >= max_bytes) {
+      return false;
+    }
+    if (path > cursor) {
+      objects.emplace_back(std::move(path), size);
+      selected += size;
+    }
+    return true;
+  };
+
+  std::vector<std::string> subdirs;
+  for (const auto& entry : std::filesystem::directory_iterator(_objectdir, ec)) {
+    std::string name = entry.path().filename().string();
+    if (name.size() == 2 && entry.is_directory() && name >= cursor.substr(0, 2)) {
+      subdirs.push_back(name);
+    }
+  }
+  std::sort(subdirs.begin(), subdirs.end());
+
+  bool full = false;
+  for (const auto& subdir : subdirs) {
+    std::vector<std::pair<std::string, uint64_t>> entries;
+    for (const auto& entry : std::filesystem::directory_iterator(_objectdir / subdir, ec)) {
+      uint64_t size = entry.file_size(ec);
+      if (!ec) {
+        entries.emplace_back(subdir + "/" + entry.path().filename().string(), size);
+      }
+    }
+    std::sort(entries.begin(), entries.end());
+
+    for (auto& [path, size] : entries) {
+      if (!select(std::move(path), size)) {
+        full = true;
+        break;
+      }
+    }
+    if (full) break;
+  }
+
+  // Packs are listed from disk, including those that failed to load
+  std::vector<std::string> packs;
+  for (const auto& entry : std::filesystem::directory_iterator(_objectdir / "pack", ec)) {
+    if (entry.path().extension() == ".idx") {
+      packs.push_back(entry.path().stem().string());
+    }
+  }
+  std::sort(packs.begin(), packs.end());
+
+  for (const auto& name : packs) {
+    if (full) break;
+    uint64_t size = std::filesystem::file_size(_objectdir / "pack" / (name + ".pack"), ec);
+    full = !select("pack/" + name, ec ? 0 : size);
+  }
+
+  event("cache::fsck", _objectdir.string(), selected);
+
+  // Reads are spread out evenly over time to stay within the rate
+  auto start = std::chrono::steady_clock::now();
+  std::atomic<uint64_t> scheduled = 0;
+
+  pool& pool = get_pool();
+  wait_group wg;
+  std::mutex mutex;
+  std::vector<std::string> corrupt;
+
+  for (const auto& [path, size] : objects) {
+    wg.add(1);
+    pool.enqueue([this, &wg, &mutex, &corrupt, &scheduled, &quarantine, start, rate, path, size]() {
+      try {
+        if (rate > 0) {
+          double offset = static_cast<double>(scheduled.fetch_add(size)) / rate;
+          std::this_thread::sleep_until(
+              start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(offset)));
+        }
+
+        std::string error;
+        bool pack = path.compare(0, 5, "pack/") == 0;
+        bool valid = pack ? check_pack(path.substr(5), error) : check_loose(path, error);
+        if (!valid) {
+          event("cache::quarantine", path, error);
+          if (pack) {
+            _packs.quarantine(path.substr(5), quarantine);
+          }
+          else {
+            std::error_code ec;
+            std::filesystem::rename(
+                _objectdir / path, quarantine / (path.substr(0, 2) + path.substr(3)), ec);
+            if (ec) {
+              throw std::runtime_error("failed to quarantine object: " + path + ": " + ec.message());
+            }
+          }
+
+          std::lock_guard<std::mutex> lock(mutex);
+          corrupt.push_back(path);
+        }
+
+        wg.done();
+      }
+      catch (const std::exception& e) {
+        wg.exception(e);
+      }
+    });
+  }
+
+  wg.wait_rethrow();
+
+  // Trees whose closures were complete may refer to quarantined objects
+  auto lock = _lock.lock();
+  if (!corrupt.empty()) {
+    invalidate_markers();
+  }
+
+  // A finished pass starts over on the next run
+  std::string next = full ? objects.empty() ? cursor : objects.back().first : std::string();
+  std::filesystem::path tmp = _tmpdir;
+  FILE* fp = fstree::mkstemp(tmp);
+  if (!fp) {
+    throw std::runtime_error("failed to create temporary file: " + tmp.string() + ": " + std::strerror(errno));
+  }
+  fprintf(fp, "%s\n", next.c_str());
+  fclose(fp);
+
+  std::filesystem::rename(tmp, cursor_path, ec);
+  if (ec) {
+    std::filesystem::remove(tmp, ec);
+    throw std::runtime_error("failed to rename temporary file: " + tmp.string() + ": " + ec.message());
+  }
+
+  std::sort(corrupt.begin(), corrupt.end());
+  return corrupt;
+}
+
+bool cache::check_loose(const std::string& path, std::string& error) {
+  // Names are the hex digest split after two characters, and a suffix for the kind
+  size_t dot = path.find('.', 3);
+  if (path.size() < 4 || path[2] != '/' || dot == std::string::npos) {
+    return true;
+  }
+  std::string suffix = path.substr(dot);
+  std::filesystem::path object_path = _objectdir / path;
+
+  fstree::digest expected;
+  try {
+    expected = fstree::digest(hash_function, path.substr(0, 2) + path.substr(3, dot - 3));
+  }
+  catch (const std::exception& e) {
+    return true;
+  }
+
+  try {
+    if (suffix == ".file") {
+      if (hashsum_hex_file(object_path) != expected) {
+        error = "digest mismatch";
+        return false;
+      }
+    }
+    else if (suffix == ".file.zst") {
+      if (!compression_supported()) {
+        return true;
+      }
+
+      std::filesystem::path tmp = _tmpdir;
+      FILE* fp = fstree::mkstemp(tmp);
+      if (!fp) {
+        throw std::runtime_error("failed to create temporary file: " + tmp.string() + ": " + std::strerror(errno));
+      }
+      fclose(fp);
+
+      fstree::digest actual;
+      try {
+        std::ifstream file(object_path, std::ios::binary);
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!file) {
+          throw std::runtime_error("failed to open file: " + object_path.string() + ": " + std::strerror(errno));
+        }
+        fstree::decompress(file, out);
+        out.close();
+        actual = hashsum_hex_file(tmp);
+      }
+      catch (...) {
+        std::error_code ec;
+        std::filesystem::remove(tmp, ec);
+        throw;
+      }
+
+      std::error_code ec;
+      std::filesystem::remove(tmp, ec);
+      if (actual != expected) {
+        error = "digest mismatch";
+        return false;
+      }
+    }
+    else if (suffix == ".tree" || suffix == ".manifest") {
+      std::ifstream file(object_path, std::ios::binary);
+      if (!file) {
+        throw std::runtime_error("failed to open file: " + object_path.string() + ": " + std::strerror(errno));
+      }
+      std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+      // Manifests are named after their root tree and verify their own contents
+      if (suffix == ".manifest") {
+        std::istringstream stream(std::move(data), std::ios::binary);
+        fstree::index index;
+        read_manifest(stream, expected, index);
+      }
+      else if (hashsum_hex(data) != expected) {
+        error = "digest mismatch";
+        return false;
+      }
+      else {
+        parse_tree(std::move(data));
+      }
+    }
+  }
+  catch (const std::exception& e) {
+    // The object may have been evicted while it was read
+    if (!fstree::file_exists(object_path)) {
+      return true;
+    }
+    error = e.what();
+    return false;
+  }
+
+  return true;
+}
+
+bool cache::check_pack(const std::string& name, std::string& error) {
+  try {
+    _packs.visit(name, [&](const fstree::digest& hash, pack_store::kind kind, std::string_view data) {
+      if (error.empty() && hashsum_hex(data) != hash) {
+        error = "digest mismatch: " + hash.string();
+      }
+      if (error.empty() && kind == pack_store::kind::tree) {
+        parse_tree(std::string(data));
+      }
+    });
+  }
+  catch (const std::exception& e) {
+    // The pack may have been evicted while it was read
+    std::error_code ec;
+    if (!std::filesystem::exists(_objectdir / "pack" / (name + ".idx"), ec)) {
+      return true;
+    }
+    error = e.what();
+  }
+
+  return error.empty();
+}
+
+uint64_t cache::load_markers() {
+  // The first line is the generation, followed by one tree digest per line
+  std::ifstream file(_objectdir / "complete");
+  uint64_t generation = 0;
+  file >> generation;
+
+  // Markers of earlier loads may refer to objects evicted since, so only
+  // the current ones are kept
+  std::lock_guard<std::mutex> lock(_complete_mutex);
+  _complete.clear();
+  std::string hash;
+  while (file >> hash) {
+    fstree::digest tree = fstree::digest::parse(hash);
+    if (!tree.empty()) {
+      _complete.insert(tree);
+    }
+  }
+
+  return generation;
+}
+
+bool cache::is_complete(const fstree::digest& tree) {
+  std::lock_guard<std::mutex> lock(_complete_mutex);
+  return _complete.count(tree) > 0;
+}
+
+void cache::set_complete(const fstree::digest& tree) {
+  std::lock_guard<std::mutex> lock(_complete_mutex);
+  _complete.insert(tree);
+}
+
+void cache::drop_marker(const fstree::digest& tree) {
+  {
+    std::lock_guard<std::mutex> lock(_complete_mutex);
+    _complete.erase(tree);
+  }
+
+  auto lock = _lock.lock();
+
+  std::filesystem::path path = _objectdir / "complete";
+  std::ifstream file(path);
+  uint64_t generation = 0;
+  if (!(file >> generation)) {
+    return;
+  }
+
+  std::ostringstream data;
+  data << generation << "\n";
+  bool found = false;
+  std::string hash;
+  while (file >> hash) {
+    if (hash == tree.string()) {
+      found = true;
+      continue;
+    }
+    data << hash << "\n";
+  }
+  file.close();
+  if (!found) {
+    return;
+  }
+
+  std::filesystem::path tmp = path;
+  tmp += ".tmp";
+  std::ofstream out(tmp, std::ios::trunc);
+  out << data.view();
+  out.close();
+
+  std::error_code ec;
+  if (out) {
+    std::filesystem::rename(tmp, path, ec);
+  }
+  if (!out || ec) {
+    std::filesystem::remove(tmp, ec);
+    std::filesystem::remove(path, ec);
+    throw std::runtime_error("failed to drop closure marker: " + path.string());
+  }
+}
+
+void cache::save_markers(uint64_t generation, const std::vector<fstree::digest>& trees) {
+  if (trees.empty()) {
+    return;
+  }
+
+  auto lock = _lock.lock();
+
+  // Objects evicted since the markers were loaded may belong to the trees
+  std::filesystem::path path = _objectdir / "complete";
+  uint64_t current = 0;
+  std::ifstream(path) >> current;
+  if (current != generation) {
+    return;
+  }
+
+  std::ostringstream data;
+  if (!std::filesystem::exists(path)) {
+    data << generation << "\n";
+  }
+  for (const auto& tree : trees) {
+    data << tree.string() << "\n";
+  }
+
+  std::ofstream file(path, std::ios::app);
+  file << data.view();
+  file.close();
+  if (!file) {
+    throw std::runtime_error("failed to write closure markers: " + path.string() + ": " + std::strerror(errno));
+  }
+}
+
+void cache::invalidate_markers() {
+  std::filesystem::path path = _objectdir / "complete";
+  uint64_t generation = 0;
+  std::ifstream(path) >> generation;
+
+  std::filesystem::path tmp = path;
+  tmp += ".tmp";
+  std::ofstream file(tmp, std::ios::trunc);
+  file << generation + 1 << "\n";
+  file.close();
+
+  std::error_code ec;
+  if (file) {
+    std::filesystem::rename(tmp, path, ec);
+  }
+  if (!file || ec) {
+    std::filesystem::remove(tmp, ec);
+    std::filesystem::remove(path, ec);
+    throw std::runtime_error("failed to invalidate closure markers: " + path.string());
   }
 }
 
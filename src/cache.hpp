@@ -1,21 +1,44 @@
 #pragma once
 
+#include "catalog.hpp"
 #include "digest.hpp"
+#include "filesystem.hpp"
 #include "index.hpp"
 #include "lock_file.hpp"
+#include "pack_store.hpp"
 #include "remote.hpp"
+#include "tree_cache.hpp"
 
 #include <string>
+#include <string_view>
 #include <filesystem>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace fstree {
 
 class cache {
   std::filesystem::path _objectdir, _tmpdir;
   size_t _max_size;
-  size_t _max_size_slice;
   std::chrono::seconds _retention_period{3600};
   lock_file _lock;
+  lock_file _evict_lock;
+  catalog _catalog;
+  pack_store _packs;
+  bool _pack_objects = false;
+  bool _manifests = false;
+  size_t _inline_size = 0;
+  copy_method _copy_method = copy_method::automatic;
+  copy_method _ingest_method = copy_method::automatic;
+  bool _compress = false;
+  std::filesystem::path _secondary_objectdir;
+  std::unique_ptr<pack_store> _secondary_packs;
+  tree_cache _trees;
+  std::mutex _complete_mutex;
+  std::unordered_set<fstree::digest, fstree::digest_hash> _complete;
 
  public:
   static std::filesystem::path default_path();
@@ -29,7 +52,46 @@ class cache {
   // Constructor
   explicit cache(const std::filesystem::path& path, size_t max_size, std::chrono::seconds retention_period);
 
+  // Destructor, logs objects added since the last flush to the catalog
+  ~cache();
+
+  // Stores new tree objects and small file objects in pack files instead
+  // of loose files. Packed objects are always readable regardless.
+  void set_pack_objects(bool enabled);
+
+  // Writes a manifest for each root tree added or pulled, and exchanges
+  // manifests with remotes on push and pull. Local manifests are always
+  // used by index_from_tree when present.
+  void set_manifests(bool enabled);
+
+  // Stores the contents of files smaller than size in their tree entries
+  // instead of separate objects. Zero disables inlining. The threshold
+  // changes the tree hashes of directories with small files.
+  void set_inline_size(size_t size);
+
+  // Selects how file objects are copied to the workspace on checkout.
+  // Packed objects are always written from memory.
+  void set_copy_method(copy_method method);
+
+  // Selects how new workspace files are copied into the cache. A clone
+  // shares the data blocks with the workspace file until either is
+  // modified, so the object stays intact.
+  void set_ingest_method(copy_method method);
+
+  // Stores new file objects compressed with zstd when a probe of their
+  // contents shows that it pays off. Compressed objects are always
+  // readable by builds with compression support. Throws if this build
+  // lacks it.
+  void set_compression(bool enabled);
+
+  // Reads objects missing from this cache from another cache directory,
+  // typically on storage shared between hosts, before pulling them from
+  // a remote. Objects found there are copied into this cache. The other
+  // cache is never written. An empty path disables the secondary tier.
+  void set_secondary(const std::filesystem::path& path);
+
   // Retrieves the tree with the given hash from the cache.
+  // Parsed trees are kept in memory and shared by later reads.
   void read_tree(const fstree::digest& hash, inode::ptr& inode);
 
   // Creates a new index from the tree with the given hash.
@@ -70,19 +132,185 @@ class cache {
   // Copy the object with the given hash to the given path.
   void copy_file(const fstree::digest& hash, const std::filesystem::path& to);
 
-  // Evict objects from the cache until the size is below the maximum size.
+  // Reads the contents of the file object with the given hash.
+  void read_file(const fstree::digest& hash, std::string& data);
+
+  // Returns true if the cache is over its high watermark, which is the
+  // maximum size or less if the filesystem is low on free space, or if
+  // its catalog needs maintenance. The size is read from the catalog
+  // without listing the object directories.
+  bool needs_evict();
+
+  // Protects a tree and all objects it refers to from eviction for the
+  // given duration. Pinning a tree again replaces its expiry.
+  void pin(const fstree::digest& tree, std::chrono::seconds duration);
+
+  // Removes the pin of a tree
+  void unpin(const fstree::digest& tree);
+
+  // Removes all loose objects that aren't reachable from a live root: the
+  // given trees, pinned trees and trees written, pulled or checked out in
+  // the last week. Objects used within the retention period are kept.
+  // Packs are removed whole, once none of their objects is reachable.
+  void gc(const std::vector<fstree::digest>& roots);
+
+  // Evicts objects once the cache is over its high watermark, until it's
+  // below the low watermark. Loose objects are evicted in segmented LRU
+  // order, see catalog, sparing the closures of pinned trees. Returns immediately if
+  // another process is already evicting. The catalog is rebuilt from the
+  // object directories when it's missing or old.
   void evict();
 
+  // Checks that objects match their digests and that tree objects and
+  // manifests parse, and moves corrupt ones to the quarantine directory.
+  // Objects are checked in a fixed order from a persistent cursor until
+  // max_bytes have been read, so a large cache can be scrubbed across
+  // several runs. Zero checks all objects. Reads are limited to rate bytes
+  // per second unless it's zero. Returns the names of corrupt objects.
+  std::vector<std::string> fsck(uint64_t max_bytes, uint64_t rate);
+
   std::filesystem::path file_path(const inode::ptr& inode);
   std::filesystem::path tree_path(const inode::ptr& inode);
 
  private:
   void create_dirtree(inode::ptr& node);
   void create_file(const std::filesystem::path& root, const inode::ptr& inode);
-  void evict_subdir(const std::filesystem::path& dir);
+
+  // Returns the name of a loose object in the catalog
+  std::string catalog_path(const std::filesystem::path& object_path);
+
+  // Records a new loose object in the catalog
+  void record_object(const std::filesystem::path& object_path, uint64_t size);
+
+  // Returns true if a loose object exists, and records the access in the catalog
+  bool use_object(const std::filesystem::path& object_path);
+
+  // Appends recorded objects to the catalog log
+  void flush_catalog();
+
+  // Replaces the catalog with a scan of the object directories
+  void rebuild_catalog();
+
+  // Returns the size the cache may use, given its current usage. It's less
+  // than the maximum size when the filesystem is low on free space.
+  uint64_t size_limit(uint64_t used);
+
+  // Evicts loose objects in catalog order until their size is below
+  // target. Returns the number of objects removed.
+  size_t evict_loose(uint64_t target);
+
+  // A victim of eviction that has been moved out of the object directory
+  struct moved_object {
+    std::string path;
+    std::filesystem::path tmp;
+    catalog::time_type time;
+  };
+
+  // Removes moved victims that haven't been used since they were selected,
+  // according to the catalog log and their modification times, and moves
+  // the others back. Must be called with the lock held. Returns the number
+  // of objects removed.
+  size_t settle_evicted(std::vector<moved_object>& moved);
+
+  // Loads the markers of trees whose closures are complete in the cache,
+  // replacing those loaded before. Returns their generation, which changes
+  // when objects are evicted.
+  uint64_t load_markers();
+
+  // Returns true if a tree's closure is known to be complete
+  bool is_complete(const fstree::digest& tree);
+
+  // Marks a tree complete in this process, e.g. the subtree of a complete tree
+  void set_complete(const fstree::digest& tree);
+
+  // Forgets the marker of a tree whose objects turned out to be missing
+  void drop_marker(const fstree::digest& tree);
+
+  // Records markers for trees with verified closures, unless objects were
+  // evicted since the markers were loaded
+  void save_markers(uint64_t generation, const std::vector<fstree::digest>& trees);
+
+  // Drops all markers after objects were evicted. Must be called with the lock held.
+  void invalidate_markers();
+
+  using tree_times = std::unordered_map<fstree::digest, catalog::time_type, fstree::digest_hash>;
+
+  // Reads and writes a list of trees with times, pins or recent roots.
+  // Entries older than the lifetime are skipped when reading.
+  void read_tree_times(const std::filesystem::path& path, std::chrono::seconds lifetime, tree_times& trees);
+  void write_tree_times(const std::filesystem::path& path, const tree_times& trees);
+
+  // Records a tree that was written, pulled or checked out as a live root
+  void record_root(const fstree::digest& tree);
+
+  // Appends the pinned and recently used root trees
+  void live_roots(std::vector<fstree::digest>& roots);
+
+  // Returns false if a loose object or a pack is corrupt. Objects that
+  // disappear while they're checked are skipped.
+  bool check_loose(const std::string& path, std::string& error);
+  bool check_pack(const std::string& name, std::string& error);
+
+  // Collects the catalog names of all objects reachable from the roots.
+  // Trees are read in parallel. Missing objects are skipped.
+  void mark(const std::vector<fstree::digest>& roots, std::unordered_set<std::string>& live);
+
+  // Extracts a packed object to a temporary file. Returns false if the object isn't packed.
+  bool extract_packed(const fstree::digest& hash, pack_store::kind kind, std::filesystem::path& tmp);
+
+  // Fetches an object from the remote into a pack, or into a loose file if it is large.
+  void pull_packed(fstree::remote& remote, const fstree::digest& hash, pack_store::kind kind);
+
+  // Reads a tree object from a pack or a loose file. Returns false if it's missing.
+  bool read_tree_object(const fstree::digest& hash, std::string& data);
+
+  // Returns the shards of a sharded tree object, or nothing for a plain tree.
+  void tree_shards(const fstree::digest& hash, std::vector<fstree::digest>& shards);
+
+  // Stores a tree object unless it's already present.
+  void store_tree(const fstree::digest& hash, std::string_view data);
+
+  // Writes an object to a temporary file and moves it into place.
+  void write_loose(const std::filesystem::path& object_path, std::string_view data);
+
+  // Reads an object from the packs of the secondary tier. Returns false if
+  // the secondary tier doesn't have it or its pack can't be read.
+  bool read_secondary_pack(const fstree::digest& hash, pack_store::kind kind, std::string& data);
+
+  // Copies an object from the secondary tier into a new temporary file.
+  // Returns false if the secondary tier doesn't have it or can't be read.
+  bool copy_secondary(const std::filesystem::path& object_path, std::filesystem::path& tmp);
+
+  // Stores a file or tree object from the secondary tier in this cache.
+  // Returns false if the secondary tier doesn't have it.
+  bool promote_object(const fstree::digest& hash);
+  bool promote_tree(const fstree::digest& hash);
+
+  // Fetches a file object from the remote and stores it, compressed if it pays off.
+  void pull_compressed(fstree::remote& remote, const fstree::digest& hash);
+
+  // Moves a complete temporary copy of a file object into place, compressed
+  // if compression is enabled and pays off.
+  void install_file(const std::filesystem::path& tmp, const fstree::digest& hash);
+
+  // Atomically moves a complete temporary file to its object path.
+  void install_object(const std::filesystem::path& tmp, const std::filesystem::path& object_path);
+
+  // Loads an index from the local manifest of a tree and stores the tree
+  // objects it contains. Returns false, leaving the index empty, if there
+  // is no usable manifest.
+  bool load_manifest(const fstree::digest& tree, fstree::index& index);
+
+  // Fetches the manifest of a tree from the remote and loads it.
+  bool pull_manifest(fstree::remote& remote, const fstree::digest& tree, fstree::index& index);
+
+  // Writes the manifest of a root tree unless it already exists.
+  void save_manifest(const inode& root);
 
   std::filesystem::path file_path(const fstree::digest& hash);
   std::filesystem::path tree_path(const fstree::digest& hash);
+  std::filesystem::path compressed_path(const fstree::digest& hash);
+  std::filesystem::path manifest_path(const fstree::digest& tree);
 };
 
 }  // namespace fstree
@@ -0,0 +1,421 @@
+#include "catalog.hpp"
+
+#include "varint.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace fstree {
+
+static const uint16_t g_magic = 0x3ef2;
+static const uint16_t g_version = 2;
+
+// Log record types
+static const uint8_t g_record_add = 1;
+static const uint8_t g_record_access = 2;
+
+// The table starts with a magic and a version number, followed by the
+// creation time, the total size and the number of objects as varints. Each
+// object is stored as its hit count, access time and size as varints, and
+// a varint length prefixed path.
+//
+// The log is a sequence of records, each a type byte followed by the
+// fields of an object in the same encoding as the table, without the hit
+// count. Access records have no size either. A truncated record at the end
+// of the log, left by an interrupted append, is ignored. So is a record with
+// a path longer than any object path, which can only be garbage.
+
+// Object paths are short, so longer ones are rejected before allocating
+static const uint64_t g_max_path_length = 4096;
+
+static void write_object(std::ostream& os, const catalog::object& obj) {
+  write_varint(os, static_cast<uint64_t>(obj.time));
+  write_varint(os, obj.size);
+  write_varint(os, obj.path.size());
+  os.write(obj.path.data(), obj.path.size());
+}
+
+static bool read_path(std::istream& is, uint64_t length, std::string& path) {
+  if (length > g_max_path_length) {
+    return false;
+  }
+  path.resize(length);
+  is.read(path.data(), length);
+  return static_cast<bool>(is);
+}
+
+static bool read_object(std::istream& is, catalog::object& obj) {
+  uint64_t time, size, length;
+  if (!read_varint(is, time) || !read_varint(is, size) || !read_varint(is, length)) {
+    return false;
+  }
+
+  obj.time = static_cast<catalog::time_type>(time);
+  obj.size = size;
+  obj.hits = 0;
+  return read_path(is, length, obj.path);
+}
+
+static void write_entry(std::ostream& os, const catalog::object& obj) {
+  write_varint(os, obj.hits);
+  write_object(os, obj);
+}
+
+static bool read_entry(std::istream& is, catalog::object& obj) {
+  uint64_t hits;
+  if (!read_varint(is, hits)) {
+    return false;
+  }
+
+  obj.hits = static_cast<uint32_t>(hits);
+  return read_object(is, obj);
+}
+
+static void write_access(std::ostream& os, const std::string& path, catalog::time_type time) {
+  write_varint(os, static_cast<uint64_t>(time));
+  write_varint(os, path.size());
+  os.write(path.data(), path.size());
+}
+
+static bool read_access(std::istream& is, catalog::object& obj) {
+  uint64_t time, length;
+  if (!read_varint(is, time) || !read_varint(is, length)) {
+    return false;
+  }
+
+  obj.time = static_cast<catalog::time_type>(time);
+  obj.size = 0;
+  return read_path(is, length, obj.path);
+}
+
+// Reads the next log record. Returns false at the end of the log.
+static bool read_record(std::istream& is, uint8_t& type, catalog::object& obj) {
+  int byte = is.get();
+  type = static_cast<uint8_t>(byte);
+  switch (byte) {
+    case g_record_add:
+      return read_object(is, obj);
+    case g_record_access:
+      return read_access(is, obj);
+    default:
+      return false;
+  }
+}
+
+// Reads the table header. Returns false if the table is missing or invalid.
+static bool read_header(std::istream& is, uint64_t& created, uint64_t& size, uint64_t& count) {
+  uint16_t magic, version;
+  is.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+  is.read(reinterpret_cast<char*>(&version), sizeof(version));
+  if (!is || magic != g_magic || version != g_version) {
+    return false;
+  }
+  return read_varint(is, created) && read_varint(is, size) && read_varint(is, count);
+}
+
+catalog::catalog(const std::filesystem::path& dir) : _table_path(dir / "catalog"), _log_path(dir / "catalog.log") {}
+
+void catalog::add(std::string path, uint64_t size, time_type time) {
+  std::lock_guard<std::mutex> lock(_pending_mutex);
+  _pending.push_back(object{std::move(path), size, time});
+}
+
+void catalog::access(std::string path, time_type time) {
+  std::lock_guard<std::mutex> lock(_pending_mutex);
+  auto [it, inserted] = _accessed.try_emplace(std::move(path), time);
+  if (!inserted && it->second < time) {
+    it->second = time;
+  }
+}
+
+bool catalog::has_pending() const {
+  std::lock_guard<std::mutex> lock(_pending_mutex);
+  return !_pending.empty() || !_accessed.empty();
+}
+
+void catalog::flush() {
+  std::vector<object> pending;
+  std::unordered_map<std::string, time_type> accessed;
+  {
+    std::lock_guard<std::mutex> lock(_pending_mutex);
+    pending.swap(_pending);
+    accessed.swap(_accessed);
+  }
+  if (pending.empty() && accessed.empty()) {
+    return;
+  }
+
+  // The records are appended with a single write
+  std::ostringstream records(std::ios::binary);
+  for (const auto& obj : pending) {
+    records.put(static_cast<char>(g_record_add));
+    write_object(records, obj);
+  }
+  for (const auto& [path, time] : accessed) {
+    records.put(static_cast<char>(g_record_access));
+    write_access(records, path, time);
+  }
+
+  std::ofstream log(_log_path, std::ios::binary | std::ios::app);
+  log.write(records.view().data(), records.view().size());
+  log.close();
+  if (!log) {
+    throw std::runtime_error("failed to write cache catalog: " + _log_path.string() + ": " + std::strerror(errno));
+  }
+}
+
+bool catalog::read_size(uint64_t& size, time_type& created) {
+  std::ifstream table(_table_path, std::ios::binary);
+  uint64_t table_created, count;
+  if (!table || !read_header(table, table_created, size, count)) {
+    return false;
+  }
+  created = static_cast<time_type>(table_created);
+
+  std::ifstream log(_log_path, std::ios::binary);
+  uint8_t type;
+  object obj;
+  while (read_record(log, type, obj)) {
+    size += obj.size;
+  }
+  return true;
+}
+
+bool catalog::load() {
+  clear();
+
+  std::ifstream table(_table_path, std::ios::binary);
+  uint64_t created, size, count;
+  if (!table || !read_header(table, created, size, count)) {
+    return false;
+  }
+
+  object obj;
+  for (uint64_t i = 0; i < count; i++) {
+    if (!read_entry(table, obj)) {
+      clear();
+      return false;
+    }
+    insert(std::move(obj));
+  }
+
+  _log_offset = 0;
+  replay();
+  return true;
+}
+
+void catalog::replay() {
+  std::ifstream log(_log_path, std::ios::binary);
+  log.seekg(_log_offset);
+
+  uint8_t type;
+  object obj;
+  while (read_record(log, type, obj)) {
+    if (type == g_record_add) {
+      insert(std::move(obj));
+    }
+    else {
+      hit(obj.path, obj.time);
+    }
+    _log_offset = static_cast<uint64_t>(log.tellg());
+  }
+}
+
+void catalog::reset(const std::vector<object>& objects) {
+  auto loaded = std::move(_objects);
+  clear();
+  for (object obj : objects) {
+    auto it = loaded.find(obj.path);
+    if (it != loaded.end()) {
+      obj.time = std::max(obj.time, it->second.time);
+      obj.hits = it->second.hits;
+    }
+    insert(std::move(obj));
+  }
+
+  // Uses are only logged, so the log may have the latest times even if
+  // the table couldn't be loaded
+  std::ifstream log(_log_path, std::ios::binary);
+  uint8_t type;
+  object obj;
+  _log_offset = 0;
+  while (read_record(log, type, obj)) {
+    touch(obj.path, obj.time);
+    _log_offset = static_cast<uint64_t>(log.tellg());
+  }
+}
+
+void catalog::clear() {
+  _objects.clear();
+  _pinned.clear();
+  _probation.clear();
+  _protected.clear();
+  _size = 0;
+  _protected_size = 0;
+}
+
+void catalog::insert(object obj) {
+  // Objects added again keep their latest access time, their hits and their pin
+  bool pinned = false;
+  auto it = _objects.find(obj.path);
+  if (it != _objects.end()) {
+    obj.time = std::max(obj.time, it->second.time);
+    obj.hits = it->second.hits;
+    pinned = _pinned.count(it->first) > 0;
+    remove(obj.path);
+  }
+
+  auto [inserted, _] = _objects.emplace(obj.path, std::move(obj));
+  if (pinned) {
+    _pinned.insert(inserted->first);
+  }
+  order(inserted->second, inserted->first);
+  _size += inserted->second.size;
+}
+
+void catalog::hit(const std::string& path, time_type time) {
+  auto it = _objects.find(path);
+  if (it == _objects.end()) {
+    return;
+  }
+
+  unorder(it->second, it->first);
+  it->second.time = std::max(it->second.time, time);
+  it->second.hits++;
+  order(it->second, it->first);
+}
+
+void catalog::order(const object& obj, std::string_view path) {
+  if (_pinned.count(path) > 0) {
+    return;
+  }
+
+  if (obj.hits > 0) {
+    _protected.emplace(obj.time, path);
+    _protected_size += obj.size;
+  }
+  else {
+    _probation.emplace(obj.time, path);
+  }
+}
+
+void catalog::unorder(const object& obj, std::string_view path) {
+  if (_pinned.count(path) > 0) {
+    return;
+  }
+
+  if (obj.hits > 0) {
+    _protected.erase({obj.time, path});
+    _protected_size -= obj.size;
+  }
+  else {
+    _probation.erase({obj.time, path});
+  }
+}
+
+const catalog::object* catalog::find(const std::string& path) const {
+  auto it = _objects.find(path);
+  return it == _objects.end() ? nullptr : &it->second;
+}
+
+const catalog::object* catalog::victim(time_type before, uint64_t protected_limit) const {
+  const auto oldest = [&](const order_set& segment) -> const object* {
+    if (segment.empty() || segment.begin()->first >= before) {
+      return nullptr;
+    }
+    return &_objects.find(std::string(segment.begin()->second))->second;
+  };
+
+  const object* obj = nullptr;
+  if (_protected_size > protected_limit) {
+    obj = oldest(_protected);
+  }
+  if (!obj) {
+    obj = oldest(_probation);
+  }
+  if (!obj) {
+    obj = oldest(_protected);
+  }
+  return obj;
+}
+
+void catalog::touch(const std::string& path, time_type time) {
+  auto it = _objects.find(path);
+  if (it == _objects.end() || it->second.time >= time) {
+    return;
+  }
+
+  unorder(it->second, it->first);
+  it->second.time = time;
+  order(it->second, it->first);
+}
+
+void catalog::remove(const std::string& path) {
+  auto it = _objects.find(path);
+  if (it == _objects.end()) {
+    return;
+  }
+
+  unorder(it->second, it->first);
+  _pinned.erase(it->first);
+  _size -= it->second.size;
+  _objects.erase(it);
+}
+
+void catalog::pin(const std::string& path) {
+  auto it = _objects.find(path);
+  if (it == _objects.end()) {
+    return;
+  }
+
+  unorder(it->second, it->first);
+  _pinned.insert(it->first);
+}
+
+void catalog::compact() {
+  std::filesystem::path tmp = _table_path;
+  tmp += ".tmp";
+
+  std::ofstream table(tmp, std::ios::binary | std::ios::trunc);
+  table.write(reinterpret_cast<const char*>(&g_magic), sizeof(g_magic));
+  table.write(reinterpret_cast<const char*>(&g_version), sizeof(g_version));
+
+  auto now = std::chrono::system_clock::now().time_since_epoch();
+  write_varint(table, std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+  write_varint(table, _size);
+  write_varint(table, _objects.size());
+
+  for (const auto& [path, obj] : _objects) {
+    write_entry(table, obj);
+  }
+
+  table.close();
+  if (!table) {
+    throw std::runtime_error("failed to write cache catalog: " + tmp.string() + ": " + std::strerror(errno));
+  }
+
+  std::error_code ec;
+  std::filesystem::rename(tmp, _table_path, ec);
+  if (ec) {
+    std::filesystem::remove(tmp, ec);
+    throw std::runtime_error("failed to write cache catalog: " + _table_path.string() + ": " + ec.message());
+  }
+
+  // The table now contains all logged objects
+  std::filesystem::remove(_log_path, ec);
+  if (ec) {
+    throw std::runtime_error("failed to truncate cache catalog: " + _log_path.string() + ": " + ec.message());
+  }
+  _log_offset = 0;
+}
+
+uint64_t catalog::log_size() const {
+  std::error_code ec;
+  uint64_t size = std::filesystem::file_size(_log_path, ec);
+  return ec ? 0 : size;
+}
+
+}  // namespace fstree
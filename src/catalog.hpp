@@ -0,0 +1,137 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace fstree {
+
+// A persistent catalog of the loose objects in the cache, with their sizes
+// and approximate access times.
+//
+// The catalog is a compacted table and an append-only log of objects added
+// and accessed since the table was written, both in the object directory.
+// The table header and the log records carry object sizes, so the total
+// size of the cache is known without listing the object directories, and
+// eviction takes its victims from the catalog in access time order.
+//
+// Accesses are buffered per process and logged in batches, instead of
+// touching each object on use. Other writers may still touch objects, so
+// access times are lower bounds that must be checked on disk before an
+// object is evicted.
+//
+// Eviction order is a segmented LRU. Objects start on probation and are
+// protected once they have been accessed after being added, so a large
+// one-off pull only displaces other objects on probation. Protected
+// objects are evicted when there are no others, or when the protected
+// segment is over its share of the cache.
+//
+// Buffering added and accessed objects is thread-safe. Flushing, loading
+// and compacting must be serialized across processes by the caller, with
+// the cache lock.
+class catalog {
+ public:
+  using time_type = std::chrono::nanoseconds::rep;
+
+  struct object {
+    std::string path;
+    uint64_t size;
+    time_type time;
+    uint32_t hits = 0;  // Logged accesses since the object was added
+  };
+
+  // Opens the catalog in an object directory
+  explicit catalog(const std::filesystem::path& dir);
+
+  // Buffers an object added to the cache. The path is relative to the object directory.
+  void add(std::string path, uint64_t size, time_type time);
+
+  // Buffers an access to an object. Repeated accesses are logged once.
+  void access(std::string path, time_type time);
+
+  // Returns true if there are buffered objects or accesses
+  bool has_pending() const;
+
+  // Appends the buffered objects and accesses to the log
+  void flush();
+
+  // Reads the total size of all objects from the table header and the log,
+  // without loading the objects. Objects added more than once are counted
+  // each time, so the size is an upper bound. Returns false if there is no
+  // usable catalog.
+  bool read_size(uint64_t& size, time_type& created);
+
+  // Loads the table and replays the log. Returns false if there is no usable catalog.
+  bool load();
+
+  // Replays the records appended to the log since it was last read
+  void replay();
+
+  // Replaces the loaded objects with a scan of the object directories,
+  // keeping the later access times of objects that were loaded or logged
+  void reset(const std::vector<object>& objects);
+
+  // Returns the total size of the loaded objects
+  uint64_t size() const { return _size; }
+
+  // Returns the number of loaded objects
+  size_t count() const { return _objects.size(); }
+
+  // Returns a loaded object, or nullptr
+  const object* find(const std::string& path) const;
+
+  // Returns the next object to evict among those accessed before the given
+  // time, or nullptr. Protected objects come first while their total size
+  // is over protected_limit, and otherwise only after all others.
+  const object* victim(time_type before, uint64_t protected_limit) const;
+
+  // Sets the access time of a loaded object, if it's later than the current one
+  void touch(const std::string& path, time_type time);
+
+  // Removes a loaded object
+  void remove(const std::string& path);
+
+  // Excludes a loaded object from eviction until the catalog is loaded
+  // again. Replayed records keep the object pinned.
+  void pin(const std::string& path);
+
+  // Writes the loaded objects to a new table and truncates the log
+  void compact();
+
+  // Returns the size of the log in bytes
+  uint64_t log_size() const;
+
+ private:
+  using order_set = std::set<std::pair<time_type, std::string_view>>;
+
+  void clear();
+  void insert(object obj);
+  void hit(const std::string& path, time_type time);
+
+  // Adds an object to or removes it from its segment
+  void order(const object& obj, std::string_view path);
+  void unorder(const object& obj, std::string_view path);
+
+  std::filesystem::path _table_path, _log_path;
+
+  mutable std::mutex _pending_mutex;
+  std::vector<object> _pending;
+  std::unordered_map<std::string, time_type> _accessed;
+
+  std::unordered_map<std::string, object> _objects;
+  std::unordered_set<std::string_view> _pinned;
+  order_set _probation, _protected;
+  uint64_t _size = 0;
+  uint64_t _protected_size = 0;
+  uint64_t _log_offset = 0;
+};
+
+}  // namespace fstree
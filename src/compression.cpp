@@ -0,0 +1,144 @@
+#include "compression.hpp"
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef FSTREE_ENABLE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace fstree {
+
+#ifdef FSTREE_ENABLE_ZSTD
+
+// Fast levels keep ingestion close to the speed of a plain copy
+static const int g_compression_level = 3;
+static const int g_probe_level = 1;
+
+// Files are only stored compressed if the probe saves this much
+static const size_t g_probe_ratio_percent = 90;
+
+static void check(size_t ret, const char* what) {
+  if (ZSTD_isError(ret)) {
+    throw std::runtime_error(std::string("failed to ") + what + ": " + ZSTD_getErrorName(ret));
+  }
+}
+
+bool compression_supported() { return true; }
+
+bool is_compressible(std::string_view sample) {
+  if (sample.empty()) {
+    return false;
+  }
+
+  std::vector<char> buffer(ZSTD_compressBound(sample.size()));
+  size_t size = ZSTD_compress(buffer.data(), buffer.size(), sample.data(), sample.size(), g_probe_level);
+  if (ZSTD_isError(size)) {
+    return false;
+  }
+  return size * 100 < sample.size() * g_probe_ratio_percent;
+}
+
+void compress(std::istream& is, std::ostream& os) {
+  ZSTD_CCtx* ctx = ZSTD_createCCtx();
+  if (!ctx) {
+    throw std::runtime_error("failed to compress: out of memory");
+  }
+
+  try {
+    check(ZSTD_CCtx_setParameter(ctx, ZSTD_c_compressionLevel, g_compression_level), "compress");
+
+    std::vector<char> in(ZSTD_CStreamInSize()), out(ZSTD_CStreamOutSize());
+    bool last = false;
+    while (!last) {
+      is.read(in.data(), in.size());
+      if (is.bad()) {
+        throw std::runtime_error("failed to compress: read error");
+      }
+      last = is.eof();
+
+      // Drain the output until the input is consumed, or the frame is complete
+      ZSTD_EndDirective mode = last ? ZSTD_e_end : ZSTD_e_continue;
+      ZSTD_inBuffer input = {in.data(), static_cast<size_t>(is.gcount()), 0};
+      bool done = false;
+      while (!done) {
+        ZSTD_outBuffer output = {out.data(), out.size(), 0};
+        size_t remaining = ZSTD_compressStream2(ctx, &output, &input, mode);
+        check(remaining, "compress");
+        os.write(out.data(), output.pos);
+        done = last ? remaining == 0 : input.pos == input.size;
+      }
+    }
+
+    if (!os) {
+      throw std::runtime_error("failed to compress: write error");
+    }
+  }
+  catch (...) {
+    ZSTD_freeCCtx(ctx);
+    throw;
+  }
+
+  ZSTD_freeCCtx(ctx);
+}
+
+void decompress(std::istream& is, std::ostream& os) {
+  ZSTD_DCtx* ctx = ZSTD_createDCtx();
+  if (!ctx) {
+    throw std::runtime_error("failed to decompress: out of memory");
+  }
+
+  try {
+    std::vector<char> in(ZSTD_DStreamInSize()), out(ZSTD_DStreamOutSize());
+    size_t remaining = 0;
+    bool started = false;
+    while (is.read(in.data(), in.size()) || is.gcount() > 0) {
+      // A full output buffer may leave decoded data behind in the context
+      ZSTD_inBuffer input = {in.data(), static_cast<size_t>(is.gcount()), 0};
+      bool flushed = false;
+      while (input.pos < input.size || !flushed) {
+        ZSTD_outBuffer output = {out.data(), out.size(), 0};
+        remaining = ZSTD_decompressStream(ctx, &output, &input);
+        check(remaining, "decompress");
+        os.write(out.data(), output.pos);
+        flushed = output.pos < output.size;
+      }
+      started = true;
+    }
+
+    if (is.bad()) {
+      throw std::runtime_error("failed to decompress: read error");
+    }
+    if (!started || remaining != 0) {
+      throw std::runtime_error("failed to decompress: truncated frame");
+    }
+    if (!os) {
+      throw std::runtime_error("failed to decompress: write error");
+    }
+  }
+  catch (...) {
+    ZSTD_freeDCtx(ctx);
+    throw;
+  }
+
+  ZSTD_freeDCtx(ctx);
+}
+
+#else
+
+bool compression_supported() { return false; }
+
+bool is_compressible(std::string_view) { return false; }
+
+void compress(std::istream&, std::ostream&) {
+  throw std::runtime_error("failed to compress: zstd support is not enabled");
+}
+
+void decompress(std::istream&, std::ostream&) {
+  throw std::runtime_error("failed to decompress: zstd support is not enabled");
+}
+
+#endif
+
+}  // namespace fstree
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <istream>
+#include <ostream>
+#include <string_view>
+
+namespace fstree {
+
+// Compression of cache objects at rest with zstd.
+//
+// Support is optional at build time, see fstree_ENABLE_ZSTD. Without it,
+// compression_supported() returns false and the other functions throw.
+
+// Returns true if this build can compress and decompress objects
+bool compression_supported();
+
+// Returns true if a sample from the start of a file compresses well enough
+// for the file to be stored compressed
+bool is_compressible(std::string_view sample);
+
+// Compresses a stream into a zstd frame
+void compress(std::istream& is, std::ostream& os);
+
+// Decompresses a zstd frame. Throws if it is corrupt or truncated.
+void decompress(std::istream& is, std::ostream& os);
+
+}  // namespace fstree
@@ -1,23 +1,77 @@
 #include "digest.hpp"
 
+#include <cstring>
 #include <stdexcept>
 
 namespace fstree {
 
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+digest::digest(algorithm alg, const std::string& hex) : _alg(alg) {
+  size_t length = digest::length(alg);
+  if (hex.length() != length * 2) {
+    throw std::invalid_argument("invalid digest length: " + hex);
+  }
+
+  for (size_t i = 0; i < length; i++) {
+    int hi = hex_value(hex[2 * i]);
+    int lo = hex_value(hex[2 * i + 1]);
+    if (hi < 0 || lo < 0) {
+      throw std::invalid_argument("invalid digest: " + hex);
+    }
+    _bytes[i] = static_cast<uint8_t>((hi << 4) | lo);
+  }
+}
+
+digest::digest(algorithm alg, const uint8_t* bytes) : _alg(alg) {
+  std::memcpy(_bytes.data(), bytes, length(alg));
+}
+
+size_t digest::length(algorithm alg) {
+  switch (alg) {
+    case algorithm::none:
+      return 0;
+    case algorithm::sha1:
+      return 20;
+    case algorithm::blake3:
+      return 32;
+  }
+  return 0;
+}
+
 digest::algorithm digest::alg() const { return _alg; }
 
-bool digest::empty() const { return _hex.empty(); }
+bool digest::empty() const { return _alg == algorithm::none; }
 
-const std::string& digest::hexdigest() const { return _hex; }
+const uint8_t* digest::data() const { return _bytes.data(); }
+
+size_t digest::size() const { return length(_alg); }
+
+std::string digest::hexdigest() const {
+  static const char digits[] = "0123456789abcdef";
+
+  size_t length = size();
+  std::string hex(length * 2, '0');
+  for (size_t i = 0; i < length; i++) {
+    hex[2 * i] = digits[_bytes[i] >> 4];
+    hex[2 * i + 1] = digits[_bytes[i] & 0xf];
+  }
+  return hex;
+}
 
 std::string digest::string() const {
   switch (_alg) {
     case algorithm::none:
       return "";
     case algorithm::sha1:
-      return "sha1:" + _hex;
+      return "sha1:" + hexdigest();
     case algorithm::blake3:
-      return "blake3:" + _hex;
+      return "blake3:" + hexdigest();
   }
   return "";
 }
@@ -1,44 +1,69 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <ostream>
 #include <string>
 
 namespace fstree {
 
+// A content digest, stored as raw bytes together with the algorithm
+// that produced it.
 class digest {
 public:
   // Parses a digest from a string representation.
   static digest parse(const std::string& str);
 
  public:
-  enum class algorithm { none, sha1, blake3 };
+  enum class algorithm : uint8_t { none, sha1, blake3 };
 
-  digest() : _alg(algorithm::none), _hex("") {}
-  digest(const digest& other) : _alg(other._alg), _hex(other._hex) {}
-  digest(digest&& other) : _alg(other._alg), _hex(std::move(other._hex)) {}
-  digest(algorithm alg, const std::string& hex) : _alg(alg), _hex(hex) {}
-  virtual ~digest() = default;
+  // The largest digest length in bytes of all supported algorithms.
+  static constexpr size_t max_length = 32;
 
-  digest& operator=(const digest&) = default;
-  bool operator==(const digest& other) const { return _alg == other._alg && _hex == other._hex; }
+  digest() = default;
+  digest(algorithm alg, const std::string& hex);
+  digest(algorithm alg, const uint8_t* bytes);
+
+  bool operator==(const digest& other) const { return _alg == other._alg && _bytes == other._bytes; }
 
   // Returns true if the digest is empty.
   bool empty() const;
 
   // Returns the hex representation of the digest.
-  const std::string& hexdigest() const;
+  std::string hexdigest() const;
 
   // Returns the algorithm used for the digest.
   algorithm alg() const;
 
+  // Returns the raw digest bytes.
+  const uint8_t* data() const;
+
+  // Returns the number of raw digest bytes.
+  size_t size() const;
+
   // Returns the string representation of the digest, e.g., "sha1:abcd1234..."
   std::string string() const;
 
+  // Returns the digest length in bytes of an algorithm.
+  static size_t length(algorithm alg);
+
  private:
-  algorithm _alg;
-  std::string _hex;
+  std::array<uint8_t, max_length> _bytes{};
+  algorithm _alg = algorithm::none;
 };
 
 std::ostream& operator<<(std::ostream& os, const digest& digest);
 
+// Hash functor for unordered containers of digests
+struct digest_hash {
+  size_t operator()(const digest& hash) const {
+    size_t value = 0;
+    std::memcpy(&value, hash.data(), std::min(sizeof(value), hash.size()));
+    return value;
+  }
+};
+
 }  // namespace fstree
@@ -7,12 +7,13 @@ namespace fstree {
 sorted_directory_iterator::sorted_directory_iterator(
     const std::filesystem::path& path, const glob_list& ignores, bool recursive)
     : sorted_directory_iterator(path, ignores, [](const inode::ptr& a, const inode::ptr& b) { 
-        return a->path() < b->path(); }, recursive)
+        return a->compare_path(*b) < 0; }, recursive)
 {}
        
 sorted_directory_iterator::sorted_directory_iterator(
     const std::filesystem::path& path, const glob_list& ignores, compare_function compare, bool recursive) 
-    : _root(fstree::make_intrusive<fstree::inode>())
+    : _arena(fstree::make_intrusive<fstree::inode_arena>())
+    , _root(_arena->make())
     , _pool(&get_pool())
     , _ignores(ignores)
     , _recursive(recursive)
@@ -44,10 +45,8 @@ sorted_directory_iterator::sorted_directory_iterator(
         _inodes.end());
 }
 
-sorted_directory_iterator::~sorted_directory_iterator() {
-    if (_root) {
-        _root->clear();
-    }
+const intrusive_ptr<inode_arena>& sorted_directory_iterator::arena() const {
+    return _arena;
 }
 
 }  // namespace fstree
@@ -2,6 +2,7 @@
 
 #include "glob_list.hpp"
 #include "inode.hpp"
+#include "inode_arena.hpp"
 
 #include <filesystem>
 #include <functional>
@@ -19,6 +20,8 @@ class sorted_directory_iterator {
   using compare_function = std::function<bool(const inode::ptr&, const inode::ptr&)>;
 
  private:
+  // Arena that owns all inodes read by the iterator
+  intrusive_ptr<inode_arena> _arena;
   inode::ptr _root;
   pool* _pool;
   glob_list _ignores;
@@ -40,8 +43,6 @@ class sorted_directory_iterator {
   explicit sorted_directory_iterator(
       const std::filesystem::path& path, const glob_list& ignores, compare_function compare, bool recursive = true);
 
-  ~sorted_directory_iterator();
-
   // begin and end functions
   std::vector<inode::ptr>::iterator begin();
   std::vector<inode::ptr>::iterator end();
@@ -50,6 +51,9 @@ class sorted_directory_iterator {
   inode::ptr& root();
   const inode::ptr& root() const;
 
+  // Arena that owns the inodes
+  const intrusive_ptr<inode_arena>& arena() const;
+
  private:
   void read_directory(
       const std::filesystem::path& abs, const std::filesystem::path& rel, inode::ptr& parent, const glob_list& ignores);
@@ -97,7 +97,7 @@ void sorted_directory_iterator::read_directory(
     file_status status(status_bits);
 
     // Add the path to the list of inodes
-    inode::ptr node = fstree::make_intrusive<inode>(relpath.string(), status, mtime, st.st_size, target);
+    inode::ptr node = _arena->make(relpath.string(), status, mtime, st.st_size, target.string());
     {
       std::lock_guard<std::mutex> lock(_mutex);
       _inodes.push_back(node);
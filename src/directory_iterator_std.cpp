@@ -71,7 +71,7 @@ void sorted_directory_iterator::read_directory(
       }
     }
 
-    inode::ptr node = fstree::make_intrusive<inode>(path.string(), file_status(type, perms), mtime, size, target.string());
+    inode::ptr node = _arena->make(path.string(), file_status(type, perms), mtime, size, target.string());
     {
       std::lock_guard<std::mutex> lock(_mutex);
       _inodes.push_back(node);
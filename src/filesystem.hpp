@@ -3,6 +3,8 @@
 
 #include "inode.hpp"
 
+#include <cstddef>
+#include <cstdint>
 #include <filesystem>
 
 namespace fstree {
@@ -18,6 +20,51 @@ void lstat(const std::filesystem::path& path, stat& st);
 FILE* mkstemp(std::filesystem::path& templ);
 bool touch(const std::filesystem::path& path);
 
+// Returns true if a regular file exists at path, without modifying it
+bool file_exists(const std::filesystem::path& path);
+
+// Returns the capacity and the space available to the user of the
+// filesystem containing path. Returns false if it can't be determined.
+bool disk_space(const std::filesystem::path& path, uint64_t& capacity, uint64_t& available);
+
+// Methods of copying the contents of a file, see copy_file
+enum class copy_method { automatic, clone, copy_range, buffered };
+
+// Copies a regular file, replacing the destination. A clone shares the data
+// blocks of the source on copy-on-write filesystems, a range copy is done
+// within the kernel, and a buffered copy reads and writes through user
+// space. The automatic method tries them in this order, the others fail if
+// they are not supported. Returns the method that was used.
+copy_method copy_file(const std::filesystem::path& from, const std::filesystem::path& to, copy_method method);
+
+// A read-only memory mapping of a whole file
+class mapped_file {
+ public:
+  mapped_file() = default;
+
+  // Maps the file at the given path
+  explicit mapped_file(const std::filesystem::path& path);
+  ~mapped_file();
+
+  mapped_file(const mapped_file&) = delete;
+  mapped_file& operator=(const mapped_file&) = delete;
+
+  mapped_file(mapped_file&& other) noexcept;
+  mapped_file& operator=(mapped_file&& other) noexcept;
+
+  // Returns the mapped data
+  const char* data() const { return _data; }
+
+  // Returns the size of the mapped data
+  size_t size() const { return _size; }
+
+ private:
+  void unmap();
+
+  const char* _data = nullptr;
+  size_t _size = 0;
+};
+
 }  // namespace fstree
 
 #endif  // FILESYSTEM_HPP
@@ -3,11 +3,23 @@
 #include "filesystem.hpp"
 
 #include <cstring>
+#include <vector>
 
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+#ifdef __APPLE__
+#include <sys/clonefile.h>
+#endif
+
 namespace fstree {
 
 void lstat(const std::filesystem::path& path, stat& status_out) {
@@ -83,6 +95,183 @@ bool touch(const std::filesystem::path& path) {
   return true;
 }
 
+bool file_exists(const std::filesystem::path& path) {
+  struct ::stat st;
+  return ::stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+bool disk_space(const std::filesystem::path& path, uint64_t& capacity, uint64_t& available) {
+  struct ::statvfs st;
+  if (::statvfs(path.c_str(), &st) != 0) {
+    return false;
+  }
+
+  capacity = uint64_t(st.f_blocks) * st.f_frsize;
+  available = uint64_t(st.f_bavail) * st.f_frsize;
+  return true;
+}
+
+// Size of the buffer of buffered copies
+static const size_t g_copy_buffer_size = 256 * 1024;
+
+// Largest range copied by one copy_file_range call
+static const size_t g_copy_range_size = 1 << 30;
+
+// A file descriptor that is closed when it goes out of scope
+struct scoped_fd {
+  int fd;
+  ~scoped_fd() {
+    if (fd != -1) ::close(fd);
+  }
+};
+
+// Returns true if a clone or range copy failed because the files or the
+// filesystem don't support it, rather than because of an I/O error
+static bool is_unsupported(int err) {
+  return err == EOPNOTSUPP || err == ENOTSUP || err == EXDEV || err == EINVAL || err == ENOSYS || err == ENOTTY;
+}
+
+static void copy_buffered(int in, int out, const std::filesystem::path& to) {
+  std::vector<char> buffer(g_copy_buffer_size);
+  for (;;) {
+    ssize_t n = ::read(in, buffer.data(), buffer.size());
+    if (n == -1 && errno == EINTR) continue;
+    if (n == -1) {
+      throw std::runtime_error("failed to copy file: " + to.string() + ": " + std::strerror(errno));
+    }
+    if (n == 0) {
+      return;
+    }
+
+    for (ssize_t written = 0; written < n;) {
+      ssize_t w = ::write(out, buffer.data() + written, n - written);
+      if (w == -1 && errno == EINTR) continue;
+      if (w == -1) {
+        throw std::runtime_error("failed to copy file: " + to.string() + ": " + std::strerror(errno));
+      }
+      written += w;
+    }
+  }
+}
+
+copy_method copy_file(const std::filesystem::path& from, const std::filesystem::path& to, copy_method method) {
+  bool automatic = method == copy_method::automatic;
+
+#ifdef __APPLE__
+  // clonefile creates the destination itself
+  if (automatic || method == copy_method::clone) {
+    ::unlink(to.c_str());
+    if (::clonefile(from.c_str(), to.c_str(), 0) == 0) {
+      return copy_method::clone;
+    }
+    if (!automatic || !is_unsupported(errno)) {
+      throw std::runtime_error("failed to clone file: " + to.string() + ": " + std::strerror(errno));
+    }
+  }
+#endif
+
+  scoped_fd in{::open(from.c_str(), O_RDONLY | O_CLOEXEC)};
+  if (in.fd == -1) {
+    throw std::runtime_error("failed to open file: " + from.string() + ": " + std::strerror(errno));
+  }
+
+  scoped_fd out{::open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)};
+  if (out.fd == -1) {
+    throw std::runtime_error("failed to create file: " + to.string() + ": " + std::strerror(errno));
+  }
+
+#if defined(__linux__) && defined(FICLONE)
+  if (automatic || method == copy_method::clone) {
+    if (::ioctl(out.fd, FICLONE, in.fd) == 0) {
+      return copy_method::clone;
+    }
+    if (!automatic || !is_unsupported(errno)) {
+      throw std::runtime_error("failed to clone file: " + to.string() + ": " + std::strerror(errno));
+    }
+  }
+#endif
+  if (method == copy_method::clone) {
+    throw std::runtime_error("failed to clone file: " + to.string() + ": not supported");
+  }
+
+#ifdef __linux__
+  if (automatic || method == copy_method::copy_range) {
+    size_t copied = 0;
+    ssize_t n;
+    while ((n = ::copy_file_range(in.fd, nullptr, out.fd, nullptr, g_copy_range_size, 0)) > 0) {
+      copied += n;
+    }
+    if (n == 0) {
+      return copy_method::copy_range;
+    }
+
+    // Fall back to a buffered copy only if nothing has been copied yet
+    if (!automatic || copied > 0 || !is_unsupported(errno)) {
+      throw std::runtime_error("failed to copy file: " + to.string() + ": " + std::strerror(errno));
+    }
+  }
+#endif
+  if (method == copy_method::copy_range) {
+    throw std::runtime_error("failed to copy file: " + to.string() + ": range copies not supported");
+  }
+
+  copy_buffered(in.fd, out.fd, to);
+  return copy_method::buffered;
+}
+
+mapped_file::mapped_file(const std::filesystem::path& path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    throw std::runtime_error("failed to open file: " + path.string() + ": " + std::strerror(errno));
+  }
+
+  struct ::stat st;
+  if (::fstat(fd, &st) != 0) {
+    int err = errno;
+    ::close(fd);
+    throw std::runtime_error("failed to stat file: " + path.string() + ": " + std::strerror(err));
+  }
+
+  if (st.st_size > 0) {
+    void* data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+      int err = errno;
+      ::close(fd);
+      throw std::runtime_error("failed to map file: " + path.string() + ": " + std::strerror(err));
+    }
+    _data = static_cast<const char*>(data);
+    _size = st.st_size;
+  }
+
+  ::close(fd);
+}
+
+mapped_file::~mapped_file() { unmap(); }
+
+mapped_file::mapped_file(mapped_file&& other) noexcept : _data(other._data), _size(other._size) {
+  other._data = nullptr;
+  other._size = 0;
+}
+
+mapped_file& mapped_file::operator=(mapped_file&& other) noexcept {
+  if (this != &other) {
+    unmap();
+    _data = other._data;
+    _size = other._size;
+    other._data = nullptr;
+    other._size = 0;
+  }
+  return *this;
+}
+
+void mapped_file::unmap() {
+  if (_data) {
+    ::munmap(const_cast<char*>(_data), _size);
+    _data = nullptr;
+    _size = 0;
+  }
+}
+
 }  // namespace fstree
 
 #endif  // _WIN32
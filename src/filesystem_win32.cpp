@@ -106,6 +106,102 @@ bool touch(const std::filesystem::path& path) {
   return true;
 }
 
+bool file_exists(const std::filesystem::path& path) {
+  DWORD attributes = GetFileAttributesA(path.string().c_str());
+  return attributes != INVALID_FILE_ATTRIBUTES && !(attributes & FILE_ATTRIBUTE_DIRECTORY);
+}
+
+bool disk_space(const std::filesystem::path& path, uint64_t& capacity, uint64_t& available) {
+  ULARGE_INTEGER free_bytes, total_bytes;
+  if (!GetDiskFreeSpaceExA(path.string().c_str(), &free_bytes, &total_bytes, nullptr)) {
+    return false;
+  }
+
+  capacity = total_bytes.QuadPart;
+  available = free_bytes.QuadPart;
+  return true;
+}
+
+copy_method copy_file(const std::filesystem::path& from, const std::filesystem::path& to, copy_method method) {
+  // Clones and range copies are not implemented, CopyFile copies within the system
+  if (method == copy_method::clone || method == copy_method::copy_range) {
+    throw std::runtime_error("failed to copy file: " + to.string() + ": copy method not supported");
+  }
+
+  std::error_code ec;
+  std::filesystem::copy_file(from, to, std::filesystem::copy_options::overwrite_existing, ec);
+  if (ec) {
+    throw std::runtime_error("failed to copy file: " + to.string() + ": " + ec.message());
+  }
+  return copy_method::buffered;
+}
+
+mapped_file::mapped_file(const std::filesystem::path& path) {
+  HANDLE file = CreateFileW(
+      path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+      FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    std::error_code ec(GetLastError(), std::system_category());
+    throw std::runtime_error("failed to open file: " + path.string() + ": " + ec.message());
+  }
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size)) {
+    std::error_code ec(GetLastError(), std::system_category());
+    CloseHandle(file);
+    throw std::runtime_error("failed to stat file: " + path.string() + ": " + ec.message());
+  }
+
+  if (size.QuadPart > 0) {
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+      std::error_code ec(GetLastError(), std::system_category());
+      CloseHandle(file);
+      throw std::runtime_error("failed to map file: " + path.string() + ": " + ec.message());
+    }
+
+    // The view keeps the mapping and the file open
+    void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    std::error_code ec(GetLastError(), std::system_category());
+    CloseHandle(mapping);
+    if (!data) {
+      CloseHandle(file);
+      throw std::runtime_error("failed to map file: " + path.string() + ": " + ec.message());
+    }
+
+    _data = static_cast<const char*>(data);
+    _size = static_cast<size_t>(size.QuadPart);
+  }
+
+  CloseHandle(file);
+}
+
+mapped_file::~mapped_file() { unmap(); }
+
+mapped_file::mapped_file(mapped_file&& other) noexcept : _data(other._data), _size(other._size) {
+  other._data = nullptr;
+  other._size = 0;
+}
+
+mapped_file& mapped_file::operator=(mapped_file&& other) noexcept {
+  if (this != &other) {
+    unmap();
+    _data = other._data;
+    _size = other._size;
+    other._data = nullptr;
+    other._size = 0;
+  }
+  return *this;
+}
+
+void mapped_file::unmap() {
+  if (_data) {
+    UnmapViewOfFile(_data);
+    _data = nullptr;
+    _size = 0;
+  }
+}
+
 }  // namespace fstree
 
 #endif  // _WIN32
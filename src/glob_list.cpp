@@ -117,15 +117,17 @@ void glob_list::load(const std::filesystem::path& path) {
     throw std::runtime_error("failed to open " + path.string() + " for reading");
   }
 
+  load(file);
+}
+
+void glob_list::load(std::istream& is) {
   std::string line;
-  while (std::getline(file, line)) {
+  while (std::getline(is, line)) {
     if (!line.empty() && line[0] != '#') {
       add(line);
     }
   }
 
-  file.close();
-
   finalize();
 }
 
@@ -2,6 +2,7 @@
 #define IGNORE_HPP
 
 #include <filesystem>
+#include <istream>
 #include <regex>
 #include <string>
 #include <vector>
@@ -30,6 +31,9 @@ class glob_list {
   // Load patterns from a file
   void load(const std::filesystem::path& path);
 
+  // Load patterns from a stream
+  void load(std::istream& is);
+
   void finalize();
 
   // Returns true if the path should be ignored.
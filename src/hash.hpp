@@ -4,12 +4,16 @@
 
 #include <filesystem>
 #include <string>
+#include <string_view>
 
 namespace fstree {
 
 // Calculate the hash sum of a stream. The stream is read until EOF.
 fstree::digest hashsum_hex(std::istream& stream);
 
+// Calculate the hash sum of an in-memory buffer.
+fstree::digest hashsum_hex(std::string_view data);
+
 // Calculate the hash sum of a file. The file is read until EOF.
 fstree::digest hashsum_hex_file(const std::filesystem::path& path);
 
@@ -33,13 +33,19 @@ fstree::digest hashsum_hex(std::istream& stream) {
   uint8_t hash_output[BLAKE3_OUT_LEN];
   blake3_hasher_finalize(&hasher, hash_output, BLAKE3_OUT_LEN);
 
-  // Convert the hash to a hexadecimal string.
-  std::ostringstream oss;
-  oss << std::hex << std::setfill('0');
-  for (size_t i = 0; i < BLAKE3_OUT_LEN; i++) {
-    oss << std::setw(2) << static_cast<int>(hash_output[i]);
-  }
-  return digest(digest::algorithm::blake3, oss.str());
+  return digest(digest::algorithm::blake3, hash_output);
+}
+
+// Calculate the hash sum of an in-memory buffer.
+fstree::digest hashsum_hex(std::string_view data) {
+  blake3_hasher hasher;
+  blake3_hasher_init(&hasher);
+  blake3_hasher_update(&hasher, data.data(), data.size());
+
+  uint8_t hash_output[BLAKE3_OUT_LEN];
+  blake3_hasher_finalize(&hasher, hash_output, BLAKE3_OUT_LEN);
+
+  return digest(digest::algorithm::blake3, hash_output);
 }
 
 // Calculate the hash sum of a file. The file is read until EOF.
@@ -16,11 +16,8 @@
 
 namespace fstree {
 
-// Calculate the hash sum of a stream
-fstree::digest hashsum_hex(std::istream& stream) {
-  // Read file contents
-  std::vector<unsigned char> buffer(std::istreambuf_iterator<char>(stream), {});
-
+// Calculate the hash sum of a message. The buffer is padded in place.
+static fstree::digest sha1(std::vector<unsigned char>& buffer) {
   // Initialize SHA1 variables
   uint32_t h0 = 0x67452301;
   uint32_t h1 = 0xEFCDAB89;
@@ -94,12 +91,30 @@ fstree::digest hashsum_hex(std::istream& stream) {
     h4 += e;
   }
 
-  // Convert hash to hexadecimal string
-  std::ostringstream oss;
-  oss << std::hex << std::setfill('0');
-  oss << std::setw(8) << h0 << std::setw(8) << h1 << std::setw(8) << h2 << std::setw(8) << h3 << std::setw(8) << h4;
+  // Convert hash to big-endian bytes
+  uint8_t hash_output[20];
+  const uint32_t h[5] = {h0, h1, h2, h3, h4};
+  for (size_t i = 0; i < 5; i++) {
+    hash_output[4 * i] = static_cast<uint8_t>(h[i] >> 24);
+    hash_output[4 * i + 1] = static_cast<uint8_t>(h[i] >> 16);
+    hash_output[4 * i + 2] = static_cast<uint8_t>(h[i] >> 8);
+    hash_output[4 * i + 3] = static_cast<uint8_t>(h[i]);
+  }
+
+  return digest(digest::algorithm::sha1, hash_output);
+}
+
+// Calculate the hash sum of a stream
+fstree::digest hashsum_hex(std::istream& stream) {
+  // Read file contents
+  std::vector<unsigned char> buffer(std::istreambuf_iterator<char>(stream), {});
+  return sha1(buffer);
+}
 
-  return digest(digest::algorithm::sha1, oss.str());
+// Calculate the hash sum of an in-memory buffer
+fstree::digest hashsum_hex(std::string_view data) {
+  std::vector<unsigned char> buffer(data.begin(), data.end());
+  return sha1(buffer);
 }
 
 // Calculate the hash sum of a file
@@ -6,42 +6,47 @@
 #include "filesystem.hpp"
 #include "glob_list.hpp"
 #include "hash.hpp"
+#include "index_snapshot.hpp"
 #include "inode.hpp"
+#include "thread_pool.hpp"
+#include "wait_group.hpp"
 
 #include <algorithm>
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <sstream>
 #include <vector>
 
 namespace fstree {
 
 static const uint16_t magic = 0x3ee3;
-static const uint16_t version = 1;
+static const uint16_t version_1 = 1;
+static const uint16_t version = 2;
+
+// Number of entries per partition in parallel merge joins
+static const size_t g_partition_size = 16 * 1024;
 
 // Constructor implementations
 index::index()
-  : _root(fstree::make_intrusive<fstree::inode>())
+  : _arena(fstree::make_intrusive<fstree::inode_arena>())
+  , _root(_arena->make())
 {}
 
 index::index(const std::filesystem::path& root)
-  : _root_path(root), _root(fstree::make_intrusive<fstree::inode>())
+  : _arena(fstree::make_intrusive<fstree::inode_arena>())
+  , _root_path(root)
+  , _root(_arena->make())
 {}
 
 index::index(const std::filesystem::path& root, const glob_list& ignore)
   : _ignore(ignore)
+  , _arena(fstree::make_intrusive<fstree::inode_arena>())
   , _root_path(root)
-  , _root(fstree::make_intrusive<fstree::inode>())
+  , _root(_arena->make())
 {}
 
-index::~index() {
-  if (_root) {
-    _root->clear();
-  }
-  std::for_each(_inodes.begin(), _inodes.end(), [](inode::ptr& inode) {
-    inode->clear();
-  });
-}
+index::~index() = default;
 
 void index::dump() const {
   for (const auto& inode : _inodes) {
@@ -72,7 +77,18 @@ inode::ptr& index::root() { return _root; }
 
 const inode::ptr& index::root() const { return _root; }
 
-void index::push_back(inode::ptr inode) { _inodes.push_back(inode); }
+void index::clear() {
+  _inodes.clear();
+  _root = inode::ptr();
+  _arena = fstree::make_intrusive<fstree::inode_arena>();
+  _root = _arena->make();
+  invalidate_lookup();
+}
+
+void index::push_back(inode::ptr inode) {
+  _inodes.push_back(inode);
+  invalidate_lookup();
+}
 
 void index::save() const {
   save(std::filesystem::path(".fstree/index"));
@@ -100,9 +116,10 @@ void index::save(const std::filesystem::path& indexfile) const {
 
   for (const auto& inode : *this) {
     // Write the path
-    size_t path_length = inode->path().length();
+    std::string path = inode->path();
+    size_t path_length = path.length();
     file.write(reinterpret_cast<const char*>(&path_length), sizeof(path_length));
-    file.write(inode->path().c_str(), inode->path().length());
+    file.write(path.c_str(), path.length());
 
     // Write the hash
     std::string hash = inode->hash().string();
@@ -124,6 +141,17 @@ void index::save(const std::filesystem::path& indexfile) const {
       file.write(inode->target().c_str(), inode->target().length());
     }
 
+    // Write the inline contents of files, since version 2
+    if (inode->is_file()) {
+      char has_data = inode->has_inline_data();
+      file.put(has_data);
+      if (has_data) {
+        size_t data_length = inode->inline_data().length();
+        file.write(reinterpret_cast<const char*>(&data_length), sizeof(data_length));
+        file.write(inode->inline_data().c_str(), inode->inline_data().length());
+      }
+    }
+
     if (!file) break;
   }
 
@@ -152,10 +180,11 @@ void index::load(const std::filesystem::path& indexfile) {
   uint16_t file_version;
   file.read(reinterpret_cast<char*>(&file_version), sizeof(file_version));
   if (!file) throw std::runtime_error("failed reading index: " + index_path.string() + ": " + std::strerror(errno));
-  if (file_version != version)
+  if (file_version != version && file_version != version_1)
     throw std::runtime_error("failed reading index: " + index_path.string() + ": invalid version");
 
   _inodes.clear();
+  invalidate_lookup();
 
   while (file.peek() != EOF) {
     std::string path;
@@ -197,51 +226,93 @@ void index::load(const std::filesystem::path& indexfile) {
       if (!file) throw std::runtime_error("failed reading index: " + index_path.string() + ": " + std::strerror(errno));
     }
 
-    push_back(fstree::make_intrusive<fstree::inode>(path, status, mtime, 0, target, fstree::digest::parse(hash)));
-  }
-}
+    auto node = _arena->make(path, status, mtime, 0, target, fstree::digest::parse(hash));
 
-void index::copy_metadata(fstree::index& other) {
-  auto cur_index_node = _inodes.begin();
-  auto cur_other_node = other._inodes.begin();
-  auto end_index_node = _inodes.end();
-  auto end_other_node = other._inodes.end();
+    if (status.is_regular() && file_version != version_1) {
+      int has_data = file.get();
+      if (has_data == EOF) throw std::runtime_error("failed reading index: " + index_path.string() + ": truncated entry");
 
-  for (;;) {
-    if (cur_index_node == end_index_node) {
-      return;
-    }
+      if (has_data) {
+        size_t data_length;
+        file.read(reinterpret_cast<char*>(&data_length), sizeof(data_length));
+        if (!file) throw std::runtime_error("failed reading index: " + index_path.string() + ": " + std::strerror(errno));
+
+        std::string data(data_length, '\0');
+        file.read(&data[0], data_length);
+        if (!file) throw std::runtime_error("failed reading index: " + index_path.string() + ": " + std::strerror(errno));
 
-    if (cur_other_node == end_other_node) {
-      return;
+        node->set_inline_data(data);
+        node->set_size(data_length);
+      }
     }
 
-    if ((*cur_index_node)->path() < (*cur_other_node)->path()) {
-      cur_index_node++;
+    push_back(node);
+  }
+}
+
+// Copies the modification time of entries with equal path and hash from
+// source to current, for the given ranges of both snapshots.
+static void copy_metadata_range(
+    const index_snapshot& current, size_t current_begin, size_t current_end,
+    const index_snapshot& source, size_t source_begin, size_t source_end) {
+  while (current_begin < current_end && source_begin < source_end) {
+    int cmp = current.path(current_begin).compare(source.path(source_begin));
+    if (cmp < 0) {
+      current_begin++;
       continue;
     }
 
-    if ((*cur_index_node)->path() > (*cur_other_node)->path()) {
-      cur_other_node++;
+    if (cmp > 0) {
+      source_begin++;
       continue;
     }
 
-    if ((*cur_index_node)->hash() == (*cur_other_node)->hash()) {
-      (*cur_index_node)->set_last_write_time((*cur_other_node)->last_write_time());
+    if (current.hash(current_begin) == source.hash(source_begin)) {
+      current.node(current_begin)->set_last_write_time(source.last_write_time(source_begin));
     }
 
-    cur_index_node++;
-    cur_other_node++;
+    current_begin++;
+    source_begin++;
+  }
+}
+
+void index::copy_metadata(fstree::index& other) {
+  index_snapshot current(_inodes.begin(), _inodes.end());
+  index_snapshot source(other._inodes.begin(), other._inodes.end());
+
+  if (current.size() < 2 * g_partition_size) {
+    copy_metadata_range(current, 0, current.size(), source, 0, source.size());
+    return;
+  }
+
+  // Split the index into partitions by path and join each of them with
+  // the matching range of the other index in parallel.
+  pool& pool = get_pool();
+  wait_group wg;
+
+  for (size_t begin = 0; begin < current.size(); begin += g_partition_size) {
+    size_t end = std::min(begin + g_partition_size, current.size());
+    size_t source_begin = source.lower_bound(current.path(begin));
+    size_t source_end = end == current.size() ? source.size() : source.lower_bound(current.path(end));
+
+    wg.add(1);
+    pool.enqueue([&current, &source, &wg, begin, end, source_begin, source_end]() {
+      copy_metadata_range(current, begin, end, source, source_begin, source_end);
+      wg.done();
+    });
   }
+
+  wg.wait();
 }
 
 void index::sort() {
   // Sort inodes by path
-  std::sort(_inodes.begin(), _inodes.end(), [](const auto& a, const auto& b) { return a->path() < b->path(); });
+  std::sort(_inodes.begin(), _inodes.end(), [](const auto& a, const auto& b) { return a->compare_path(*b) < 0; });
 }
 
 void index::checkout(fstree::cache& cache, const std::filesystem::path& path) {
   event("index::checkout", path.string());
+  event("index::checkout_size", path.string(), _root->size());
 
   // Create destination directory if it doesn't exist
   std::error_code ec;
@@ -252,18 +323,20 @@ void index::checkout(fstree::cache& cache, const std::filesystem::path& path) {
 
   sorted_directory_iterator tree(path, _ignore);
 
-  auto cur_tree_node = tree.begin();
-  auto cur_index_node = _inodes.begin();
-  auto end_tree_node = tree.end();
-  auto end_index_node = _inodes.end();
+  // Join columnar snapshots of the existing tree and the index
+  index_snapshot existing(tree.begin(), tree.end());
+  index_snapshot wanted(_inodes.begin(), _inodes.end());
 
-  index new_index;
+  size_t cur_tree_node = 0;
+  size_t cur_index_node = 0;
+  size_t end_tree_node = existing.size();
+  size_t end_index_node = wanted.size();
 
   for (;;) {
     // Reached the end of the tree. All remaining index nodes are added.
     if (cur_tree_node == end_tree_node) {
       for (; cur_index_node != end_index_node; cur_index_node++) {
-        checkout_node(cache, *cur_index_node, path);
+        checkout_node(cache, inode::ptr(wanted.node(cur_index_node)), path);
       }
       break;
     }
@@ -272,7 +345,7 @@ void index::checkout(fstree::cache& cache, const std::filesystem::path& path) {
     if (cur_index_node == end_index_node) {
       for (; cur_tree_node != end_tree_node; cur_tree_node++) {
         // Remove files that are not in the index
-        std::filesystem::path absolute_path = path / (*cur_tree_node)->path();
+        std::filesystem::path absolute_path = path / existing.path(cur_tree_node);
         std::filesystem::remove_all(absolute_path, ec);
         if (ec) {
           throw std::runtime_error("failed to remove file: " + absolute_path.string() + ": " + ec.message());
@@ -281,18 +354,20 @@ void index::checkout(fstree::cache& cache, const std::filesystem::path& path) {
       break;
     }
 
+    int cmp = existing.path(cur_tree_node).compare(wanted.path(cur_index_node));
+
     // If the tree node is less than the index node, it should be removed
-    if ((*cur_tree_node)->path() < (*cur_index_node)->path()) {
+    if (cmp < 0) {
       // Check if the parent directory of the tree node is canonical.
       // If not, the tree node must be ignored because it's parent directory became a symlink.
-      std::filesystem::path tree_parent = (path / (*cur_tree_node)->path()).parent_path();
+      std::filesystem::path tree_parent = (path / existing.path(cur_tree_node)).parent_path();
       std::filesystem::path tree_canonical_parent = std::filesystem::weakly_canonical(tree_parent);
       if (tree_parent != tree_canonical_parent) {
         cur_tree_node++;
         continue;
       }
 
-      std::filesystem::path absolute_path = path / (*cur_tree_node)->path();
+      std::filesystem::path absolute_path = path / existing.path(cur_tree_node);
       std::filesystem::remove_all(absolute_path, ec);
       if (ec) {
         throw std::runtime_error("failed to remove directory: " + absolute_path.string() + ": " + ec.message());
@@ -302,81 +377,90 @@ void index::checkout(fstree::cache& cache, const std::filesystem::path& path) {
     }
 
     // If the tree node is greater than the index node, index node should be created.
-    if ((*cur_tree_node)->path() > (*cur_index_node)->path()) {
-      checkout_node(cache, *cur_index_node, path);
+    if (cmp > 0) {
+      checkout_node(cache, inode::ptr(wanted.node(cur_index_node)), path);
       cur_index_node++;
       continue;
     }
 
     // If the tree node is equal to the index node, it's maybe modified
-    if ((*cur_tree_node)->path() == (*cur_index_node)->path()) {
-      // Compare inode type
-      if ((*cur_tree_node)->type() != (*cur_index_node)->type()) {
-        switch ((*cur_tree_node)->type()) {
-          case std::filesystem::file_type::directory: {
-            std::filesystem::path absolute_path = path / (*cur_tree_node)->path();
-            std::filesystem::remove_all(absolute_path, ec);
-            if (ec) {
-              throw std::runtime_error("failed to remove directory: " + absolute_path.string() + ": " + ec.message());
-            }
-            // Skip ahead all children of the directory in the tree
-            {
-              auto dir_path = (*cur_tree_node)->path() + "/";
+    file_status tree_status = existing.status(cur_tree_node);
+    file_status index_status = wanted.status(cur_index_node);
+
+    // Compare inode type
+    if (tree_status.type() != index_status.type()) {
+      switch (tree_status.type()) {
+        case std::filesystem::file_type::directory: {
+          std::filesystem::path absolute_path = path / existing.path(cur_tree_node);
+          std::filesystem::remove_all(absolute_path, ec);
+          if (ec) {
+            throw std::runtime_error("failed to remove directory: " + absolute_path.string() + ": " + ec.message());
+          }
+          // Skip ahead all children of the directory in the tree
+          {
+            auto dir_path = std::string(existing.path(cur_tree_node)) + "/";
+            cur_tree_node++;
+            while (cur_tree_node != end_tree_node && existing.path(cur_tree_node).starts_with(dir_path)) {
               cur_tree_node++;
-              while (cur_tree_node != end_tree_node && (*cur_tree_node)->path().find(dir_path) == 0) {
-                cur_tree_node++;
-              }
             }
-            checkout_node(cache, *cur_index_node, path);
-            cur_index_node++;
-            continue;
           }
+          checkout_node(cache, inode::ptr(wanted.node(cur_index_node)), path);
+          cur_index_node++;
+          continue;
+        }
 
-          default: {
-            std::filesystem::path absolute_path = path / (*cur_tree_node)->path();
-            std::filesystem::remove(absolute_path, ec);
-            if (ec) {
-              throw std::runtime_error("failed to remove file: " + absolute_path.string() + ": " + ec.message());
-            }
-            break;
+        default: {
+          std::filesystem::path absolute_path = path / existing.path(cur_tree_node);
+          std::filesystem::remove(absolute_path, ec);
+          if (ec) {
+            throw std::runtime_error("failed to remove file: " + absolute_path.string() + ": " + ec.message());
           }
+          break;
         }
-        checkout_node(cache, *cur_index_node, path);
-
-        cur_tree_node++;
-        cur_index_node++;
-        continue;
       }
+      checkout_node(cache, inode::ptr(wanted.node(cur_index_node)), path);
 
-      // Compare modification time
-      if ((*cur_tree_node)->last_write_time() != (*cur_index_node)->last_write_time()) {
-        if (!(*cur_index_node)->is_directory()) checkout_node(cache, *cur_index_node, path);
-      }
+      cur_tree_node++;
+      cur_index_node++;
+      continue;
+    }
 
-      // Compare inode permissions
-      if ((*cur_tree_node)->permissions() != (*cur_index_node)->permissions()) {
-        std::filesystem::permissions(
-            path / (*cur_index_node)->path(), (*cur_index_node)->permissions(), std::filesystem::perm_options::replace,
-            ec);
-        if (ec) {
-          throw std::runtime_error("failed to set permissions: " + path.string() + ": " + ec.message());
-        }
-      }
+    // Compare modification time
+    if (existing.last_write_time(cur_tree_node) != wanted.last_write_time(cur_index_node)) {
+      if (!index_status.is_directory()) checkout_node(cache, inode::ptr(wanted.node(cur_index_node)), path);
+    }
 
-      // Compare symlink target
-      if ((*cur_index_node)->target() != (*cur_tree_node)->target()) {
-        std::filesystem::remove(path / (*cur_index_node)->path(), ec);
-        if (ec) {
-          throw std::runtime_error("failed to remove symlink: " + path.string() + ": " + ec.message());
-        }
+    // Compare inode permissions
+    if (tree_status.permissions() != index_status.permissions()) {
+      std::filesystem::permissions(
+          path / wanted.path(cur_index_node), index_status.permissions(), std::filesystem::perm_options::replace, ec);
+      if (ec) {
+        throw std::runtime_error("failed to set permissions: " + path.string() + ": " + ec.message());
+      }
+    }
 
-        checkout_node(cache, *cur_index_node, path);
+    // Compare symlink target
+    if (wanted.node(cur_index_node)->target() != existing.node(cur_tree_node)->target()) {
+      std::filesystem::remove(path / wanted.path(cur_index_node), ec);
+      if (ec) {
+        throw std::runtime_error("failed to remove symlink: " + path.string() + ": " + ec.message());
       }
 
-      cur_tree_node++;
-      cur_index_node++;
-      continue;
+      checkout_node(cache, inode::ptr(wanted.node(cur_index_node)), path);
     }
+
+    cur_tree_node++;
+    cur_index_node++;
+  }
+}
+
+// Writes the inline contents of a file
+static void write_file(const std::filesystem::path& path, const std::string& data) {
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file.write(data.data(), data.size());
+  file.close();
+  if (!file) {
+    throw std::runtime_error("failed to write file: " + path.string() + ": " + std::strerror(errno));
   }
 }
 
@@ -417,7 +501,12 @@ void index::checkout_node(fstree::cache& c, inode::ptr node, const std::filesyst
     if (ec) {
       throw std::runtime_error("failed to remove file: " + full_path.string() + ": " + ec.message());
     }
-    c.copy_file(node->hash(), full_path);
+    if (node->has_inline_data()) {
+      write_file(full_path, node->inline_data());
+    }
+    else {
+      c.copy_file(node->hash(), full_path);
+    }
     std::filesystem::permissions(full_path, node->permissions(), std::filesystem::perm_options::replace, ec);
     if (ec) {
       throw std::runtime_error("failed to set permissions: " + full_path.string() + ": " + ec.message());
@@ -433,10 +522,11 @@ void index::checkout_node(fstree::cache& c, inode::ptr node, const std::filesyst
 }
 
 inode::ptr index::find_node_by_path(const std::filesystem::path& path) const {
-  auto it = std::lower_bound(_inodes.begin(), _inodes.end(), path.string(), [](const inode::ptr& a, const std::string& b) {
-    return a->path() < b;
+  const std::string str = path.string();
+  auto it = std::lower_bound(_inodes.begin(), _inodes.end(), str, [](const inode::ptr& a, const std::string& b) {
+    return a->compare_path(b) < 0;
   });
-  if (it != _inodes.end() && (*it)->path() == path) {
+  if (it != _inodes.end() && (*it)->compare_path(str) == 0) {
     return *it;
   }
   return nullptr;
@@ -445,6 +535,9 @@ inode::ptr index::find_node_by_path(const std::filesystem::path& path) const {
 std::vector<inode::ptr> index::glob(const std::string& pattern) const {
   std::vector<inode::ptr> result;
   if (_root->has_children()) {
+    if (glob_lookup(pattern, result)) {
+      return result;
+    }
     return glob_recursive(pattern, _root, result);
   }
   else {
@@ -456,17 +549,19 @@ std::vector<inode::ptr> index::glob(const glob_list& patterns) const {
   std::vector<inode::ptr> result;
   for (auto it = patterns.begin(); it != patterns.end(); ++it) {
     if (_root->has_children()) {
-      glob_recursive(*it, _root, result);
+      if (!glob_lookup(*it, result)) {
+        glob_recursive(*it, _root, result);
+      }
     } else {
       glob_linear(*it, result);
     }
   }
   // Remove duplicates (a file may be matched by more than one pattern).
   std::sort(result.begin(), result.end(), [](const inode::ptr& a, const inode::ptr& b) {
-    return a->path() < b->path();
+    return a->compare_path(*b) < 0;
   });
   result.erase(std::unique(result.begin(), result.end(), [](const inode::ptr& a, const inode::ptr& b) {
-    return a->path() == b->path();
+    return a->compare_path(*b) == 0;
   }), result.end());
   return result;
 }
@@ -535,7 +630,7 @@ static std::vector<std::string> split_glob_pattern(const std::string& pattern) {
 // result:  matched inodes are appended here
 static void glob_match_node(
     const std::vector<std::string>& segs, size_t seg_idx,
-    const inode::ptr& node, std::vector<inode::ptr>& result)
+    inode* node, std::vector<inode::ptr>& result)
 {
   if (seg_idx >= segs.size()) {
     return;
@@ -547,7 +642,7 @@ static void glob_match_node(
   if (seg == "**") {
     if (last_seg) {
       // '**' as the final segment: match this node and everything beneath it.
-      result.push_back(node);
+      result.push_back(inode::ptr(node));
       if (node->is_directory()) {
         for (const auto& child : *node) {
           glob_match_node(segs, seg_idx, child, result);
@@ -573,7 +668,7 @@ static void glob_match_node(
     }
 
     if (last_seg) {
-      result.push_back(node);
+      result.push_back(inode::ptr(node));
     } else if (node->is_directory()) {
       // Partial match: descend into children with the next segment.
       for (const auto& child : *node) {
@@ -613,11 +708,124 @@ std::vector<inode::ptr> index::glob_recursive(const std::string& pattern, const
   return result;
 }
 
+// Returns the extension of a name, i.e. everything after the last '.'.
+// Names without a '.' have no extension and are not indexed by extension.
+static bool name_extension(const std::string& name, std::string& ext) {
+  size_t dot = name.rfind('.');
+  if (dot == std::string::npos) {
+    return false;
+  }
+  ext = name.substr(dot + 1);
+  return true;
+}
+
+void index::build_lookup() const {
+  _by_name.clear();
+  _by_extension.clear();
+
+  // Walk the inode tree rather than the inode list so that the lookup
+  // covers exactly the nodes that glob_recursive() would visit, in the
+  // same pre-order.
+  std::vector<inode*> stack;
+  for (auto it = _root->end(); it != _root->begin();) {
+    stack.push_back(*--it);
+  }
+  while (!stack.empty()) {
+    inode* node = stack.back();
+    stack.pop_back();
+
+    const std::string& name = node->name();
+    std::string ext;
+    if (name_extension(name, ext)) {
+      _by_extension[ext].push_back(node);
+    }
+    _by_name[name].push_back(node);
+
+    // Push children in reverse so that they are visited in tree order.
+    for (auto it = node->end(); it != node->begin();) {
+      stack.push_back(*--it);
+    }
+  }
+
+  _lookup_valid = true;
+}
+
+void index::invalidate_lookup() {
+  if (_lookup_valid) {
+    _lookup_valid = false;
+    _by_name.clear();
+    _by_extension.clear();
+  }
+}
+
+bool index::glob_lookup(const std::string& pattern, std::vector<inode::ptr>& result) const {
+  std::vector<std::string> segs = split_glob_pattern(pattern);
+  bool anchored = (!pattern.empty() && pattern[0] == '/');
+
+  // Strip leading '**' segments. The remaining pattern must be a single
+  // segment that may match at any depth for the lookup tables to apply.
+  size_t first = 0;
+  while (first < segs.size() && segs[first] == "**") {
+    ++first;
+  }
+  if (segs.size() - first != 1 || (anchored && first == 0)) {
+    return false;
+  }
+
+  const std::string& seg = segs[first];
+  size_t wildcard = seg.find_last_of("*?");
+
+  const std::unordered_map<std::string, std::vector<inode*>>* table = nullptr;
+  std::string key;
+
+  if (wildcard == std::string::npos) {
+    // A literal basename, e.g. CMakeLists.txt
+    table = &_by_name;
+    key = seg;
+  }
+  else {
+    // Any name matching the segment ends with its literal suffix. If that
+    // suffix contains a '.', all matches share the suffix's extension,
+    // e.g. '*.so', 'lib*.so' or '*.tar.gz'.
+    if (!name_extension(seg.substr(wildcard + 1), key)) {
+      return false;
+    }
+    table = &_by_extension;
+  }
+
+  // Concurrent globs on a shared index build the tables once
+  {
+    std::lock_guard<std::mutex> lock(_lookup_mutex.mutex);
+    if (!_lookup_valid) {
+      build_lookup();
+    }
+  }
+
+  auto it = table->find(key);
+  if (it == table->end()) {
+    return true;
+  }
+
+  for (const auto& node : it->second) {
+    if (wildcard == std::string::npos || glob_match_segment(seg, node->name())) {
+      result.push_back(inode::ptr(node));
+    }
+  }
+
+  return true;
+}
+
 void index::load_ignore_from_index(fstree::cache& cache, const std::filesystem::path& path) {
   fstree::inode::ptr ignore_node = find_node_by_path(path);
-  if (ignore_node && ignore_node->is_file()) {
-    auto ignore_path = cache.file_path(ignore_node);
-    _ignore.load(ignore_path.string());
+  if (ignore_node && ignore_node->has_inline_data()) {
+    std::istringstream data(ignore_node->inline_data());
+    _ignore.load(data);
+  }
+  else if (ignore_node && ignore_node->is_file()) {
+    std::string contents;
+    cache.read_file(ignore_node->hash(), contents);
+    std::istringstream data(contents);
+    _ignore.load(data);
   }
 }
 
@@ -645,50 +853,66 @@ void index::refresh() {
 
   // Copy index a temporary vector and clear the index
   std::vector<inode::ptr> nodes(std::move(_inodes));
+  _inodes.clear();
 
-  auto tree_it = tree.begin();
-  auto tree_end = tree.end();
-  auto index_it = nodes.begin();
-  auto index_end = nodes.end();
+  // Join columnar snapshots of the filesystem tree and the old index
+  index_snapshot scanned(tree.begin(), tree.end());
+  index_snapshot previous(nodes.begin(), nodes.end());
+  _inodes.reserve(scanned.size());
+
+  size_t tree_it = 0;
+  size_t tree_end = scanned.size();
+  size_t index_it = 0;
+  size_t index_end = previous.size();
 
   // Iterate through the filesystem tree and the index in parallel
   // looking for matching paths.
 
-  while (tree_it != tree_end || index_it != index_end) {
-    if (tree_it == tree_end) {
-      // No more tree nodes - done
-      break;
-    }
-    else if (index_it == index_end) {
+  while (tree_it != tree_end) {
+    if (index_it == index_end) {
       // No more index nodes - add remaining tree nodes
       for (; tree_it != tree_end; ++tree_it) {
-        _inodes.push_back(*tree_it);
+        _inodes.emplace_back(scanned.node(tree_it));
       }
       break;
     }
-    else if ((*tree_it)->path() < (*index_it)->path()) {
+
+    int cmp = scanned.path(tree_it).compare(previous.path(index_it));
+    if (cmp < 0) {
       // Tree node is new - add it
-      _inodes.push_back(*tree_it);
+      _inodes.emplace_back(scanned.node(tree_it));
       ++tree_it;
     }
-    else if ((*tree_it)->path() > (*index_it)->path()) {
+    else if (cmp > 0) {
       // Index node was deleted - ignore it
       ++index_it;
     }
     else {
       // Matching paths - keep the tree node
-      _inodes.push_back(*tree_it);
+      inode* node = scanned.node(tree_it);
+      _inodes.emplace_back(node);
 
       // Check if hash can be reused from index
       // It's reused if the inodes have the same metadata.
-      // The hash length must also match the current algorithm's hash length.
-      if ((*index_it)->hash().alg() != fstree::hash_function || (*index_it)->hash().hexdigest().size() != fstree::hash_digest_length) {
-        (*tree_it)->set_dirty();
+      // The hash must also have been computed with the current algorithm.
+      file_status tree_status = scanned.status(tree_it);
+      file_status index_status = previous.status(index_it);
+
+      if (previous.hash(index_it).alg() != fstree::hash_function) {
+        node->set_dirty();
       }
-      else if ((*index_it)->is_equivalent(*tree_it)) {
-        (*tree_it)->set_hash((*index_it)->hash());
+      else if (tree_status.type() == index_status.type() && tree_status.permissions() == index_status.permissions() &&
+               scanned.last_write_time(tree_it) == previous.last_write_time(index_it) &&
+               node->target() == previous.node(index_it)->target()) {
+        node->set_hash(previous.hash(index_it));
+
+        // An unchanged file keeps its inline contents, in case it's inlined again
+        inode* previous_node = previous.node(index_it);
+        if (previous_node->has_inline_data() && previous_node->inline_data().size() == node->size()) {
+          node->set_inline_data(previous_node->inline_data());
+        }
       } else {
-        (*tree_it)->set_dirty();
+        node->set_dirty();
       }
 
       ++tree_it;
@@ -696,13 +920,16 @@ void index::refresh() {
     }
   }
 
-  // Replace root node
+  // Replace root node and adopt the arena of the scanned tree
   _root = std::move(tree.root());
+  _arena = tree.arena();
+  invalidate_lookup();
 }
 
 void index::merge(const fstree::index& other) {
-  // Create a new root node for the merged tree
-  inode::ptr new_root = fstree::make_intrusive<fstree::inode>();
+  // Create a new arena and root node for the merged tree
+  _arena = fstree::make_intrusive<fstree::inode_arena>();
+  inode::ptr new_root = _arena->make();
 
   // Clear current inodes and rebuild from scratch
   std::vector<inode::ptr> old_inodes(std::move(_inodes));
@@ -712,6 +939,7 @@ void index::merge(const fstree::index& other) {
 
   // Update the root
   _root = new_root;
+  invalidate_lookup();
 }
 
 void index::merge_recursive(inode::ptr& parent, const std::string& parent_path,
@@ -782,7 +1010,7 @@ void index::merge_recursive(inode::ptr& parent, const std::string& parent_path,
       }
       break;
     }
-    else if ((*current_it)->path() < (*other_it)->path()) {
+    else if ((*current_it)->compare_path(**other_it) < 0) {
       // Node exists only in current - clone it
       new_node = clone_node(*current_it);
       parent->add_child(new_node);
@@ -795,7 +1023,7 @@ void index::merge_recursive(inode::ptr& parent, const std::string& parent_path,
       }
       ++current_it;
     }
-    else if ((*current_it)->path() > (*other_it)->path()) {
+    else if ((*current_it)->compare_path(**other_it) > 0) {
       // Node exists only in other - clone it
       new_node = clone_node(*other_it);
       parent->add_child(new_node);
@@ -830,7 +1058,7 @@ void index::merge_recursive(inode::ptr& parent, const std::string& parent_path,
 
 inode::ptr index::clone_node(const inode::ptr& source) {
   // Create a new inode with the same properties as the source
-  inode::ptr new_node = fstree::make_intrusive<fstree::inode>(
+  inode::ptr new_node = _arena->make(
     source->path(),
     source->status(),
     source->last_write_time(),
@@ -838,6 +1066,9 @@ inode::ptr index::clone_node(const inode::ptr& source) {
     source->target(),
     source->hash()
   );
+  if (source->has_inline_data()) {
+    new_node->set_inline_data(source->inline_data());
+  }
 
   return new_node;
 }
@@ -2,9 +2,12 @@
 
 #include "glob_list.hpp"
 #include "inode.hpp"
+#include "inode_arena.hpp"
 
 #include <filesystem>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <sys/stat.h>
@@ -16,10 +19,27 @@ class remote;
 
 class index {
   glob_list _ignore;
+  intrusive_ptr<inode_arena> _arena;
   std::vector<inode::ptr> _inodes;
   std::filesystem::path _root_path;
   inode::ptr _root;
 
+  // Guards the lazy build of the lookup tables. Copies get their own mutex.
+  struct lookup_mutex {
+    std::mutex mutex;
+    lookup_mutex() = default;
+    lookup_mutex(const lookup_mutex&) {}
+    lookup_mutex& operator=(const lookup_mutex&) { return *this; }
+  };
+
+  // Secondary lookup tables used by glob(), mapping basenames and extensions
+  // to inodes of the tree under _root, in tree order. Built on first use and
+  // invalidated when the index changes.
+  mutable std::unordered_map<std::string, std::vector<inode*>> _by_name;
+  mutable std::unordered_map<std::string, std::vector<inode*>> _by_extension;
+  mutable bool _lookup_valid = false;
+  mutable lookup_mutex _lookup_mutex;
+
  public:
   // Constructor
   index();
@@ -44,6 +64,9 @@ class index {
 
   const inode::ptr& root() const;
 
+  // Removes all inodes, keeping the root path and ignore list
+  void clear();
+
   // Checks out the index to the given path
   void checkout(fstree::cache& cache, const std::filesystem::path& path);
 
@@ -55,7 +78,9 @@ class index {
 
   inode::ptr find_node_by_path(const std::filesystem::path& path) const;
 
-  // Returns a list of inodes matching the given glob pattern
+  // Returns a list of inodes matching the given glob pattern.
+  // Patterns that reduce to a basename or extension at any depth, such as
+  // '**/CMakeLists.txt' or '*.so', are answered from lookup tables.
   std::vector<inode::ptr> glob(const std::string& pattern) const;
   std::vector<inode::ptr> glob(const glob_list& patterns) const;
 
@@ -91,6 +116,14 @@ class index {
  private:
   void checkout_node(fstree::cache& c, inode::ptr node, const std::filesystem::path& path);
 
+  // Answers the pattern from the basename/extension lookup tables.
+  // Returns false if the pattern can't be reduced to such a lookup.
+  bool glob_lookup(const std::string& pattern, std::vector<inode::ptr>& result) const;
+
+  void build_lookup() const;
+
+  void invalidate_lookup();
+
   std::vector<inode::ptr> glob_linear(const std::string& patterns, std::vector<inode::ptr>& result) const;
 
   std::vector<inode::ptr> glob_recursive(const std::string& patterns, const inode::ptr& node, std::vector<inode::ptr>& result) const;
@@ -0,0 +1,44 @@
+#include "index_snapshot.hpp"
+
+namespace fstree {
+
+// Rough average path length, used to size the path buffer up front
+static const size_t g_average_path_length = 48;
+
+size_t index_snapshot::lower_bound(std::string_view path) const {
+  size_t first = 0;
+  size_t count = size();
+
+  while (count > 0) {
+    size_t step = count / 2;
+    if (this->path(first + step) < path) {
+      first += step + 1;
+      count -= step + 1;
+    }
+    else {
+      count = step;
+    }
+  }
+
+  return first;
+}
+
+void index_snapshot::reserve(size_t size) {
+  _paths.reserve(size * g_average_path_length);
+  _offsets.reserve(size + 1);
+  _hashes.reserve(size);
+  _mtimes.reserve(size);
+  _status.reserve(size);
+  _nodes.reserve(size);
+}
+
+void index_snapshot::push_back(const inode& node) {
+  node.append_path(_paths);
+  _offsets.push_back(_paths.size());
+  _hashes.push_back(node.hash());
+  _mtimes.push_back(node.last_write_time());
+  _status.push_back(node.status());
+  _nodes.push_back(const_cast<inode*>(&node));
+}
+
+}  // namespace fstree
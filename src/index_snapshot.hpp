@@ -0,0 +1,77 @@
+#pragma once
+
+#include "digest.hpp"
+#include "inode.hpp"
+#include "status.hpp"
+
+#include <cstddef>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace fstree {
+
+// A columnar, read-only snapshot of a sorted list of inodes.
+//
+// Paths are stored back to back in one buffer and the other attributes in
+// parallel arrays, so that the sorted merge joins in index can scan two
+// snapshots sequentially and compare paths with plain memory compares. The
+// snapshot can also be split by path into ranges that are joined in
+// parallel.
+//
+// The snapshot does not hold references to the inodes, which must be
+// kept alive by the owner of the original list.
+class index_snapshot {
+ public:
+  index_snapshot() = default;
+
+  // Builds a snapshot of a range of inode::ptr, which must be sorted by path
+  template <typename Iterator>
+  index_snapshot(Iterator begin, Iterator end) {
+    reserve(static_cast<size_t>(std::distance(begin, end)));
+    for (; begin != end; ++begin) {
+      push_back(**begin);
+    }
+  }
+
+  // Returns the number of entries
+  size_t size() const { return _nodes.size(); }
+
+  // Returns true if the snapshot has no entries
+  bool empty() const { return _nodes.empty(); }
+
+  // Returns the path of an entry
+  std::string_view path(size_t i) const {
+    return std::string_view(_paths.data() + _offsets[i], _offsets[i + 1] - _offsets[i]);
+  }
+
+  // Returns the hash of an entry
+  const fstree::digest& hash(size_t i) const { return _hashes[i]; }
+
+  // Returns the modification time of an entry
+  inode::time_type last_write_time(size_t i) const { return _mtimes[i]; }
+
+  // Returns the type and permissions of an entry
+  file_status status(size_t i) const { return file_status(_status[i]); }
+
+  // Returns the inode of an entry
+  inode* node(size_t i) const { return _nodes[i]; }
+
+  // Returns the first entry whose path is not less than the given path
+  size_t lower_bound(std::string_view path) const;
+
+ private:
+  void reserve(size_t size);
+
+  void push_back(const inode& node);
+
+  std::string _paths;
+  std::vector<size_t> _offsets{0};
+  std::vector<fstree::digest> _hashes;
+  std::vector<inode::time_type> _mtimes;
+  std::vector<uint32_t> _status;
+  std::vector<inode*> _nodes;
+};
+
+}  // namespace fstree
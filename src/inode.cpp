@@ -1,48 +1,93 @@
 #include "inode.hpp"
 #include "hash.hpp"
+#include "inode_arena.hpp"
+#include "varint.hpp"
 
 #include <algorithm>
+#include <bit>
+#include <cstdio>
 #include <cstring>
+#include <sstream>
+#include <type_traits>
 
 namespace fstree {
 
 static const uint16_t g_magic = 0x3eee;
-static const uint16_t g_version = 1;
+static const uint16_t g_version_1 = 1;
+static const uint16_t g_version_2 = 2;
+static const uint16_t g_version_shards = 3;
+static const uint16_t g_version = g_version_2;
 
-// Constructor implementations
-inode::inode() : _status(file_status(std::filesystem::file_type::directory, std::filesystem::perms::none)) {}
+// Entry flags of version 2 trees
+static const uint8_t g_entry_size = 0x01;
+static const uint8_t g_entry_file_count = 0x02;
+static const uint8_t g_entry_inline = 0x04;
+
+// Directories with more entries than this are split into shards
+static const size_t g_shard_threshold = 4096;
+static const size_t g_shard_count = 256;
 
+// Constructor implementations
 inode::inode(
-    const std::string& path,
+    inode_arena* arena,
+    const std::string* dir,
+    const std::string* name,
+    const std::string* target,
     file_status status,
     time_type mtime,
     size_t size,
-    const std::string& target,
     const fstree::digest& hash)
-    : _path(path), _hash(hash), _status(status), _last_write_time(mtime), _size(size), _target(target) {}
+    : _arena(arena),
+      _dir(dir),
+      _name(name),
+      _target(target),
+      _last_write_time(mtime),
+      _size(size),
+      _status(status),
+      _hash(hash) {}
+
+static_assert(std::is_trivially_destructible_v<inode>, "inode must be trivially destructible");
+
+// Reference counting
+void inode::add_ref() { _arena->add_ref(); }
+
+void inode::release_ref() { _arena->release_ref(); }
+
+inode_arena* inode::arena() const { return _arena; }
+
+void inode::add_child(const inode::ptr& child) {
+  if (child->_arena != _arena) {
+    throw std::invalid_argument("inode belongs to another arena: " + child->path());
+  }
 
-void inode::add_child(inode::ptr& child) {
-  _children.push_back(child);
-  child->set_parent(intrusive_from_this());
+  // Child arrays have a power of two capacity, grow when full
+  if (_child_count == 0 || std::has_single_bit(_child_count)) {
+    inode** children = _arena->allocate_children(_child_count == 0 ? 1 : _child_count * 2);
+    std::copy(_children, _children + _child_count, children);
+    _children = children;
+  }
+
+  _children[_child_count++] = child.get();
+  child->_parent = this;
 }
 
 // Iterator implementations
-std::vector<inode::ptr>::iterator inode::begin() { return _children.begin(); }
+inode::iterator inode::begin() { return _children; }
 
-std::vector<inode::ptr>::iterator inode::end() { return _children.end(); }
+inode::iterator inode::end() { return _children + _child_count; }
 
-std::vector<inode::ptr>::const_iterator inode::begin() const { return _children.begin(); }
+inode::const_iterator inode::begin() const { return _children; }
 
-std::vector<inode::ptr>::const_iterator inode::end() const { return _children.end(); }
+inode::const_iterator inode::end() const { return _children + _child_count; }
 
 // Type checking methods
-bool inode::is_directory() const { return _status.is_directory(); }
+bool inode::is_directory() const { return status().is_directory(); }
 
-bool inode::is_file() const { return _status.is_regular(); }
+bool inode::is_file() const { return status().is_regular(); }
 
-bool inode::is_symlink() const { return _status.is_symlink(); }
+bool inode::is_symlink() const { return status().is_symlink(); }
 
-bool inode::has_children() const { return !_children.empty(); }
+bool inode::has_children() const { return _child_count > 0; }
 
 // Hash methods
 const fstree::digest& inode::hash() const { return _hash; }
@@ -50,17 +95,42 @@ const fstree::digest& inode::hash() const { return _hash; }
 void inode::set_hash(const fstree::digest& hash) { _hash = hash; }
 
 // Status methods
-file_status inode::status() const { return _status; }
+file_status inode::status() const { return file_status(_status); }
 
 void inode::set_status(file_status status) { _status = status; }
 
-// Size method
+// Size methods
 size_t inode::size() const { return _size; }
 
+void inode::set_size(size_t size) { _size = size; }
+
+size_t inode::file_count() const { return _file_count; }
+
+void inode::set_file_count(size_t count) { _file_count = static_cast<uint32_t>(std::min<size_t>(count, UINT32_MAX)); }
+
+void inode::update_totals() {
+  size_t size = 0, files = 0;
+  for (const inode* child : *this) {
+    if (child->is_ignored()) {
+      continue;
+    }
+    if (child->is_file()) {
+      size += child->size();
+      files++;
+    }
+    else if (child->is_directory()) {
+      size += child->size();
+      files += child->file_count();
+    }
+  }
+  set_size(size);
+  set_file_count(files);
+}
+
 // Type and permissions
-std::filesystem::file_type inode::type() const { return _status.type(); }
+std::filesystem::file_type inode::type() const { return status().type(); }
 
-std::filesystem::perms inode::permissions() const { return _status.permissions(); }
+std::filesystem::perms inode::permissions() const { return status().permissions(); }
 
 // Time methods
 inode::time_type inode::last_write_time() const { return _last_write_time; }
@@ -68,18 +138,88 @@ inode::time_type inode::last_write_time() const { return _last_write_time; }
 void inode::set_last_write_time(time_type last_write_time) { _last_write_time = last_write_time; }
 
 // Target methods
-const std::string& inode::target() const { return _target; }
+const std::string& inode::target() const {
+  static const std::string empty;
+  return (_flags & flag_inline) ? empty : *_target;
+}
+
+std::filesystem::path inode::target_path() const { return std::filesystem::path(target()).make_preferred(); }
+
+bool inode::has_inline_data() const { return _flags & flag_inline; }
+
+const std::string& inode::inline_data() const {
+  static const std::string empty;
+  return (_flags & flag_inline) ? *_target : empty;
+}
 
-std::filesystem::path inode::target_path() const { return std::filesystem::path(_target).make_preferred(); }
+void inode::set_inline_data(std::string_view data) {
+  _target = _arena->intern_locked(data);
+  _flags |= flag_inline;
+}
+
+void inode::clear_inline_data() {
+  if (_flags & flag_inline) {
+    _target = _arena->intern_locked("");
+    _flags &= ~flag_inline;
+  }
+}
 
 // Path methods
-const std::string& inode::path() const { return _path; }
+std::string inode::path() const {
+  std::string path;
+  path.reserve(_dir->size() + _name->size());
+  path.append(*_dir);
+  path.append(*_name);
+  return path;
+}
+
+void inode::append_path(std::string& out) const {
+  out.append(*_dir);
+  out.append(*_name);
+}
+
+// Compares the concatenations a[0] + a[1] and b[0] + b[1]
+static int compare_parts(const std::string_view (&a)[2], const std::string_view (&b)[2]) {
+  size_t ai = 0, ao = 0, bi = 0, bo = 0;
+
+  while (true) {
+    while (ai < 2 && ao == a[ai].size()) ai++, ao = 0;
+    while (bi < 2 && bo == b[bi].size()) bi++, bo = 0;
+    if (ai == 2 || bi == 2) {
+      return (ai == 2 ? 0 : 1) - (bi == 2 ? 0 : 1);
+    }
+
+    size_t n = std::min(a[ai].size() - ao, b[bi].size() - bo);
+    int cmp = a[ai].substr(ao, n).compare(b[bi].substr(bo, n));
+    if (cmp != 0) {
+      return cmp;
+    }
+    ao += n;
+    bo += n;
+  }
+}
 
-std::string inode::name() const { return std::filesystem::path(_path).filename().string(); }
+int inode::compare_path(const inode& other) const {
+  if (_dir == other._dir) {
+    return _name->compare(*other._name);
+  }
+
+  const std::string_view a[2] = {*_dir, *_name};
+  const std::string_view b[2] = {*other._dir, *other._name};
+  return compare_parts(a, b);
+}
+
+int inode::compare_path(std::string_view path) const {
+  const std::string_view a[2] = {*_dir, *_name};
+  const std::string_view b[2] = {path, std::string_view()};
+  return compare_parts(a, b);
+}
 
-const inode::ptr& inode::parent() const { return _parent; }
+const std::string& inode::name() const { return *_name; }
 
-void inode::set_parent(const inode::ptr& parent) { _parent = parent; }
+inode::ptr inode::parent() const { return inode::ptr(_parent); }
+
+void inode::set_parent(const inode::ptr& parent) { _parent = parent.get(); }
 
 void inode::set_dirty() {
   _hash = digest();
@@ -89,54 +229,125 @@ void inode::set_dirty() {
 }
 
 void inode::sort() {
-  std::sort(_children.begin(), _children.end(), [](const inode::ptr& a, const inode::ptr& b) { return a->path() < b->path(); });
+  std::sort(begin(), end(), [](const inode* a, const inode* b) { return a->compare_path(*b) < 0; });
 }
 
 bool inode::is_dirty() const { return _hash.empty(); }
 
-bool inode::is_equivalent(const inode::ptr& other) const {
-  return _path == other->_path && _status.type() == other->_status.type() &&
-         _status.permissions() == other->_status.permissions() && _last_write_time == other->_last_write_time &&
-         _target == other->_target;
-}
+bool inode::is_equivalent(const inode::ptr& other) const { return *this == *other; }
 
 // Equality operator
 bool inode::operator==(const inode& other) const {
-  return _path == other._path && _status.type() == other._status.type() &&
-         _status.permissions() == other._status.permissions() && _last_write_time == other._last_write_time &&
-         _target == other._target;
+  return *_name == *other._name && *_dir == *other._dir && type() == other.type() &&
+         permissions() == other.permissions() && _last_write_time == other._last_write_time &&
+         target() == other.target();
 }
 
 // Ignore methods
-void inode::ignore() { _ignored = true; }
+void inode::ignore() { _flags |= flag_ignored; }
 
-bool inode::is_ignored() const { return _ignored; }
+bool inode::is_ignored() const { return _flags & flag_ignored; }
 
 void inode::unignore() {
-  if (!_unignored) {
-    _unignored = true;
+  if (!is_unignored()) {
+    _flags |= flag_unignored;
     if (_parent) _parent->unignore();
   }
 }
 
-bool inode::is_unignored() const { return _unignored; }
+bool inode::is_unignored() const { return _flags & flag_unignored; }
 
 void inode::rehash(const std::filesystem::path& root) { 
-  _hash = hashsum_hex_file(root / _path); 
+  _hash = hashsum_hex_file(root / path()); 
 }
 
-void inode::clear() {
-  std::for_each(_children.begin(), _children.end(), [](inode::ptr& child) {
-    child->clear();
-  });
-  _children.clear();
-  _parent.reset();
+// Tree objects start with a magic and a version number.
+//
+// Version 1 stores each entry as a u64 name length and the name, a u64
+// length and the digest string ("sha1:<hex>"), the u32 status bits, and for
+// symlinks a u64 target length and the target, all in host byte order.
+//
+// Version 2 stores each entry as a varint name length and the name, a one
+// byte algorithm tag followed by the raw digest bytes, the status bits as a
+// varint, a flags byte, and for symlinks a varint target length and the
+// target. Version 2 is written, both are read. The flags announce optional
+// fields that follow the flags byte: the size of a file or the total size
+// of a directory as a varint, the number of files below a directory as a
+// varint, and the contents of a small file as a varint length and the data.
+// Files with inline contents have no file object of their own.
+//
+// Directories with many entries are written as a version 3 shard index
+// instead. Entries are distributed over shards by a hash of their name, and
+// each shard is a version 2 tree object of its own. The shard index lists
+// the shards as version 2 entries named by the shard number, so a change
+// rewrites only one shard and the index.
+
+static void write_header(std::ostream& os, uint16_t version) {
+  os.write(reinterpret_cast<const char*>(&g_magic), sizeof(g_magic));
+  os.write(reinterpret_cast<const char*>(&version), sizeof(version));
+}
+
+// Writes one entry of a version 2 tree
+static void write_entry(
+    std::ostream& os,
+    const std::string& name,
+    const fstree::digest& hash,
+    file_status status,
+    const std::string& target,
+    uint8_t flags = 0,
+    uint64_t size = 0,
+    uint64_t files = 0,
+    std::string_view data = std::string_view()) {
+  // Write the path
+  write_varint(os, name.length());
+  os.write(name.c_str(), name.length());
+
+  // Write the hash
+  os.put(static_cast<char>(hash.alg()));
+  os.write(reinterpret_cast<const char*>(hash.data()), hash.size());
+
+  // Write the status bits
+  write_varint(os, uint32_t(status));
+
+  // Write the entry flags and optional fields
+  os.put(static_cast<char>(flags));
+  if (flags & g_entry_size) {
+    write_varint(os, size);
+  }
+  if (flags & g_entry_file_count) {
+    write_varint(os, files);
+  }
+  if (flags & g_entry_inline) {
+    write_varint(os, data.size());
+    os.write(data.data(), data.size());
+  }
+
+  // Write the target if it's a symlink
+  if (status.is_symlink()) {
+    write_varint(os, target.size());
+    os.write(target.c_str(), target.size());
+  }
+}
+
+// Writes the entry of a child inode, with its size, file count and inline data
+static void write_entry(std::ostream& os, const inode& child) {
+  uint8_t flags = 0;
+  if (child.is_file()) {
+    flags = g_entry_size;
+    if (child.has_inline_data()) {
+      flags |= g_entry_inline;
+    }
+  }
+  else if (child.is_directory()) {
+    flags = g_entry_size | g_entry_file_count;
+  }
+  write_entry(
+      os, child.name(), child.hash(), child.status(), child.target(), flags, child.size(), child.file_count(),
+      child.inline_data());
 }
 
 std::ostream& operator<<(std::ostream& os, const inode& inode) {
-  // write magic and version
-  os.write(reinterpret_cast<const char*>(&g_magic), sizeof(g_magic));
-  os.write(reinterpret_cast<const char*>(&g_version), sizeof(g_version));
+  write_header(os, g_version);
 
   // write each child
   for (const auto& child : inode) {
@@ -144,29 +355,7 @@ std::ostream& operator<<(std::ostream& os, const inode& inode) {
       continue;
     }
 
-    // Write the path
-    auto path = child->name();
-    uint64_t path_length = path.length();
-    os.write(reinterpret_cast<const char*>(&path_length), sizeof(path_length));
-    os.write(path.c_str(), path.length());
-
-    // Write the hash
-    auto hash = child->hash().string();
-    uint64_t hash_length = hash.length();
-    os.write(reinterpret_cast<const char*>(&hash_length), sizeof(hash_length));
-    os.write(hash.c_str(), hash_length);
-
-    // Write the status bits
-    uint32_t status_bits = child->status();
-    os.write(reinterpret_cast<const char*>(&status_bits), sizeof(status_bits));
-
-    // Write the target if it's a symlink
-    if (child->is_symlink()) {
-      auto& target = child->target();
-      uint64_t target_length = target.size();
-      os.write(reinterpret_cast<const char*>(&target_length), sizeof(target_length));
-      os.write(target.c_str(), target.size());
-    }
+    write_entry(os, *child);
 
     // Check if there was an error writing
     if (!os) {
@@ -181,7 +370,188 @@ std::ostream& operator<<(std::ostream& os, const inode& inode) {
   return os;
 }
 
-std::istream& operator>>(std::istream& is, inode& inode) {
+// Returns the shard of an entry, from the FNV-1a hash of its name
+static size_t shard_of(const std::string& name) {
+  uint32_t hash = 2166136261u;
+  for (unsigned char c : name) {
+    hash = (hash ^ c) * 16777619u;
+  }
+  return hash % g_shard_count;
+}
+
+void write_tree(
+    std::ostream& os, const inode& tree, const std::function<void(const fstree::digest&, std::string_view)>& write_shard) {
+  size_t count = 0;
+  for (const auto& child : tree) {
+    count += !child->is_ignored();
+  }
+
+  if (count <= g_shard_threshold) {
+    os << tree;
+    return;
+  }
+
+  std::vector<std::vector<const inode*>> shards(g_shard_count);
+  for (const auto& child : tree) {
+    if (!child->is_ignored()) {
+      shards[shard_of(child->name())].push_back(child);
+    }
+  }
+
+  write_header(os, g_version_shards);
+
+  for (size_t i = 0; i < shards.size(); i++) {
+    if (shards[i].empty()) {
+      continue;
+    }
+
+    std::ostringstream shard(std::ios::binary);
+    write_header(shard, g_version);
+    for (const inode* child : shards[i]) {
+      write_entry(shard, *child);
+    }
+    if (!shard) {
+      throw std::runtime_error("failed writing tree shard: " + tree.path());
+    }
+
+    fstree::digest hash = hashsum_hex(shard.view());
+    write_shard(hash, shard.view());
+
+    char name[17];
+    std::snprintf(name, sizeof(name), "%02zx", i);
+    write_entry(os, name, hash, file_status(std::filesystem::file_type::directory, std::filesystem::perms::none), "");
+  }
+
+  if (!os) {
+    throw std::runtime_error("failed writing tree: " + tree.path() + ": " + std::strerror(errno));
+  }
+}
+
+// Returns the number of bytes left in a tree stream, or UINT64_MAX if the
+// stream can't seek
+static uint64_t remaining(std::istream& is) {
+  std::istream::pos_type pos = is.tellg();
+  if (pos < 0) return UINT64_MAX;
+  is.seekg(0, std::ios::end);
+  std::istream::pos_type end = is.tellg();
+  is.seekg(pos);
+  return end < pos ? 0 : static_cast<uint64_t>(end - pos);
+}
+
+// Reads a length prefixed string of a version 1 tree
+static void read_string_v1(std::istream& is, const inode& inode, std::string& str) {
+  uint64_t length;
+  is.read(reinterpret_cast<char*>(&length), sizeof(length));
+  if (!is) throw std::runtime_error("failed reading tree: " + inode.hash().string() + ": " + std::strerror(errno));
+  if (length > remaining(is)) {
+    throw std::runtime_error("failed reading tree: " + inode.hash().string() + ": truncated entry");
+  }
+
+  str.resize(length);
+  is.read(&str[0], length);
+  if (!is) throw std::runtime_error("failed reading tree: " + inode.hash().string() + ": " + std::strerror(errno));
+}
+
+// Reads a varint length prefixed string of a version 2 tree
+static void read_string_v2(std::istream& is, const inode& inode, std::string& str) {
+  uint64_t length;
+  if (!read_varint(is, length)) {
+    throw std::runtime_error("failed reading tree: " + inode.hash().string() + ": truncated entry");
+  }
+
+  // A corrupt length must not make us allocate more than the tree holds
+  if (length > remaining(is)) {
+    throw std::runtime_error("failed reading tree: " + inode.hash().string() + ": truncated entry");
+  }
+
+  str.resize(length);
+  is.read(&str[0], length);
+  if (!is) throw std::runtime_error("failed reading tree: " + inode.hash().string() + ": truncated entry");
+}
+
+// Reads one entry of a version 1 tree
+static void read_entry_v1(
+    std::istream& is, const inode& inode, std::string& name, fstree::digest& hash, file_status& status, std::string& target) {
+  read_string_v1(is, inode, name);
+
+  std::string hash_string;
+  read_string_v1(is, inode, hash_string);
+  hash = fstree::digest::parse(hash_string);
+
+  uint32_t status_bits;
+  is.read(reinterpret_cast<char*>(&status_bits), sizeof(status_bits));
+  if (!is) throw std::runtime_error("failed reading tree: " + inode.hash().string() + ": " + std::strerror(errno));
+  status = static_cast<file_status>(status_bits);
+
+  target.clear();
+  if (status.is_symlink()) {
+    read_string_v1(is, inode, target);
+  }
+}
+
+// Reads one entry of a version 2 tree
+static void read_entry_v2(
+    std::istream& is,
+    const inode& inode,
+    std::string& name,
+    fstree::digest& hash,
+    file_status& status,
+    std::string& target,
+    uint64_t& size,
+    uint64_t& files,
+    std::string& data,
+    bool& has_data) {
+  read_string_v2(is, inode, name);
+
+  int alg = is.get();
+  if (alg == EOF) throw std::runtime_error("failed reading tree: " + inode.hash().string() + ": truncated entry");
+  if (alg > static_cast<int>(fstree::digest::algorithm::blake3)) {
+    throw std::runtime_error("failed reading tree: " + inode.hash().string() + ": unknown digest algorithm");
+  }
+
+  uint8_t bytes[fstree::digest::max_length];
+  auto algorithm = static_cast<fstree::digest::algorithm>(alg);
+  is.read(reinterpret_cast<char*>(bytes), fstree::digest::length(algorithm));
+  if (!is) throw std::runtime_error("failed reading tree: " + inode.hash().string() + ": truncated entry");
+  hash = fstree::digest(algorithm, bytes);
+
+  uint64_t status_bits;
+  if (!read_varint(is, status_bits) || status_bits > UINT32_MAX) {
+    throw std::runtime_error("failed reading tree: " + inode.hash().string() + ": invalid status");
+  }
+  status = static_cast<file_status>(static_cast<uint32_t>(status_bits));
+
+  int flags = is.get();
+  if (flags == EOF) throw std::runtime_error("failed reading tree: " + inode.hash().string() + ": truncated entry");
+  if (flags & ~(g_entry_size | g_entry_file_count | g_entry_inline)) {
+    throw std::runtime_error("failed reading tree: " + inode.hash().string() + ": unsupported entry flags");
+  }
+
+  size = 0;
+  if ((flags & g_entry_size) && !read_varint(is, size)) {
+    throw std::runtime_error("failed reading tree: " + inode.hash().string() + ": truncated entry");
+  }
+  files = 0;
+  if ((flags & g_entry_file_count) && !read_varint(is, files)) {
+    throw std::runtime_error("failed reading tree: " + inode.hash().string() + ": truncated entry");
+  }
+
+  has_data = flags & g_entry_inline;
+  data.clear();
+  if (has_data) {
+    if (!status.is_regular()) {
+      throw std::runtime_error("failed reading tree: " + inode.hash().string() + ": inline data of non-file entry");
+    }
+    read_string_v2(is, inode, data);
+  }
+
+  target.clear();
+  if (status.is_symlink()) {
+    read_string_v2(is, inode, target);
+  }
+}
+
+void read_tree(std::istream& is, inode& inode, std::vector<fstree::digest>& shards) {
   // read magic and version
 
   uint16_t magic;
@@ -196,59 +566,62 @@ std::istream& operator>>(std::istream& is, inode& inode) {
   is.read(reinterpret_cast<char*>(&version), sizeof(version));
   if (!is) throw std::runtime_error("failed reading tree: " + inode.hash().string() + ": " + std::strerror(errno));
 
-  if (version != g_version) {
+  if (version != g_version_1 && version != g_version_2 && version != g_version_shards) {
     throw std::runtime_error("failed reading tree: " + inode.hash().string() + ": unsupported version");
   }
 
+  // Children paths are relative to the tree root
+  std::string prefix = inode.path();
+  if (!prefix.empty()) {
+    prefix += static_cast<char>(std::filesystem::path::preferred_separator);
+  }
+
+  std::string path;
+  std::string target;
+  fstree::digest hash;
+  file_status status;
+  std::string data;
+  uint64_t size = 0, files = 0;
+  bool has_data = false;
+
   while (is.peek() != EOF) {
-    // Read the path
-    std::string path;
-    uint64_t path_length;
-    is.read(reinterpret_cast<char*>(&path_length), sizeof(path_length));
-    if (!is) throw std::runtime_error("failed reading tree: " + inode.hash().string() + ": " + std::strerror(errno));
-
-    path.resize(path_length);
-    is.read(&path[0], path_length);
-    if (!is) throw std::runtime_error("failed reading tree: " + inode.hash().string() + ": " + std::strerror(errno));
-    // Read the hash
-    std::string hash;
-    uint64_t hash_length;
-    is.read(reinterpret_cast<char*>(&hash_length), sizeof(hash_length));
-    if (!is) throw std::runtime_error("failed reading tree: " + inode.hash().string() + ": " + std::strerror(errno));
-
-    hash.resize(hash_length);
-    is.read(&hash[0], hash_length);
-    if (!is) throw std::runtime_error("failed reading tree: " + inode.hash().string() + ": " + std::strerror(errno));
-    // Read the file status
-    uint32_t status_bits;
-    is.read(reinterpret_cast<char*>(&status_bits), sizeof(status_bits));
-    if (!is) throw std::runtime_error("failed reading tree: " + inode.hash().string() + ": " + std::strerror(errno));
-
-    auto status = static_cast<file_status>(status_bits);
-
-    // // Read the mtime
-    // uint64_t mtime;
-    // is.read(reinterpret_cast<char *>(&mtime), sizeof(mtime));
-
-    // Read the target if it's a symlink
-    std::string target;
-    if (status.is_symlink()) {
-      uint64_t target_length;
-      is.read(reinterpret_cast<char*>(&target_length), sizeof(target_length));
-      if (!is) throw std::runtime_error("failed reading tree: " + inode.hash().string() + ": " + std::strerror(errno));
-
-      target.resize(target_length);
-      is.read(&target[0], target_length);
-      if (!is) throw std::runtime_error("failed reading tree: " + inode.hash().string() + ": " + std::strerror(errno));
-    }
-
-    std::filesystem::path inode_path = inode.path();
-    inode_path /= path;
-    auto child = fstree::make_intrusive<fstree::inode>(
-      inode_path.string(), status, inode::time_type(0), 0ul, target, fstree::digest::parse(hash));
+    if (version == g_version_1) {
+      read_entry_v1(is, inode, path, hash, status, target);
+    }
+    else {
+      read_entry_v2(is, inode, path, hash, status, target, size, files, data, has_data);
+    }
+
+    if (version == g_version_shards) {
+      shards.push_back(hash);
+      continue;
+    }
+
+    auto child = inode.arena()->make(prefix + path, status, inode::time_type(0), size, target, hash);
+    child->set_file_count(files);
+    if (has_data) {
+      child->set_inline_data(data);
+    }
     inode.add_child(child);
   }
+}
 
+bool is_sharded_tree(std::string_view data) {
+  uint16_t magic, version;
+  if (data.size() < sizeof(magic) + sizeof(version)) {
+    return false;
+  }
+  std::memcpy(&magic, data.data(), sizeof(magic));
+  std::memcpy(&version, data.data() + sizeof(magic), sizeof(version));
+  return magic == g_magic && version == g_version_shards;
+}
+
+std::istream& operator>>(std::istream& is, inode& inode) {
+  std::vector<fstree::digest> shards;
+  read_tree(is, inode, shards);
+  if (!shards.empty()) {
+    throw std::runtime_error("failed reading tree: " + inode.hash().string() + ": unexpected sharded tree");
+  }
   return is;
 }
 
@@ -5,44 +5,56 @@
 #include "status.hpp"
 
 #include <chrono>
+#include <cstdint>
 #include <filesystem>
+#include <functional>
+#include <istream>
+#include <ostream>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace fs = std::filesystem;
 
 namespace fstree {
 
-class inode : public intrusive_ptr_base<inode> {
+class inode_arena;
+
+// A file, directory or symlink in a tree.
+// Inodes are always allocated from an inode_arena, see inode_arena.hpp.
+//
+// The layout is kept compact: names, parent directories and symlink
+// targets are interned in the arena, children are an arena allocated
+// pointer array, and the full path is only built on demand. Inodes are
+// trivially destructible, so releasing an arena does not visit them.
+class inode {
  public:
   using time_type = std::chrono::time_point<std::chrono::nanoseconds>::rep;
   using ptr = intrusive_ptr<inode>;
+  using iterator = inode**;
+  using const_iterator = inode* const*;
 
-  // Constructor
-  inode();
+  // Reference counting, forwarded to the owning arena
+  void add_ref();
+  void release_ref();
 
-  // Constructor
-  inode(
-      const std::string& path,
-      file_status status,
-      time_type mtime,
-      size_t size,
-      const std::string& target,
-      const fstree::digest& hash = fstree::digest());
+  // Returns the arena that owns this inode
+  inode_arena* arena() const;
 
-  void add_child(inode::ptr& child);
+  // Adds a child inode. The child must belong to the same arena.
+  void add_child(const inode::ptr& child);
 
   // Iterator begin
-  std::vector<inode::ptr>::iterator begin();
+  iterator begin();
 
   // Iterator end
-  std::vector<inode::ptr>::iterator end();
+  iterator end();
 
   // Const iterator begin
-  std::vector<inode::ptr>::const_iterator begin() const;
+  const_iterator begin() const;
 
   // Const iterator end
-  std::vector<inode::ptr>::const_iterator end() const;
+  const_iterator end() const;
 
   // Returns true if this inode is a directory
   bool is_directory() const;
@@ -65,9 +77,19 @@ class inode : public intrusive_ptr_base<inode> {
   // Set the file status, which includes the type and permissions
   void set_status(file_status status);
 
-  // Return the size of the file
+  // Return the size of the file, or the total size of all files below a directory
   size_t size() const;
 
+  void set_size(size_t size);
+
+  // Returns the number of files below a directory
+  size_t file_count() const;
+
+  void set_file_count(size_t count);
+
+  // Sets the size and file count of a directory from its direct children
+  void update_totals();
+
   // Return the inode type
   std::filesystem::file_type type() const;
 
@@ -79,15 +101,38 @@ class inode : public intrusive_ptr_base<inode> {
 
   void set_last_write_time(time_type last_write_time);
 
+  // Returns the symlink target, or an empty string for other inodes
   const std::string& target() const;
 
   std::filesystem::path target_path() const;
 
-  const std::string& path() const;
+  // Returns true if the contents of a small file are stored in its tree entry
+  bool has_inline_data() const;
+
+  // Returns the inline contents of a file, or an empty string
+  const std::string& inline_data() const;
 
-  std::string name() const;
+  // Stores the contents of a file in the inode and its tree entry
+  void set_inline_data(std::string_view data);
 
-  const inode::ptr& parent() const;
+  // Drops the inline contents of a file, which then needs a file object
+  void clear_inline_data();
+
+  // Returns the path relative to the tree root, built on demand
+  std::string path() const;
+
+  // Appends the path relative to the tree root to a string
+  void append_path(std::string& out) const;
+
+  // Compares paths like path() < other.path() without building them.
+  // Returns a negative value, zero or a positive value.
+  int compare_path(const inode& other) const;
+  int compare_path(std::string_view path) const;
+
+  // Returns the file name, i.e. the last path component
+  const std::string& name() const;
+
+  inode::ptr parent() const;
 
   void set_parent(const inode::ptr& parent);
 
@@ -112,41 +157,73 @@ class inode : public intrusive_ptr_base<inode> {
   void unignore();
   bool is_unignored() const;
 
-  void clear();
-
  private:
-  // The name of the file
-  std::string _path;
+  friend class inode_arena;
 
-  // The hash of the file
-  fstree::digest _hash;
+  enum flags : uint8_t { flag_ignored = 1, flag_unignored = 2, flag_inline = 4 };
 
-  // The permissions of the file
-  file_status _status;
+  // Constructor
+  inode(inode_arena* arena, const std::string* dir, const std::string* name, const std::string* target, file_status status,
+        time_type mtime, size_t size, const fstree::digest& hash);
+
+  // The arena that owns the inode
+  inode_arena* _arena;
+
+  // The parent inode if this is a child inode
+  inode* _parent = nullptr;
+
+  // Children inodes if this is a directory, allocated from the arena.
+  // The capacity is implied by the number of children.
+  inode** _children = nullptr;
+
+  // The interned parent directory, including the trailing separator
+  const std::string* _dir;
+
+  // The interned file name
+  const std::string* _name;
+
+  // The interned symlink target, or the inline contents of a file
+  const std::string* _target;
 
   // The modification time of the file
   time_type _last_write_time;
 
   // The size of the file
-  size_t _size = 0;
+  uint64_t _size;
 
-  // Symlink target if this is a symlink
-  std::string _target;
+  // The number of children
+  uint32_t _child_count = 0;
 
-  // Children inodes if this is a directory
-  std::vector<inode::ptr> _children;
+  // The type and permissions of the file, see file_status
+  uint32_t _status;
 
-  // The parent inode if this is a child inode
-  inode::ptr _parent = nullptr;
+  // The hash of the file
+  fstree::digest _hash;
 
-  // If the inode was ignored
-  bool _ignored = false;
+  // Ignore and inline flags
+  uint8_t _flags = 0;
 
-  // If the inode was unignored (explicitly included)
-  bool _unignored = false;
+  // The number of files below a directory, fits in the tail padding
+  uint32_t _file_count = 0;
 };
 
+// Writes the tree object of a directory, without sharding
 std::ostream& operator<<(std::ostream& os, const inode& inode);
+
+// Reads a tree object into a directory inode. Throws on sharded trees.
 std::istream& operator>>(std::istream& is, inode& inode);
 
+// Writes the tree object of a directory. Large directories are split into
+// shard tree objects, which are passed to write_shard before the shard
+// index is written to os.
+void write_tree(
+    std::ostream& os, const inode& tree, const std::function<void(const fstree::digest&, std::string_view)>& write_shard);
+
+// Reads a tree object into a directory inode. The shards of a sharded tree
+// are appended to shards, and must be read into the same inode afterwards.
+void read_tree(std::istream& is, inode& inode, std::vector<fstree::digest>& shards);
+
+// Returns true if a serialized tree object is the shard index of a sharded tree
+bool is_sharded_tree(std::string_view data);
+
 }  // namespace fstree
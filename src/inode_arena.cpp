@@ -0,0 +1,124 @@
+#include "inode_arena.hpp"
+
+#include <algorithm>
+#include <new>
+#include <type_traits>
+
+namespace fstree {
+
+// Chunks grow geometrically so that small arenas, such as the ones
+// holding a single tree object, stay small.
+static const size_t g_min_chunk_capacity = 64;
+static const size_t g_max_chunk_capacity = 64 * 1024;
+
+// Child arrays are carved out of blocks of this size. Larger arrays get
+// a block of their own.
+static const size_t g_block_size = 64 * 1024;
+
+#ifdef _WIN32
+static const std::string_view g_separators = "/\\";
+#else
+static const std::string_view g_separators = "/";
+#endif
+
+inode_arena::inode_arena() = default;
+
+inode_arena::~inode_arena() {
+  for (auto& chunk : _chunks) {
+    if constexpr (!std::is_trivially_destructible_v<inode>) {
+      for (size_t i = 0; i < chunk.size; i++) {
+        chunk.data[i].~inode();
+      }
+    }
+    ::operator delete(chunk.data, std::align_val_t(alignof(inode)));
+  }
+
+  for (auto& block : _blocks) {
+    ::operator delete(block.data);
+  }
+}
+
+inode::ptr inode_arena::make() {
+  return make(std::string_view(), file_status(std::filesystem::file_type::directory, std::filesystem::perms::none), 0, 0,
+              std::string_view());
+}
+
+inode::ptr inode_arena::make(
+    std::string_view path,
+    file_status status,
+    inode::time_type mtime,
+    size_t size,
+    std::string_view target,
+    const fstree::digest& hash) {
+  // Split the path into the parent directory, including the separator, and the name
+  size_t pos = path.find_last_of(g_separators);
+  std::string_view dir = pos == std::string_view::npos ? std::string_view() : path.substr(0, pos + 1);
+  std::string_view name = pos == std::string_view::npos ? path : path.substr(pos + 1);
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  void* storage = allocate();
+  inode* node = new (storage) inode(this, intern(dir), intern(name), intern(target), status, mtime, size, hash);
+  _chunks.back().size++;
+  return inode::ptr(node);
+}
+
+size_t inode_arena::size() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  size_t size = 0;
+  for (const auto& chunk : _chunks) {
+    size += chunk.size;
+  }
+  return size;
+}
+
+void* inode_arena::allocate() {
+  if (_chunks.empty() || _chunks.back().size == _chunks.back().capacity) {
+    size_t capacity = _chunks.empty() ? g_min_chunk_capacity : std::min(_chunks.back().capacity * 2, g_max_chunk_capacity);
+    _chunks.reserve(_chunks.size() + 1);
+    void* data = ::operator new(capacity * sizeof(inode), std::align_val_t(alignof(inode)));
+    _chunks.push_back(chunk{static_cast<inode*>(data), 0, capacity});
+  }
+
+  return &_chunks.back().data[_chunks.back().size];
+}
+
+inode** inode_arena::allocate_children(size_t count) {
+  size_t bytes = count * sizeof(inode*);
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (bytes > g_block_size) {
+    // Oversized arrays are kept in their own block, in front of the current one
+    _blocks.reserve(_blocks.size() + 1);
+    void* data = ::operator new(bytes);
+    _blocks.insert(_blocks.empty() ? _blocks.end() : _blocks.end() - 1, block{data, bytes});
+    return static_cast<inode**>(data);
+  }
+
+  if (_blocks.empty() || _block_used + bytes > _blocks.back().size) {
+    _blocks.reserve(_blocks.size() + 1);
+    _blocks.push_back(block{::operator new(g_block_size), g_block_size});
+    _block_used = 0;
+  }
+
+  void* data = static_cast<char*>(_blocks.back().data) + _block_used;
+  _block_used += bytes;
+  return static_cast<inode**>(data);
+}
+
+const std::string* inode_arena::intern(std::string_view str) {
+  auto it = _string_table.find(str);
+  if (it != _string_table.end()) {
+    return it->second;
+  }
+
+  const std::string* interned = &_strings.emplace_back(str);
+  _string_table.emplace(*interned, interned);
+  return interned;
+}
+
+const std::string* inode_arena::intern_locked(std::string_view str) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return intern(str);
+}
+
+}  // namespace fstree
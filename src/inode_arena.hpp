@@ -0,0 +1,95 @@
+#pragma once
+
+#include "inode.hpp"
+#include "intrusive_ptr.hpp"
+
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace fstree {
+
+// An arena that owns a set of inodes.
+//
+// Inodes are constructed in place in large chunks instead of being heap
+// allocated one by one. The arena is reference counted, and every reference
+// to one of its inodes is a reference to the arena itself, so the inodes
+// stay valid for as long as any of them is referenced. Parent and child
+// links between inodes of the same arena are plain pointers, which means
+// that there are no reference cycles to break and that all inodes are
+// released in bulk when the last reference goes away.
+//
+// The arena also interns the names, directories, symlink targets and inline
+// file contents of its inodes, so that each distinct string is only stored
+// once.
+//
+// Allocation is thread-safe.
+class inode_arena : public intrusive_ptr_base<inode_arena> {
+ public:
+  using ptr = intrusive_ptr<inode_arena>;
+
+  inode_arena();
+  ~inode_arena();
+
+  inode_arena(const inode_arena&) = delete;
+  inode_arena& operator=(const inode_arena&) = delete;
+
+  // Constructs a new directory inode with an empty path, used as tree root
+  inode::ptr make();
+
+  // Constructs a new inode in the arena. The path is relative to the tree root.
+  inode::ptr make(
+      std::string_view path,
+      file_status status,
+      inode::time_type mtime,
+      size_t size,
+      std::string_view target,
+      const fstree::digest& hash = fstree::digest());
+
+  // Returns the number of inodes in the arena
+  size_t size() const;
+
+ private:
+  friend class inode;
+
+  struct chunk {
+    inode* data;
+    size_t size;
+    size_t capacity;
+  };
+
+  struct block {
+    void* data;
+    size_t size;
+  };
+
+  // Returns storage for an array of child pointers
+  inode** allocate_children(size_t count);
+
+  // Returns storage for one more inode, adding a new chunk if the
+  // current one is full. Must be called with the mutex held.
+  void* allocate();
+
+  // Returns the interned copy of a string. Must be called with the mutex held.
+  const std::string* intern(std::string_view str);
+
+  // Returns the interned copy of a string, taking the mutex
+  const std::string* intern_locked(std::string_view str);
+
+  mutable std::mutex _mutex;
+  std::vector<chunk> _chunks;
+
+  // Raw memory for child arrays, handed out front to back
+  std::vector<block> _blocks;
+  size_t _block_used = 0;
+
+  // Interned strings. A deque never moves its elements.
+  std::deque<std::string> _strings;
+  std::unordered_map<std::string_view, const std::string*> _string_table;
+};
+
+}  // namespace fstree
@@ -26,6 +26,11 @@ class lock_file {
 
   // Lock the file. If the file is already locked, this function will block until the file is unlocked.
   context lock();
+
+  // Lock the file unless it is already locked. Returns false if it is.
+  // On success, the caller releases the lock with a context or unlock().
+  bool try_lock();
+
   void unlock();
 
  private:
@@ -3,6 +3,8 @@
 
 #include "lock_file.hpp"
 
+#include <cerrno>
+
 #include <fcntl.h>
 #include <sys/file.h>
 #include <unistd.h>
@@ -44,6 +46,21 @@ lock_file::context lock_file::lock() {
   return context(*this);
 }
 
+bool lock_file::try_lock() {
+  if (_fd == -1) {
+    throw std::runtime_error("lock file is invalid");
+  }
+
+  if (flock(_fd, LOCK_EX | LOCK_NB) == -1) {
+    if (errno == EWOULDBLOCK) {
+      return false;
+    }
+    throw std::runtime_error("failed to lock file: " + _path.string());
+  }
+
+  return true;
+}
+
 void lock_file::unlock() {
   if (_fd == -1) {
     throw std::runtime_error("lock file is invalid");
@@ -44,6 +44,26 @@ lock_file::context lock_file::lock() {
   return context(*this);
 }
 
+bool lock_file::try_lock() {
+  if (_handle == INVALID_HANDLE_VALUE) {
+    throw std::runtime_error("lock file is invalid");
+  }
+
+  if (!LockFile(_handle, 0, 0, 0, 0)) {
+    if (GetLastError() == ERROR_LOCK_VIOLATION) {
+      return false;
+    }
+    throw std::runtime_error("failed to lock file: " + _path.string());
+  }
+
+  if (!_mutex.try_lock()) {
+    UnlockFile(_handle, 0, 0, 0, 0);
+    return false;
+  }
+
+  return true;
+}
+
 void lock_file::unlock() {
   _mutex.unlock();
 
@@ -23,16 +23,32 @@
 #endif
 
 int usage() {
+  std::cerr << "fstree checkout [--cache <dir>] [--copy-method auto|clone|copy-range|copy] <tree> [<directory>]"
+            << std::endl;
+  std::cerr << "fstree du [--cache <dir>] <tree>" << std::endl;
+  std::cerr << "fstree evict [--cache <dir>] [--cache-size <size>] [--cache-retention <seconds>]" << std::endl;
+  std::cerr << "fstree fsck [--cache <dir>] [--fsck-size <size>] [--fsck-rate <size>] [--threads <int>]" << std::endl;
+  std::cerr << "fstree gc [--cache <dir>] [--cache-retention <seconds>] [<tree>...]" << std::endl;
   std::cerr << "fstree ls-index [<directory>]" << std::endl;
   std::cerr << "fstree ls-tree [--cache <dir>] <tree>" << std::endl;
-  std::cerr << "fstree pull [--cache <dir>] [--remote <url>] [--threads <int>] <tree>" << std::endl;
-  std::cerr << "fstree pull-checkout [--cache <dir>] [--remote <url>] [--threads <int>] <tree> [<directory>]"
+  std::cerr << "fstree pin [--cache <dir>] [--pin-expiry <seconds>] <tree>" << std::endl;
+  std::cerr << "fstree pull [--cache <dir>] [--cache-secondary <dir>] [--cache-packs] [--cache-compress] [--manifest] "
+               "[--remote <url>] [--threads <int>] <tree>"
+            << std::endl;
+  std::cerr << "fstree pull-checkout [--cache <dir>] [--cache-secondary <dir>] [--cache-packs] [--cache-compress] "
+               "[--manifest] [--copy-method auto|clone|copy-range|copy] [--remote <url>] [--threads <int>] <tree> "
+               "[<directory>]"
+            << std::endl;
+  std::cerr << "fstree push [--cache <dir>] [--manifest] [--remote <url>] [--threads <int>] [<directory>]" << std::endl;
+  std::cerr << "fstree unpin [--cache <dir>] <tree>" << std::endl;
+  std::cerr << "fstree write-tree [--cache <dir>] [--cache-packs] [--cache-compress] [--manifest] "
+               "[--inline-size <size>] [--ingest-method auto|clone|copy-range|copy] [--ignore <conf>] "
+               "[--threads <int>] [<directory>]"
+            << std::endl;
+  std::cerr << "fstree write-tree-push [--cache <dir>] [--cache-packs] [--cache-compress] [--manifest] "
+               "[--inline-size <size>] [--ingest-method auto|clone|copy-range|copy] [--ignore <conf>] "
+               "[--remote <url>] [--threads <int>] [<directory>]"
             << std::endl;
-  std::cerr << "fstree push [--cache <dir>] [--remote <url>] [--threads <int>] [<directory>]" << std::endl;
-  std::cerr << "fstree write-tree [--cache <dir>] [--ignore <conf>] [--threads <int>] [<directory>]" << std::endl;
-  std::cerr
-      << "fstree write-tree-push [--cache <dir>] [--ignore <conf>] [--remote <url>] [--threads <int>] [<directory>]"
-      << std::endl;
   return EXIT_FAILURE;
 }
 
@@ -97,6 +113,15 @@ bool spawn_evict_process(
   return true;
 }
 
+// Parses the name of a file copy method
+fstree::copy_method parse_copy_method(const std::string& name) {
+  if (name == "auto") return fstree::copy_method::automatic;
+  if (name == "clone") return fstree::copy_method::clone;
+  if (name == "copy-range") return fstree::copy_method::copy_range;
+  if (name == "copy") return fstree::copy_method::buffered;
+  throw std::invalid_argument("invalid copy method: " + name);
+}
+
 int cmd_fstree(const fstree::argparser& args) {
   fstree::url remoteurl(args.get_option("--remote"));
   if (remoteurl.host().empty()) throw std::invalid_argument("invalid remote URL: " + args.get_option("--remote"));
@@ -135,9 +160,27 @@ int cmd_fstree(const fstree::argparser& args) {
     throw std::invalid_argument("invalid cache retention period: " + args.get_option("--cache-retention"));
   }
 
+  size_t inlinesize = 0;
+  try {
+    inlinesize = fstree::parse_size(args.get_option("--inline-size"));
+  }
+  catch (const std::exception& e) {
+    throw std::invalid_argument("invalid inline size: " + args.get_option("--inline-size"));
+  }
+
+  fstree::copy_method copymethod = parse_copy_method(args.get_option("--copy-method"));
+  fstree::copy_method ingestmethod = parse_copy_method(args.get_option("--ingest-method"));
+
   if (args.size() < 1) throw std::invalid_argument("missing command argument");
 
   fstree::cache cache(cachedir, cachesize, retention_period);
+  cache.set_pack_objects(args.has_option("--cache-packs"));
+  cache.set_compression(args.has_option("--cache-compress"));
+  cache.set_secondary(args.get_option("--cache-secondary"));
+  cache.set_manifests(args.has_option("--manifest"));
+  cache.set_inline_size(inlinesize);
+  cache.set_copy_method(copymethod);
+  cache.set_ingest_method(ingestmethod);
 
   if (args[0] == "checkout") {
     if (args.size() < 2) throw std::invalid_argument("missing tree argument");
@@ -171,10 +214,86 @@ int cmd_fstree(const fstree::argparser& args) {
     std::cout << rindex.root()->hash() << std::endl;
     return EXIT_SUCCESS;
   }
+  else if (args[0] == "du") {
+    // Reports sizes from tree objects alone, without pulling file objects
+    if (args.size() < 2) throw std::invalid_argument("missing tree argument");
+    fstree::digest tree = fstree::digest::parse(args[1]);
+    if (tree.empty()) throw std::invalid_argument("missing tree argument");
+
+    fstree::inode_arena::ptr arena = fstree::make_intrusive<fstree::inode_arena>();
+    fstree::inode::ptr root = arena->make();
+    cache.read_tree(tree, root);
+
+    for (const auto& inode : *root) {
+      if (inode->is_directory())
+        std::cout << inode->size() << "\t" << inode->file_count() << "\t" << inode->path() << std::endl;
+      else if (inode->is_file())
+        std::cout << inode->size() << "\t" << 1 << "\t" << inode->path() << std::endl;
+    }
+    std::cout << root->size() << "\t" << root->file_count() << "\t." << std::endl;
+
+    return EXIT_SUCCESS;
+  }
   else if (args[0] == "evict") {
     cache.evict();
     return EXIT_SUCCESS;
   }
+  else if (args[0] == "fsck") {
+    uint64_t max_bytes = 0, rate = 0;
+    try {
+      max_bytes = fstree::parse_size(args.get_option("--fsck-size"));
+    }
+    catch (const std::exception& e) {
+      throw std::invalid_argument("invalid fsck size: " + args.get_option("--fsck-size"));
+    }
+    try {
+      rate = fstree::parse_size(args.get_option("--fsck-rate"));
+    }
+    catch (const std::exception& e) {
+      throw std::invalid_argument("invalid fsck rate: " + args.get_option("--fsck-rate"));
+    }
+
+    std::vector<std::string> corrupt = cache.fsck(max_bytes, rate);
+    for (const auto& path : corrupt) {
+      std::cout << path << std::endl;
+    }
+    return corrupt.empty() ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  else if (args[0] == "gc") {
+    std::vector<fstree::digest> roots;
+    for (size_t i = 1; i < args.size(); i++) {
+      fstree::digest tree = fstree::digest::parse(args[i]);
+      if (tree.empty()) throw std::invalid_argument("invalid tree argument: " + args[i]);
+      roots.push_back(tree);
+    }
+
+    cache.gc(roots);
+    return EXIT_SUCCESS;
+  }
+  else if (args[0] == "pin") {
+    if (args.size() < 2) throw std::invalid_argument("missing tree argument");
+    fstree::digest tree = fstree::digest::parse(args[1]);
+    if (tree.empty()) throw std::invalid_argument("missing tree argument");
+
+    std::chrono::seconds expiry;
+    try {
+      expiry = std::chrono::seconds(std::stoll(args.get_option("--pin-expiry")));
+    }
+    catch (const std::exception& e) {
+      throw std::invalid_argument("invalid pin expiry: " + args.get_option("--pin-expiry"));
+    }
+
+    cache.pin(tree, expiry);
+    return EXIT_SUCCESS;
+  }
+  else if (args[0] == "unpin") {
+    if (args.size() < 2) throw std::invalid_argument("missing tree argument");
+    fstree::digest tree = fstree::digest::parse(args[1]);
+    if (tree.empty()) throw std::invalid_argument("missing tree argument");
+
+    cache.unpin(tree);
+    return EXIT_SUCCESS;
+  }
   else if (args[0] == "ls-index") {
     if (args.size() < 1) return usage();
     std::filesystem::path workspace = args.size() > 1 ? args.get_value_path(1) : current_path();
@@ -199,7 +318,8 @@ int cmd_fstree(const fstree::argparser& args) {
     fstree::digest tree = fstree::digest::parse(args[1]);
     if (tree.empty()) throw std::invalid_argument("missing tree argument");
 
-    fstree::inode::ptr root = fstree::make_intrusive<fstree::inode>();
+    fstree::inode_arena::ptr arena = fstree::make_intrusive<fstree::inode_arena>();
+    fstree::inode::ptr root = arena->make();
     cache.read_tree(tree, root);
 
     for (const auto& inode : *root) {
@@ -211,7 +331,6 @@ int cmd_fstree(const fstree::argparser& args) {
                   << std::endl;
     }
 
-    root->clear();
     return EXIT_SUCCESS;
   }
   else if (args[0] == "pull") {
@@ -227,8 +346,8 @@ int cmd_fstree(const fstree::argparser& args) {
 
     cache.pull(index, *remote, tree);
 
-    // Evict cache in background
-    if (!spawn_evict_process(args.command(), cachedir, cachesize, retention_period)) {
+    // Evict cache in background when it's over its high watermark
+    if (cache.needs_evict() && !spawn_evict_process(args.command(), cachedir, cachesize, retention_period)) {
       cache.evict();
     }
 
@@ -265,7 +384,7 @@ int cmd_fstree(const fstree::argparser& args) {
     rindex.checkout(cache, workspace);
     rindex.save(indexfile);
 
-    if (!spawn_evict_process(args.command(), cachedir, cachesize, retention_period)) {
+    if (cache.needs_evict() && !spawn_evict_process(args.command(), cachedir, cachesize, retention_period)) {
       cache.evict();
     }
 
@@ -313,7 +432,7 @@ int cmd_fstree(const fstree::argparser& args) {
     cache.add(index);
     index.save(indexfile);
 
-    if (!spawn_evict_process(args.command(), cachedir, cachesize, retention_period)) {
+    if (cache.needs_evict() && !spawn_evict_process(args.command(), cachedir, cachesize, retention_period)) {
       cache.evict();
     }
 
@@ -347,7 +466,7 @@ int cmd_fstree(const fstree::argparser& args) {
     cache.push(index, *remote);
     index.save(indexfile);
 
-    if (!spawn_evict_process(args.command(), cachedir, cachesize, retention_period)) {
+    if (cache.needs_evict() && !spawn_evict_process(args.command(), cachedir, cachesize, retention_period)) {
       cache.evict();
     }
 
@@ -373,6 +492,16 @@ int main(int argc, char* argv[]) {
     args.add_option_alias("--cache-size", "-cs");
     args.add_option("--cache-retention", std::to_string(fstree::cache::default_retention.count()));
     args.add_option_alias("--cache-retention", "-cr");
+    args.add_bool_option("--cache-packs");
+    args.add_bool_option("--cache-compress");
+    args.add_option("--cache-secondary", "");
+    args.add_bool_option("--manifest");
+    args.add_option("--inline-size", "0");
+    args.add_option("--copy-method", "auto");
+    args.add_option("--ingest-method", "auto");
+    args.add_option("--pin-expiry", std::to_string(7 * 24 * 3600));
+    args.add_option("--fsck-size", "0");
+    args.add_option("--fsck-rate", "0");
     args.add_bool_option("--json");
     args.add_option_alias("--json", "-J");
     args.add_option("--ignore", ".fstreeignore");
@@ -0,0 +1,162 @@
+#include "manifest.hpp"
+
+#include "hash.hpp"
+#include "varint.hpp"
+
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace fstree {
+
+static const uint16_t g_magic = 0x3ef1;
+static const uint16_t g_version = 1;
+
+// Bounds the recursion and tree object sizes when reading a manifest
+static const size_t g_max_depth = 1024;
+static const uint64_t g_max_tree_size = 1ULL << 30;
+
+// Manifests start with a magic and a version number, followed by the tree
+// objects of all directories in depth-first order, starting with the root.
+// Each tree object is stored as a varint length and its exact bytes. The
+// shards of a sharded tree directly follow its shard index, and the
+// subdirectories of a tree follow in the order of its entries.
+
+fstree::digest manifest_key(const fstree::digest& tree) { return hashsum_hex("manifest:" + tree.string()); }
+
+static void write_object(std::ostream& os, std::string_view data) {
+  write_varint(os, data.size());
+  os.write(data.data(), data.size());
+}
+
+static void write_tree(std::ostream& os, const inode& tree) {
+  std::vector<std::string> shards;
+  std::ostringstream object(std::ios::binary);
+  fstree::write_tree(object, tree, [&](const fstree::digest&, std::string_view data) { shards.emplace_back(data); });
+
+  write_object(os, object.view());
+  for (const auto& shard : shards) {
+    write_object(os, shard);
+  }
+
+  for (const inode* child : tree) {
+    if (child->is_directory() && !child->is_ignored()) {
+      write_tree(os, *child);
+    }
+  }
+}
+
+void write_manifest(std::ostream& os, const inode& root) {
+  os.write(reinterpret_cast<const char*>(&g_magic), sizeof(g_magic));
+  os.write(reinterpret_cast<const char*>(&g_version), sizeof(g_version));
+  write_tree(os, root);
+
+  if (!os) {
+    throw std::runtime_error("failed writing manifest: " + root.hash().string() + ": " + std::strerror(errno));
+  }
+}
+
+// Reads the next tree object and checks it against the expected hash
+static void read_object(std::istream& is, const fstree::digest& root, const fstree::digest& hash, std::string& data) {
+  uint64_t length;
+  if (!read_varint(is, length)) {
+    throw std::runtime_error("failed reading manifest: " + root.string() + ": truncated");
+  }
+  if (length > g_max_tree_size) {
+    throw std::runtime_error("failed reading manifest: " + root.string() + ": tree object too large");
+  }
+
+  data.resize(length);
+  is.read(data.data(), length);
+  if (!is) {
+    throw std::runtime_error("failed reading manifest: " + root.string() + ": truncated");
+  }
+
+  // The tree object must match the hash its parent refers to
+  if (hashsum_hex(data) != hash) {
+    throw std::runtime_error("failed reading manifest: " + root.string() + ": mismatching tree " + hash.string());
+  }
+}
+
+static void read_tree(
+    std::istream& is,
+    const fstree::digest& root,
+    inode::ptr& tree,
+    fstree::index& index,
+    const std::function<void(const fstree::digest&, std::string_view)>& visit_tree,
+    size_t depth) {
+  if (depth > g_max_depth) {
+    throw std::runtime_error("failed reading manifest: " + root.string() + ": tree too deep");
+  }
+
+  std::string data;
+  read_object(is, root, tree->hash(), data);
+  if (visit_tree) {
+    visit_tree(tree->hash(), data);
+  }
+
+  std::vector<fstree::digest> shards;
+  {
+    std::istringstream stream(std::move(data), std::ios::binary);
+    fstree::read_tree(stream, *tree, shards);
+  }
+
+  // The shards of a sharded tree follow its shard index
+  for (const auto& shard : shards) {
+    read_object(is, root, shard, data);
+    if (visit_tree) {
+      visit_tree(shard, data);
+    }
+
+    std::vector<fstree::digest> nested;
+    std::istringstream stream(std::move(data), std::ios::binary);
+    fstree::read_tree(stream, *tree, nested);
+    if (!nested.empty()) {
+      throw std::runtime_error("failed reading manifest: " + root.string() + ": nested shards");
+    }
+  }
+  if (!shards.empty()) {
+    tree->sort();
+  }
+  tree->update_totals();
+
+  for (inode* child : *tree) {
+    index.push_back(inode::ptr(child));
+  }
+
+  for (inode* child : *tree) {
+    if (child->is_directory()) {
+      inode::ptr subtree(child);
+      read_tree(is, root, subtree, index, visit_tree, depth + 1);
+    }
+  }
+}
+
+void read_manifest(
+    std::istream& is,
+    const fstree::digest& tree,
+    fstree::index& index,
+    const std::function<void(const fstree::digest&, std::string_view)>& visit_tree) {
+  uint16_t magic;
+  is.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+  if (!is || magic != g_magic) {
+    throw std::runtime_error("failed reading manifest: " + tree.string() + ": invalid magic");
+  }
+
+  uint16_t version;
+  is.read(reinterpret_cast<char*>(&version), sizeof(version));
+  if (!is || version != g_version) {
+    throw std::runtime_error("failed reading manifest: " + tree.string() + ": unsupported version");
+  }
+
+  index.root()->set_hash(tree);
+  index.root()->set_status(fstree::file_status(std::filesystem::file_type::directory, std::filesystem::perms::none));
+  read_tree(is, tree, index.root(), index, visit_tree, 0);
+
+  if (is.peek() != EOF) {
+    throw std::runtime_error("failed reading manifest: " + tree.string() + ": trailing data");
+  }
+}
+
+}  // namespace fstree
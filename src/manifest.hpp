@@ -0,0 +1,38 @@
+#pragma once
+
+#include "digest.hpp"
+#include "index.hpp"
+#include "inode.hpp"
+
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <string_view>
+
+namespace fstree {
+
+// A manifest is a flattened copy of every tree object below a root tree,
+// so that a whole index can be loaded with one read or one download
+// instead of one per directory.
+//
+// Manifests are optional and not part of the Merkle tree. Every tree
+// object in a manifest is checked against the hash recorded by its parent,
+// starting from the requested root, so a stale or corrupt manifest is
+// rejected rather than trusted.
+
+// Returns the key under which the manifest of a root tree is stored
+fstree::digest manifest_key(const fstree::digest& tree);
+
+// Writes the manifest of the tree below a directory inode. The hashes of
+// all directories must be up to date.
+void write_manifest(std::ostream& os, const inode& root);
+
+// Reads a manifest of the given tree into an index, whose root becomes the
+// tree root. The callback is called with each verified tree object.
+void read_manifest(
+    std::istream& is,
+    const fstree::digest& tree,
+    fstree::index& index,
+    const std::function<void(const fstree::digest&, std::string_view)>& visit_tree = nullptr);
+
+}  // namespace fstree
@@ -0,0 +1,664 @@
+#include "pack_store.hpp"
+
+#include "event.hpp"
+#include "hash.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace fstree {
+
+static const uint16_t g_pack_magic = 0x3eef;
+static const uint16_t g_index_magic = 0x3ef0;
+static const uint16_t g_version = 1;
+
+// Pack file header: magic and version
+static const size_t g_pack_header_size = 4;
+
+// Index file header: magic, version and entry count, followed by the fanout
+static const size_t g_index_header_size = 8;
+static const size_t g_fanout_size = 256 * sizeof(uint32_t);
+
+// Index entry: digest bytes, u64 offset, u32 size, algorithm, kind, two reserved bytes
+static const size_t g_entry_size = fstree::digest::max_length + 16;
+static const size_t g_entry_offset = fstree::digest::max_length;
+static const size_t g_entry_length = fstree::digest::max_length + 8;
+static const size_t g_entry_alg = fstree::digest::max_length + 12;
+static const size_t g_entry_kind = fstree::digest::max_length + 13;
+
+// Pending objects are written to a new pack once they exceed this size
+static const size_t g_max_pending_size = 32 * 1024 * 1024;
+
+// Packs smaller than this are merged when there are more than g_max_packs of them
+static const size_t g_consolidate_size = 64 * 1024 * 1024;
+static const size_t g_max_packs = 8;
+
+template <typename T>
+static T load_value(const char* data) {
+  T value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+template <typename T>
+static void store_value(std::string& out, T value) {
+  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Compares an index entry with a key
+static int compare_entry(const char* entry, const std::array<uint8_t, fstree::digest::max_length + 2>& k) {
+  int cmp = std::memcmp(entry, k.data(), fstree::digest::max_length);
+  if (cmp != 0) return cmp;
+  cmp = int(uint8_t(entry[g_entry_alg])) - int(k[fstree::digest::max_length]);
+  if (cmp != 0) return cmp;
+  return int(uint8_t(entry[g_entry_kind])) - int(k[fstree::digest::max_length + 1]);
+}
+
+pack_store::pack_store(const std::filesystem::path& dir, const std::filesystem::path& tmpdir, bool read_only)
+    : _dir(dir), _tmpdir(tmpdir), _read_only(read_only) {
+  std::unique_lock<std::shared_mutex> lock(_packs_mutex);
+  load();
+}
+
+pack_store::~pack_store() {
+  try {
+    flush();
+  }
+  catch (const std::exception& e) {
+    event("warning", _dir.string(), std::string("failed to write pack: ") + e.what());
+  }
+}
+
+pack_store::key pack_store::make_key(const fstree::digest& hash, kind kind) {
+  key k{};
+  std::memcpy(k.data(), hash.data(), hash.size());
+  k[fstree::digest::max_length] = static_cast<uint8_t>(hash.alg());
+  k[fstree::digest::max_length + 1] = static_cast<uint8_t>(kind);
+  return k;
+}
+
+const char* pack_store::pack::find(const key& k) const {
+  const char* fanout = index.data() + g_index_header_size;
+  size_t first = k[0] == 0 ? 0 : load_value<uint32_t>(fanout + (k[0] - 1) * sizeof(uint32_t));
+  size_t last = load_value<uint32_t>(fanout + k[0] * sizeof(uint32_t));
+  const char* entries = fanout + g_fanout_size;
+
+  while (first < last) {
+    size_t middle = first + (last - first) / 2;
+    const char* entry = entries + middle * g_entry_size;
+    int cmp = compare_entry(entry, k);
+    if (cmp == 0) return entry;
+    if (cmp < 0) {
+      first = middle + 1;
+    }
+    else {
+      last = middle;
+    }
+  }
+
+  return nullptr;
+}
+
+const char* pack_store::find_loaded(const key& k, std::shared_ptr<pack>& found) const {
+  for (const auto& pack : _packs) {
+    const char* entry = pack->find(k);
+    if (entry) {
+      found = pack;
+      return entry;
+    }
+  }
+  return nullptr;
+}
+
+const char* pack_store::find(const key& k, std::shared_ptr<pack>& found) {
+  std::error_code ec;
+  {
+    std::shared_lock<std::shared_mutex> lock(_packs_mutex);
+    const char* entry = find_loaded(k, found);
+    if (entry || std::filesystem::last_write_time(_dir, ec) == _dir_time) {
+      return entry;
+    }
+  }
+
+  // Other processes have added or removed packs since they were loaded
+  std::unique_lock<std::shared_mutex> lock(_packs_mutex);
+  if (std::filesystem::last_write_time(_dir, ec) != _dir_time) {
+    load();
+  }
+  return find_loaded(k, found);
+}
+
+bool pack_store::contains(const fstree::digest& hash, kind kind) {
+  key k = make_key(hash, kind);
+
+  std::shared_ptr<pack> pack;
+  if (find(k, pack)) {
+    touch(*pack);
+    return true;
+  }
+
+  std::lock_guard<std::mutex> lock(_pending_mutex);
+  return _pending_index.count(k) > 0;
+}
+
+bool pack_store::read(const fstree::digest& hash, kind kind, std::string& data) {
+  key k = make_key(hash, kind);
+
+  std::shared_ptr<pack> pack;
+  const char* entry = find(k, pack);
+  if (entry) {
+    uint64_t offset = load_value<uint64_t>(entry + g_entry_offset);
+    uint32_t length = load_value<uint32_t>(entry + g_entry_length);
+    if (offset > pack->data.size() || length > pack->data.size() - offset) {
+      throw std::runtime_error("failed reading pack: " + (_dir / pack->name).string() + ": invalid object offset");
+    }
+
+    data.assign(pack->data.data() + offset, length);
+    touch(*pack);
+    return true;
+  }
+
+  std::lock_guard<std::mutex> lock(_pending_mutex);
+  auto it = _pending_index.find(k);
+  if (it == _pending_index.end()) {
+    return false;
+  }
+
+  data.assign(_pending, it->second.first, it->second.second);
+  return true;
+}
+
+void pack_store::write(const fstree::digest& hash, kind kind, std::string_view data) {
+  if (data.size() > UINT32_MAX) {
+    throw std::invalid_argument("object too large for pack: " + hash.string());
+  }
+
+  check_writable();
+  key k = make_key(hash, kind);
+
+  std::lock_guard<std::mutex> lock(_pending_mutex);
+  if (_pending_index.count(k) > 0) {
+    return;
+  }
+
+  _pending_index.emplace(k, std::make_pair(_pending.size(), data.size()));
+  _pending.append(data);
+
+  if (_pending.size() >= g_max_pending_size) {
+    flush_locked();
+  }
+}
+
+void pack_store::flush() {
+  std::lock_guard<std::mutex> lock(_pending_mutex);
+  flush_locked();
+}
+
+void pack_store::flush_locked() {
+  if (_pending_index.empty()) {
+    return;
+  }
+
+  std::filesystem::path tmp = _tmpdir;
+  FILE* fp = fstree::mkstemp(tmp);
+  if (!fp) {
+    throw std::runtime_error("failed to create temporary file: " + tmp.string() + ": " + std::strerror(errno));
+  }
+
+  std::string header;
+  store_value(header, g_pack_magic);
+  store_value(header, g_version);
+
+  if (fwrite(header.data(), 1, header.size(), fp) != header.size() ||
+      fwrite(_pending.data(), 1, _pending.size(), fp) != _pending.size()) {
+    int err = errno;
+    fclose(fp);
+    std::error_code ec;
+    std::filesystem::remove(tmp, ec);
+    throw std::runtime_error("failed to write to temporary file: " + tmp.string() + ": " + std::strerror(err));
+  }
+  fclose(fp);
+
+  std::vector<entry> entries;
+  entries.reserve(_pending_index.size());
+  for (const auto& [k, location] : _pending_index) {
+    entries.push_back(entry{k, g_pack_header_size + location.first, static_cast<uint32_t>(location.second)});
+  }
+
+  {
+    std::unique_lock<std::shared_mutex> lock(_packs_mutex);
+    install(tmp, entries);
+  }
+
+  _pending.clear();
+  _pending_index.clear();
+}
+
+std::shared_ptr<pack_store::pack> pack_store::install(const std::filesystem::path& tmp, std::vector<entry>& entries) {
+  std::error_code ec;
+
+  std::sort(entries.begin(), entries.end(), [](const entry& a, const entry& b) { return a.k < b.k; });
+
+  // Build the index with the fanout table
+  std::string index;
+  index.reserve(g_index_header_size + g_fanout_size + entries.size() * g_entry_size);
+  store_value(index, g_index_magic);
+  store_value(index, g_version);
+  store_value(index, static_cast<uint32_t>(entries.size()));
+
+  uint32_t count = 0;
+  auto it = entries.begin();
+  for (size_t byte = 0; byte < 256; byte++) {
+    while (it != entries.end() && it->k[0] == byte) {
+      ++it;
+      ++count;
+    }
+    store_value(index, count);
+  }
+
+  for (const auto& entry : entries) {
+    index.append(reinterpret_cast<const char*>(entry.k.data()), fstree::digest::max_length);
+    store_value(index, entry.offset);
+    store_value(index, entry.size);
+    index.push_back(static_cast<char>(entry.k[fstree::digest::max_length]));
+    index.push_back(static_cast<char>(entry.k[fstree::digest::max_length + 1]));
+    index.append(2, '\0');
+  }
+
+  // Packs are named after the hash of their content
+  std::string name = "pack-" + hashsum_hex_file(tmp).hexdigest();
+
+  std::filesystem::path tmp_index = _tmpdir;
+  FILE* fp = fstree::mkstemp(tmp_index);
+  if (!fp) {
+    std::filesystem::remove(tmp, ec);
+    throw std::runtime_error("failed to create temporary file: " + tmp_index.string() + ": " + std::strerror(errno));
+  }
+  if (fwrite(index.data(), 1, index.size(), fp) != index.size()) {
+    int err = errno;
+    fclose(fp);
+    std::filesystem::remove(tmp, ec);
+    std::filesystem::remove(tmp_index, ec);
+    throw std::runtime_error("failed to write to temporary file: " + tmp_index.string() + ": " + std::strerror(err));
+  }
+  fclose(fp);
+
+  std::filesystem::create_directories(_dir, ec);
+  if (ec) {
+    std::filesystem::remove(tmp, ec);
+    std::filesystem::remove(tmp_index, ec);
+    throw std::runtime_error("failed to create pack directory: " + _dir.string() + ": " + ec.message());
+  }
+
+  // The pack is moved into place before its index, which makes it visible
+  std::filesystem::path pack_path = _dir / (name + ".pack");
+  std::filesystem::path index_path = _dir / (name + ".idx");
+  if (std::filesystem::exists(index_path, ec)) {
+    std::filesystem::remove(tmp, ec);
+    std::filesystem::remove(tmp_index, ec);
+  }
+  else {
+    std::filesystem::rename(tmp, pack_path, ec);
+    if (ec) {
+      std::filesystem::remove(tmp, ec);
+      std::filesystem::remove(tmp_index, ec);
+      throw std::runtime_error("failed to rename temporary file: " + tmp.string() + ": " + ec.message());
+    }
+
+    std::filesystem::rename(tmp_index, index_path, ec);
+    if (ec) {
+      std::filesystem::remove(tmp_index, ec);
+      throw std::runtime_error("failed to rename temporary file: " + tmp_index.string() + ": " + ec.message());
+    }
+  }
+
+  for (const auto& pack : _packs) {
+    if (pack->name == name) {
+      return pack;
+    }
+  }
+
+  auto pack = open(name);
+  _packs.push_back(pack);
+  return pack;
+}
+
+std::shared_ptr<pack_store::pack> pack_store::open(const std::string& name) const {
+  auto result = std::make_shared<pack>();
+  result->name = name;
+  result->index = mapped_file(_dir / (name + ".idx"));
+  result->data = mapped_file(_dir / (name + ".pack"));
+
+  const mapped_file& index = result->index;
+  if (index.size() < g_index_header_size + g_fanout_size || load_value<uint16_t>(index.data()) != g_index_magic) {
+    throw std::runtime_error("failed reading pack index: " + (_dir / name).string() + ": invalid magic");
+  }
+  if (load_value<uint16_t>(index.data() + 2) != g_version) {
+    throw std::runtime_error("failed reading pack index: " + (_dir / name).string() + ": unsupported version");
+  }
+
+  uint32_t count = load_value<uint32_t>(index.data() + 4);
+  uint32_t fanout_count = load_value<uint32_t>(index.data() + g_index_header_size + 255 * sizeof(uint32_t));
+  if (count != fanout_count || index.size() != g_index_header_size + g_fanout_size + size_t(count) * g_entry_size) {
+    throw std::runtime_error("failed reading pack index: " + (_dir / name).string() + ": invalid size");
+  }
+
+  // Lookups search between fanout bounds, which must stay within the entries
+  uint32_t previous = 0;
+  for (size_t byte = 0; byte < 256; byte++) {
+    uint32_t bound = load_value<uint32_t>(index.data() + g_index_header_size + byte * sizeof(uint32_t));
+    if (bound < previous || bound > count) {
+      throw std::runtime_error("failed reading pack index: " + (_dir / name).string() + ": invalid fanout");
+    }
+    previous = bound;
+  }
+
+  const mapped_file& data = result->data;
+  if (data.size() < g_pack_header_size || load_value<uint16_t>(data.data()) != g_pack_magic) {
+    throw std::runtime_error("failed reading pack: " + (_dir / name).string() + ": invalid magic");
+  }
+
+  return result;
+}
+
+void pack_store::load() {
+  std::vector<std::shared_ptr<pack>> packs;
+
+  // Packs never change once installed, so open ones are kept
+  std::unordered_map<std::string, std::shared_ptr<pack>> loaded;
+  for (const auto& pack : _packs) {
+    loaded.emplace(pack->name, pack);
+  }
+
+  // The time is taken first, so that packs added while listing are picked
+  // up by the next lookup that misses
+  std::error_code ec;
+  _dir_time = std::filesystem::last_write_time(_dir, ec);
+
+  for (const auto& entry : std::filesystem::directory_iterator(_dir, ec)) {
+    if (entry.path().extension() != ".idx") {
+      continue;
+    }
+
+    std::string name = entry.path().stem().string();
+    auto it = loaded.find(name);
+    if (it != loaded.end()) {
+      packs.push_back(it->second);
+      continue;
+    }
+
+    try {
+      packs.push_back(open(name));
+    }
+    catch (const std::exception& e) {
+      // The pack may have been removed by a concurrent eviction
+      event("warning", entry.path().string(), e.what());
+    }
+  }
+
+  // Keep the order stable so that lookups visit packs consistently
+  std::sort(packs.begin(), packs.end(), [](const auto& a, const auto& b) { return a->name < b->name; });
+  _packs = std::move(packs);
+}
+
+void pack_store::remove(const pack& pack) {
+  std::error_code ec;
+
+  // The index goes first so that the pack disappears atomically for readers
+  std::filesystem::remove(_dir / (pack.name + ".idx"), ec);
+  if (ec) {
+    throw std::runtime_error("failed to remove pack: " + (_dir / pack.name).string() + ": " + ec.message());
+  }
+  std::filesystem::remove(_dir / (pack.name + ".pack"), ec);
+  if (ec) {
+    throw std::runtime_error("failed to remove pack: " + (_dir / pack.name).string() + ": " + ec.message());
+  }
+}
+
+bool pack_store::holds(const pack& pack, const std::function<bool(const fstree::digest&, kind)>& keep) const {
+  size_t count = load_value<uint32_t>(pack.index.data() + 4);
+  const char* entries = pack.index.data() + g_index_header_size + g_fanout_size;
+  for (size_t i = 0; i < count; i++) {
+    const char* e = entries + i * g_entry_size;
+    auto alg = static_cast<fstree::digest::algorithm>(e[g_entry_alg]);
+    if (fstree::digest::length(alg) == 0) {
+      continue;
+    }
+    if (keep(fstree::digest(alg, reinterpret_cast<const uint8_t*>(e)), static_cast<kind>(e[g_entry_kind]))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void pack_store::touch(pack& pack) {
+  if (!_read_only && !pack.accessed.exchange(true)) {
+    fstree::touch(_dir / (pack.name + ".pack"));
+  }
+}
+
+void pack_store::check_writable() const {
+  if (_read_only) {
+    throw std::runtime_error("pack store is read-only: " + _dir.string());
+  }
+}
+
+size_t pack_store::size() const {
+  std::shared_lock<std::shared_mutex> lock(_packs_mutex);
+  size_t size = 0;
+  for (const auto& pack : _packs) {
+    size += pack->data.size() + pack->index.size();
+  }
+  return size;
+}
+
+std::vector<std::string> pack_store::names() const {
+  std::shared_lock<std::shared_mutex> lock(_packs_mutex);
+  std::vector<std::string> result;
+  for (const auto& pack : _packs) {
+    result.push_back(pack->name);
+  }
+  return result;
+}
+
+bool pack_store::visit(
+    const std::string& name, const std::function<void(const fstree::digest&, kind, std::string_view)>& visit) {
+  std::shared_ptr<pack> found;
+  {
+    std::shared_lock<std::shared_mutex> lock(_packs_mutex);
+    for (const auto& pack : _packs) {
+      if (pack->name == name) {
+        found = pack;
+        break;
+      }
+    }
+  }
+  if (!found) {
+    // Packs that failed to load are opened again, so that their errors surface
+    std::error_code ec;
+    if (!std::filesystem::exists(_dir / (name + ".idx"), ec)) {
+      return false;
+    }
+    found = open(name);
+  }
+
+  size_t count = load_value<uint32_t>(found->index.data() + 4);
+  const char* fanout = found->index.data() + g_index_header_size;
+  const char* entries = fanout + g_fanout_size;
+  key previous{};
+  for (size_t i = 0; i < count; i++) {
+    const char* e = entries + i * g_entry_size;
+
+    // Lookups rely on sorted entries within the fanout bounds of their first byte
+    if (i > 0 && compare_entry(e, previous) <= 0) {
+      throw std::runtime_error("failed reading pack index: " + (_dir / name).string() + ": entries out of order");
+    }
+    uint8_t byte = uint8_t(e[0]);
+    size_t first = byte == 0 ? 0 : load_value<uint32_t>(fanout + (byte - 1) * sizeof(uint32_t));
+    size_t last = load_value<uint32_t>(fanout + byte * sizeof(uint32_t));
+    if (i < first || i >= last) {
+      throw std::runtime_error("failed reading pack index: " + (_dir / name).string() + ": invalid fanout");
+    }
+    std::memcpy(previous.data(), e, fstree::digest::max_length);
+    previous[fstree::digest::max_length] = uint8_t(e[g_entry_alg]);
+    previous[fstree::digest::max_length + 1] = uint8_t(e[g_entry_kind]);
+
+    uint64_t offset = load_value<uint64_t>(e + g_entry_offset);
+    uint32_t length = load_value<uint32_t>(e + g_entry_length);
+    if (offset > found->data.size() || length > found->data.size() - offset) {
+      throw std::runtime_error("failed reading pack: " + (_dir / name).string() + ": invalid object offset");
+    }
+
+    auto alg = static_cast<fstree::digest::algorithm>(e[g_entry_alg]);
+    if (fstree::digest::length(alg) == 0) {
+      throw std::runtime_error("failed reading pack: " + (_dir / name).string() + ": invalid digest algorithm");
+    }
+
+    fstree::digest hash(alg, reinterpret_cast<const uint8_t*>(e));
+    visit(hash, static_cast<kind>(e[g_entry_kind]), std::string_view(found->data.data() + offset, length));
+  }
+
+  return true;
+}
+
+void pack_store::quarantine(const std::string& name, const std::filesystem::path& dir) {
+  check_writable();
+  std::unique_lock<std::shared_mutex> lock(_packs_mutex);
+
+  // The index goes first so that the pack disappears atomically for readers
+  // An index without its pack file is quarantined alone
+  std::error_code ec;
+  for (const char* ext : {".idx", ".pack"}) {
+    if (ext == std::string_view(".pack") && !std::filesystem::exists(_dir / (name + ext), ec)) {
+      continue;
+    }
+    std::filesystem::rename(_dir / (name + ext), dir / (name + ext), ec);
+    if (ec) {
+      throw std::runtime_error("failed to quarantine pack: " + (_dir / name).string() + ": " + ec.message());
+    }
+  }
+
+  _packs.erase(
+      std::remove_if(_packs.begin(), _packs.end(), [&](const auto& pack) { return pack->name == name; }), _packs.end());
+}
+
+size_t pack_store::evict(
+    size_t max_size, std::chrono::seconds retention, const std::function<bool(const fstree::digest&, kind)>& keep) {
+  check_writable();
+  flush();
+
+  std::unique_lock<std::shared_mutex> lock(_packs_mutex);
+
+  // Pick up packs written by other processes
+  load();
+
+  std::vector<std::pair<inode::time_type, std::shared_ptr<pack>>> packs;
+  size_t size = 0;
+  for (const auto& pack : _packs) {
+    fstree::stat status;
+    try {
+      fstree::lstat(_dir / (pack->name + ".pack"), status);
+    }
+    catch (const std::exception& e) {
+      // The pack has likely been removed by another process
+      continue;
+    }
+    packs.emplace_back(status.last_write_time, pack);
+    size += pack->data.size() + pack->index.size();
+  }
+
+  // Remove the least recently used packs first
+  std::sort(packs.begin(), packs.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+  auto curtime = std::chrono::system_clock::now().time_since_epoch();
+  std::vector<std::shared_ptr<pack>> remaining;
+  for (const auto& [mtime, pack] : packs) {
+    if (size > max_size && std::chrono::nanoseconds(mtime) + retention <= curtime && !(keep && holds(*pack, keep))) {
+      remove(*pack);
+      size -= pack->data.size() + pack->index.size();
+      event("cache::evict", (_dir / (pack->name + ".pack")).string());
+      continue;
+    }
+    remaining.push_back(pack);
+  }
+  _packs = remaining;
+
+  // Merge small packs when there are too many of them
+  std::vector<std::shared_ptr<pack>> small;
+  for (const auto& pack : remaining) {
+    if (pack->data.size() < g_consolidate_size) {
+      small.push_back(pack);
+    }
+  }
+
+  if (small.size() > g_max_packs) {
+    std::filesystem::path tmp = _tmpdir;
+    FILE* fp = fstree::mkstemp(tmp);
+    if (!fp) {
+      throw std::runtime_error("failed to create temporary file: " + tmp.string() + ": " + std::strerror(errno));
+    }
+
+    std::string header;
+    store_value(header, g_pack_magic);
+    store_value(header, g_version);
+    bool ok = fwrite(header.data(), 1, header.size(), fp) == header.size();
+
+    // Copy each distinct object once
+    std::set<key> seen;
+    std::vector<entry> entries;
+    uint64_t offset = g_pack_header_size;
+    for (const auto& pack : small) {
+      size_t count = load_value<uint32_t>(pack->index.data() + 4);
+      const char* entries_data = pack->index.data() + g_index_header_size + g_fanout_size;
+      for (size_t i = 0; ok && i < count; i++) {
+        const char* e = entries_data + i * g_entry_size;
+        key k{};
+        std::memcpy(k.data(), e, fstree::digest::max_length);
+        k[fstree::digest::max_length] = uint8_t(e[g_entry_alg]);
+        k[fstree::digest::max_length + 1] = uint8_t(e[g_entry_kind]);
+        if (!seen.insert(k).second) {
+          continue;
+        }
+
+        uint64_t object_offset = load_value<uint64_t>(e + g_entry_offset);
+        uint32_t length = load_value<uint32_t>(e + g_entry_length);
+        if (object_offset > pack->data.size() || length > pack->data.size() - object_offset) {
+          continue;
+        }
+
+        ok = fwrite(pack->data.data() + object_offset, 1, length, fp) == length;
+        entries.push_back(entry{k, offset, length});
+        offset += length;
+      }
+    }
+
+    if (!ok) {
+      int err = errno;
+      fclose(fp);
+      std::error_code ec;
+      std::filesystem::remove(tmp, ec);
+      throw std::runtime_error("failed to write to temporary file: " + tmp.string() + ": " + std::strerror(err));
+    }
+    fclose(fp);
+
+    auto merged = install(tmp, entries);
+    event("cache::consolidate", (_dir / (merged->name + ".pack")).string(), small.size());
+
+    size += merged->data.size() + merged->index.size();
+    for (const auto& pack : small) {
+      if (pack->name == merged->name) continue;
+      remove(*pack);
+      size -= pack->data.size() + pack->index.size();
+    }
+
+    load();
+  }
+
+  return size;
+}
+
+}  // namespace fstree
@@ -0,0 +1,154 @@
+#pragma once
+
+#include "digest.hpp"
+#include "filesystem.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace fstree {
+
+// Storage of small cache objects in append-only pack files.
+//
+// A pack is a pair of files in the pack directory. The .pack file holds
+// the object data back to back. The .idx file is a table of all objects in
+// the pack, sorted by digest, with a 256 entry fanout on the first digest
+// byte. Both files are memory mapped. A pack becomes visible once its index
+// has been renamed into place, and is never modified afterwards.
+//
+// New objects are buffered in memory and written as a new pack by flush().
+// Packs are only removed or merged by evict(). Access times are tracked
+// per pack, by touching the pack file on the first hit in each process.
+//
+// Lookups try each pack in turn, so their cost grows with the number of
+// packs. evict() merges small packs to keep it low. Packs written by other
+// processes are picked up when a lookup misses and the pack directory has
+// changed since the packs were loaded.
+// A read-only store never modifies the pack directory, e.g. the packs of
+// another cache: hits aren't recorded and writes and eviction throw.
+//
+// All methods are thread-safe.
+class pack_store {
+ public:
+  enum class kind : uint8_t { file = 1, tree = 2 };
+
+  pack_store(const std::filesystem::path& dir, const std::filesystem::path& tmpdir, bool read_only = false);
+  ~pack_store();
+
+  pack_store(const pack_store&) = delete;
+  pack_store& operator=(const pack_store&) = delete;
+
+  // Returns true if the object is stored in a pack or pending
+  bool contains(const fstree::digest& hash, kind kind);
+
+  // Reads an object into data. Returns false if the object is not stored.
+  bool read(const fstree::digest& hash, kind kind, std::string& data);
+
+  // Adds an object. It is buffered until the next flush.
+  void write(const fstree::digest& hash, kind kind, std::string_view data);
+
+  // Writes all pending objects to a new pack
+  void flush();
+
+  // Removes the least recently used packs until the total size of all packs
+  // is below max_size, sparing packs used within the retention period and
+  // packs with an object for which keep returns true, if given.
+  // Remaining small packs are merged when there are too many of them.
+  // Returns the total size of the remaining packs.
+  size_t evict(size_t max_size, std::chrono::seconds retention,
+               const std::function<bool(const fstree::digest&, kind)>& keep = nullptr);
+
+  // Returns the total size of all packs
+  size_t size() const;
+
+  // Returns the names of all packs, sorted
+  std::vector<std::string> names() const;
+
+  // Calls visit with each object in a pack, in index order. A pack that
+  // failed to load is opened from disk again. Returns false if there is no
+  // such pack. Throws if the pack or its index is corrupt, including
+  // entries that lookups can't find through the fanout.
+  bool visit(const std::string& name, const std::function<void(const fstree::digest&, kind, std::string_view)>& visit);
+
+  // Moves the files of a pack to another directory, removing it from the store
+  void quarantine(const std::string& name, const std::filesystem::path& dir);
+
+ private:
+  // Sort key of an object: digest bytes, algorithm and kind
+  using key = std::array<uint8_t, fstree::digest::max_length + 2>;
+
+  struct pack {
+    std::string name;
+    mapped_file data;
+    mapped_file index;
+    std::atomic<bool> accessed{false};
+
+    // Returns the index entry of an object, or nullptr
+    const char* find(const key& k) const;
+  };
+
+  struct entry {
+    key k;
+    uint64_t offset;
+    uint32_t size;
+  };
+
+  static key make_key(const fstree::digest& hash, kind kind);
+
+  // Finds an object in the sealed packs, reloading them first if the pack
+  // directory has changed since they were loaded
+  const char* find(const key& k, std::shared_ptr<pack>& found);
+
+  // Finds an object in the loaded packs. Must be called with the packs mutex held.
+  const char* find_loaded(const key& k, std::shared_ptr<pack>& found) const;
+
+  // Reads the list of packs from disk, keeping those already open. Must be
+  // called with the packs mutex held.
+  void load();
+
+  // Opens and validates a pack
+  std::shared_ptr<pack> open(const std::string& name) const;
+
+  // Writes the index for a temporary pack file and moves both into place.
+  // Must be called with the packs mutex held. Returns the installed pack.
+  std::shared_ptr<pack> install(const std::filesystem::path& tmp, std::vector<entry>& entries);
+
+  // Returns true if keep returns true for any object in a pack
+  bool holds(const pack& pack, const std::function<bool(const fstree::digest&, kind)>& keep) const;
+
+  // Removes the files of a pack
+  void remove(const pack& pack);
+
+  // Marks a pack as accessed
+  void touch(pack& pack);
+
+  // Throws if the store is read-only
+  void check_writable() const;
+
+  void flush_locked();
+
+  std::filesystem::path _dir, _tmpdir;
+  const bool _read_only;
+
+  mutable std::shared_mutex _packs_mutex;
+  std::vector<std::shared_ptr<pack>> _packs;
+  std::filesystem::file_time_type _dir_time;  // Of the pack directory when last loaded
+
+  std::mutex _pending_mutex;
+  std::string _pending;
+  std::map<key, std::pair<size_t, size_t>> _pending_index;
+};
+
+}  // namespace fstree
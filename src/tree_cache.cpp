@@ -0,0 +1,88 @@
+#include "tree_cache.hpp"
+
+#include "inode_arena.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <utility>
+
+namespace fstree {
+
+tree_object::tree_object(const inode& tree) {
+  _entries.reserve(tree.end() - tree.begin());
+  _memory_size = sizeof(tree_object);
+
+  for (const inode* child : tree) {
+    std::optional<std::string> data;
+    if (child->has_inline_data()) {
+      data = child->inline_data();
+    }
+    _entries.push_back(entry{
+        child->name(), child->status(), child->hash(), child->target(), child->size(), child->file_count(),
+        std::move(data)});
+    _memory_size +=
+        sizeof(entry) + child->name().size() + child->target().size() + child->inline_data().size();
+  }
+}
+
+void tree_object::materialize(inode& tree) const {
+  // Children paths are relative to the tree root
+  std::string prefix = tree.path();
+  if (!prefix.empty()) {
+    prefix += static_cast<char>(std::filesystem::path::preferred_separator);
+  }
+  size_t prefix_size = prefix.size();
+
+  for (const auto& entry : _entries) {
+    prefix.resize(prefix_size);
+    prefix += entry.name;
+    auto child = tree.arena()->make(prefix, entry.status, inode::time_type(0), entry.size, entry.target, entry.hash);
+    child->set_file_count(entry.file_count);
+    if (entry.data) {
+      child->set_inline_data(*entry.data);
+    }
+    tree.add_child(child);
+  }
+}
+
+tree_cache::tree_cache(size_t max_size) : _max_size(max_size) {}
+
+tree_cache::object_ptr tree_cache::get(const fstree::digest& hash) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  auto it = _objects.find(hash);
+  if (it == _objects.end()) {
+    return nullptr;
+  }
+
+  _lru.splice(_lru.begin(), _lru, it->second);
+  return it->second->second;
+}
+
+void tree_cache::put(const fstree::digest& hash, object_ptr object) {
+  if (object->memory_size() > _max_size) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (_objects.count(hash) > 0) {
+    return;
+  }
+
+  _size += object->memory_size();
+  _lru.emplace_front(hash, std::move(object));
+  _objects.emplace(hash, _lru.begin());
+
+  while (_size > _max_size) {
+    auto& last = _lru.back();
+    _size -= last.second->memory_size();
+    _objects.erase(last.first);
+    _lru.pop_back();
+  }
+}
+
+size_t tree_cache::size() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _size;
+}
+
+}  // namespace fstree
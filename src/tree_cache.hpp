@@ -0,0 +1,85 @@
+#pragma once
+
+#include "digest.hpp"
+#include "inode.hpp"
+#include "status.hpp"
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace fstree {
+
+// The parsed entries of a tree object.
+//
+// Entry names are relative to the tree, so the same parsed object can be
+// attached to any directory with that hash. It is immutable once built and
+// shared between all readers.
+class tree_object {
+ public:
+  struct entry {
+    std::string name;
+    file_status status;
+    fstree::digest hash;
+    std::string target;
+    size_t size;
+    size_t file_count;
+    std::optional<std::string> data;
+  };
+
+  // Captures the children of a directory inode
+  explicit tree_object(const inode& tree);
+
+  // Adds inodes for all entries as children of a directory inode
+  void materialize(inode& tree) const;
+
+  // Returns the entries in tree order
+  const std::vector<entry>& entries() const { return _entries; }
+
+  // Returns the approximate memory used by the object
+  size_t memory_size() const { return _memory_size; }
+
+ private:
+  std::vector<entry> _entries;
+  size_t _memory_size;
+};
+
+// A bounded, thread-safe LRU of parsed tree objects keyed by digest.
+//
+// Tree objects are content addressed, so cached entries never go stale
+// and need no invalidation.
+class tree_cache {
+ public:
+  using object_ptr = std::shared_ptr<const tree_object>;
+
+  // Default memory budget of parsed trees
+  static constexpr size_t default_max_size = 64 * 1024 * 1024;
+
+  explicit tree_cache(size_t max_size = default_max_size);
+
+  // Returns the parsed tree with the given hash, or nullptr
+  object_ptr get(const fstree::digest& hash);
+
+  // Adds a parsed tree, evicting the least recently used ones over budget
+  void put(const fstree::digest& hash, object_ptr object);
+
+  // Returns the approximate memory used by all cached trees
+  size_t size() const;
+
+ private:
+  using lru_list = std::list<std::pair<fstree::digest, object_ptr>>;
+
+  mutable std::mutex _mutex;
+  lru_list _lru;
+  std::unordered_map<fstree::digest, lru_list::iterator, fstree::digest_hash> _objects;
+  size_t _size = 0;
+  size_t _max_size;
+};
+
+}  // namespace fstree
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+
+namespace fstree {
+
+// Writes an unsigned LEB128 varint
+inline void write_varint(std::ostream& os, uint64_t value) {
+  char buffer[10];
+  size_t length = 0;
+  do {
+    uint8_t byte = value & 0x7f;
+    value >>= 7;
+    buffer[length++] = static_cast<char>(value ? byte | 0x80 : byte);
+  } while (value);
+  os.write(buffer, length);
+}
+
+// Reads an unsigned LEB128 varint. Returns false on error.
+inline bool read_varint(std::istream& is, uint64_t& value) {
+  value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int byte = is.get();
+    if (byte == EOF) return false;
+    value |= uint64_t(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) return true;
+  }
+  return false;
+}
+
+}  // namespace fstree
@@ -0,0 +1,487 @@
+#include "cache.hpp"
+#include "index.hpp"
+#include "remote.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace fstree;
+namespace fs = std::filesystem;
+
+// Serves the loose objects of another cache, like a remote
+class cache_remote : public fstree::remote {
+  fs::path _objectdir;
+
+  fs::path find(const digest& hash) {
+    std::string hex = hash.hexdigest();
+    for (const char* ext : {".file", ".tree"}) {
+      fs::path path = _objectdir / hex.substr(0, 2) / (hex.substr(2) + ext);
+      if (fs::exists(path)) return path;
+    }
+    return {};
+  }
+
+ public:
+  explicit cache_remote(const fs::path& cache) : _objectdir(cache / "objects") {}
+
+  bool has_object(const digest& hash) override { return !find(hash).empty(); }
+
+  void has_tree(const digest&, std::vector<digest>&, std::vector<digest>&) override {}
+
+  void has_objects(const std::vector<digest>& hashes, std::vector<bool>& presence) override {
+    presence.clear();
+    for (const auto& hash : hashes) presence.push_back(has_object(hash));
+  }
+
+  void write_object(const digest&, const fs::path&) override { throw std::runtime_error("read-only remote"); }
+
+  void read_object(const digest& hash, const fs::path& path, const fs::path&) override {
+    fs::path object = find(hash);
+    if (object.empty()) throw std::runtime_error("object not found: " + hash.string());
+    fs::create_directories(path.parent_path());
+    fs::copy_file(object, path, fs::copy_options::overwrite_existing);
+  }
+};
+
+class CacheTest : public ::testing::Test {
+ protected:
+  fs::path test_dir;
+
+  void SetUp() override {
+    test_dir = fs::temp_directory_path() / "fstree_test_cache";
+    fs::remove_all(test_dir);
+    fs::create_directories(test_dir);
+  }
+
+  void TearDown() override { fs::remove_all(test_dir); }
+
+  void write_file(const std::string& rel, const std::string& data) {
+    fs::path path = test_dir / rel;
+    fs::create_directories(path.parent_path());
+    std::ofstream(path, std::ios::binary) << data;
+  }
+
+  // Returns the loose objects of a cache in the order fsck checks them
+  std::vector<std::string> loose_objects(const std::string& cache) {
+    std::vector<std::string> objects;
+    fs::path objectdir = test_dir / cache / "objects";
+    for (const auto& entry : fs::recursive_directory_iterator(objectdir)) {
+      fs::path rel = entry.path().lexically_relative(objectdir);
+      if (entry.is_regular_file() && rel.begin()->string().size() == 2) {
+        objects.push_back(rel.generic_string());
+      }
+    }
+    std::sort(objects.begin(), objects.end());
+    return objects;
+  }
+
+  // Makes all loose objects look unused for two hours, and forgets the
+  // catalog and the recently written roots
+  void age_objects(const std::string& cache) {
+    fs::path objectdir = test_dir / cache / "objects";
+    auto old = fs::file_time_type::clock::now() - std::chrono::hours(2);
+    for (const auto& object : loose_objects(cache)) {
+      fs::last_write_time(objectdir / object, old);
+    }
+    for (const char* name : {"catalog", "catalog.log", "roots"}) {
+      fs::remove(objectdir / name);
+    }
+  }
+
+  fs::path tree_object(const std::string& cache, const digest& hash) {
+    std::string hex = hash.hexdigest();
+    return test_dir / cache / "objects" / hex.substr(0, 2) / (hex.substr(2) + ".tree");
+  }
+
+  // Writes the tree of a workspace like fstree write-tree, keeping its index
+  // between calls, and returns the tree hash
+  digest write_tree(fstree::cache& c, const std::string& workspace) {
+    fstree::glob_list ignores;
+    fstree::index idx(test_dir / workspace, ignores);
+    fs::path index_file = test_dir / (workspace + ".index");
+    if (fs::exists(index_file)) {
+      idx.load(index_file);
+    }
+    idx.refresh();
+    c.add(idx);
+    idx.save(index_file);
+    return idx.root()->hash();
+  }
+};
+
+TEST_F(CacheTest, InlineDependsOnlyOnSize) {
+  for (const std::string ws : {"a", "b"}) {
+    write_file(ws + "/small", "tiny");
+    write_file(ws + "/dir/large", std::string(100, 'x'));
+  }
+
+  fstree::cache c(test_dir / "cache", cache::default_max_size, cache::default_retention);
+  digest plain = write_tree(c, "a");
+
+  // Unchanged files follow the threshold, not how they were written before
+  c.set_inline_size(16);
+  digest inlined = write_tree(c, "a");
+  EXPECT_NE(inlined, plain);
+  EXPECT_EQ(write_tree(c, "b"), inlined);
+
+  c.set_inline_size(0);
+  EXPECT_EQ(write_tree(c, "a"), plain);
+  EXPECT_EQ(write_tree(c, "b"), plain);
+}
+
+TEST_F(CacheTest, InlineSizeChangeRewritesCleanDirectories) {
+  for (const std::string ws : {"a", "b", "c"}) {
+    write_file(ws + "/dir/small", "tiny");
+    write_file(ws + "/dir/large", std::string(100, 'x'));
+  }
+
+  fstree::cache c(test_dir / "cache", cache::default_max_size, cache::default_retention);
+  digest plain = write_tree(c, "a");
+  write_tree(c, "c");
+
+  // The directory is clean and its tree exists, but the small file moves
+  // into its entry
+  c.set_inline_size(16);
+  digest inlined = write_tree(c, "a");
+  EXPECT_NE(inlined, plain);
+  EXPECT_EQ(write_tree(c, "b"), inlined);
+
+  c.set_inline_size(0);
+  EXPECT_EQ(write_tree(c, "a"), plain);
+
+  // Inlined files get no object, even if the index was written without them
+  fstree::cache other(test_dir / "other", cache::default_max_size, cache::default_retention);
+  other.set_inline_size(16);
+  EXPECT_EQ(write_tree(other, "c"), inlined);
+  auto objects = loose_objects("other");
+  EXPECT_EQ(std::count_if(objects.begin(), objects.end(),
+                          [](const std::string& object) { return object.ends_with(".file"); }),
+            1);
+}
+
+TEST_F(CacheTest, PullRepairsStaleCompleteMarker) {
+  write_file("ws/small", "tiny");
+  write_file("ws/dir/large", std::string(100, 'x'));
+
+  digest tree;
+  {
+    fstree::cache source(test_dir / "source", cache::default_max_size, cache::default_retention);
+    tree = write_tree(source, "ws");
+  }
+  cache_remote remote(test_dir / "source");
+
+  {
+    fstree::cache c(test_dir / "cache", cache::default_max_size, cache::default_retention);
+    fstree::index index;
+    c.pull(index, remote, tree);
+  }
+  ASSERT_TRUE(fs::exists(test_dir / "cache" / "objects" / "complete"));
+
+  // The tree is marked complete, but its object is gone
+  ASSERT_TRUE(fs::remove(tree_object("cache", tree)));
+
+  fstree::cache c(test_dir / "cache", cache::default_max_size, cache::default_retention);
+  fstree::index index;
+  EXPECT_NO_THROW(c.pull(index, remote, tree));
+  EXPECT_TRUE(fs::exists(tree_object("cache", tree)));
+  EXPECT_EQ(index.root()->hash(), tree);
+  EXPECT_EQ(index.size(), 3u);
+}
+
+TEST_F(CacheTest, SecondaryPackErrorsFallBackToRemote) {
+  write_file("ws/small", "tiny");
+  write_file("ws/dir/file", "contents");
+
+  digest tree;
+  {
+    fstree::cache source(test_dir / "source", cache::default_max_size, cache::default_retention);
+    tree = write_tree(source, "ws");
+  }
+  {
+    fstree::cache shared(test_dir / "shared", cache::default_max_size, cache::default_retention);
+    shared.set_pack_objects(true);
+    ASSERT_EQ(write_tree(shared, "ws"), tree);
+  }
+
+  // Cut the shared packs short after their header, so that reads fail
+  size_t packs = 0;
+  for (const auto& entry : fs::directory_iterator(test_dir / "shared" / "objects" / "pack")) {
+    if (entry.path().extension() == ".pack") {
+      fs::resize_file(entry.path(), 4);
+      packs++;
+    }
+  }
+  ASSERT_GT(packs, 0u);
+
+  cache_remote remote(test_dir / "source");
+  fstree::cache c(test_dir / "cache", cache::default_max_size, cache::default_retention);
+  c.set_secondary(test_dir / "shared");
+  fstree::index index;
+  EXPECT_NO_THROW(c.pull(index, remote, tree));
+  EXPECT_TRUE(fs::exists(tree_object("cache", tree)));
+}
+
+TEST_F(CacheTest, FsckQuarantinesCorruptObject) {
+  write_file("ws/a", "first file");
+  write_file("ws/b", "second file");
+
+  fstree::cache c(test_dir / "cache", cache::default_max_size, cache::default_retention);
+  write_tree(c, "ws");
+  EXPECT_TRUE(c.fsck(0, 0).empty());
+
+  std::vector<std::string> objects = loose_objects("cache");
+  auto corrupt = std::find_if(objects.begin(), objects.end(), [](const auto& name) { return name.ends_with(".file"); });
+  ASSERT_NE(corrupt, objects.end());
+  std::ofstream(test_dir / "cache" / "objects" / *corrupt, std::ios::binary) << "changed";
+
+  EXPECT_EQ(c.fsck(0, 0), std::vector<std::string>{*corrupt});
+  EXPECT_FALSE(fs::exists(test_dir / "cache" / "objects" / *corrupt));
+  EXPECT_TRUE(fs::exists(test_dir / "cache" / "quarantine" / (corrupt->substr(0, 2) + corrupt->substr(3))));
+  EXPECT_TRUE(c.fsck(0, 0).empty());
+}
+
+TEST_F(CacheTest, FsckResumesFromCursor) {
+  for (int i = 0; i < 5; i++) {
+    write_file("ws/file" + std::to_string(i), "contents " + std::to_string(i));
+  }
+
+  fstree::cache c(test_dir / "cache", cache::default_max_size, cache::default_retention);
+  write_tree(c, "ws");
+
+  std::vector<std::string> objects = loose_objects("cache");
+  auto last = std::find_if(objects.rbegin(), objects.rend(), [](const auto& name) { return name.ends_with(".file"); });
+  ASSERT_NE(last, objects.rend());
+  std::ofstream(test_dir / "cache" / "objects" / *last, std::ios::binary) << "changed";
+  size_t position = objects.rend() - last - 1;
+
+  // Each run checks a single object, after the one recorded by the last run
+  for (size_t i = 0; i < objects.size(); i++) {
+    std::vector<std::string> corrupt = c.fsck(1, 0);
+    if (i == position) {
+      EXPECT_EQ(corrupt, std::vector<std::string>{*last});
+    }
+    else {
+      EXPECT_TRUE(corrupt.empty()) << i;
+    }
+
+    std::string cursor;
+    std::getline(std::ifstream(test_dir / "cache" / "objects" / "fsck"), cursor);
+    EXPECT_EQ(cursor, i + 1 < objects.size() ? objects[i] : "");
+  }
+}
+
+TEST_F(CacheTest, FsckQuarantinesUnreadablePack) {
+  write_file("ws/a", "first file");
+
+  fstree::cache c(test_dir / "cache", cache::default_max_size, cache::default_retention);
+  c.set_pack_objects(true);
+  write_tree(c, "ws");
+
+  std::vector<std::string> packs;
+  for (const auto& entry : fs::directory_iterator(test_dir / "cache" / "objects" / "pack")) {
+    if (entry.path().extension() == ".idx") {
+      packs.push_back(entry.path().stem().string());
+    }
+  }
+  ASSERT_EQ(packs.size(), 1u);
+
+  // A broken magic keeps the pack from loading at all
+  {
+    std::fstream index(test_dir / "cache" / "objects" / "pack" / (packs[0] + ".idx"),
+                       std::ios::in | std::ios::out | std::ios::binary);
+    index.write("xx", 2);
+  }
+
+  fstree::cache reopened(test_dir / "cache", cache::default_max_size, cache::default_retention);
+  EXPECT_EQ(reopened.fsck(0, 0), std::vector<std::string>{"pack/" + packs[0]});
+  EXPECT_TRUE(fs::exists(test_dir / "cache" / "quarantine" / (packs[0] + ".idx")));
+  EXPECT_TRUE(fs::exists(test_dir / "cache" / "quarantine" / (packs[0] + ".pack")));
+  EXPECT_FALSE(fs::exists(test_dir / "cache" / "objects" / "pack" / (packs[0] + ".idx")));
+}
+
+TEST_F(CacheTest, EvictKeepsPacksOfPinnedTrees) {
+  write_file("pinned/file", "pinned contents");
+  write_file("other/file", "other contents");
+
+  // Everything is over the size limit and outside the retention period
+  fstree::cache c(test_dir / "cache", 1, std::chrono::seconds(0));
+  c.set_pack_objects(true);
+  digest pinned = write_tree(c, "pinned");
+  digest other = write_tree(c, "other");
+  c.pin(pinned, std::chrono::hours(1));
+
+  c.evict();
+  EXPECT_TRUE(c.has_tree(pinned));
+  EXPECT_FALSE(c.has_tree(other));
+}
+
+TEST_F(CacheTest, AddAndEvictConcurrently) {
+  for (int i = 0; i < 1000; i++) {
+    write_file("ws/dir" + std::to_string(i % 20) + "/file" + std::to_string(i), "contents " + std::to_string(i));
+  }
+
+  fs::path objectdir = test_dir / "cache" / "objects";
+  for (int iteration = 0; iteration < 5; iteration++) {
+    {
+      fstree::cache c(test_dir / "cache", cache::default_max_size, cache::default_retention);
+      write_tree(c, "ws");
+    }
+
+    // All objects look unused for two hours, and the catalog is rebuilt from their times
+    auto old = fs::file_time_type::clock::now() - std::chrono::hours(2);
+    for (const auto& object : loose_objects("cache")) {
+      fs::last_write_time(objectdir / object, old);
+    }
+    fs::remove(objectdir / "catalog");
+    fs::remove(objectdir / "catalog.log");
+
+    // A fresh index rehashes every file and reuses the objects, while
+    // another process evicts everything it doesn't know to be in use
+    fstree::glob_list ignores;
+    fstree::index index(test_dir / "ws", ignores);
+    index.refresh();
+
+    std::thread writer([&]() {
+      fstree::cache c(test_dir / "cache", cache::default_max_size, cache::default_retention);
+      c.add(index);
+    });
+    std::thread evictor([&]() {
+      fstree::cache c(test_dir / "cache", 1, cache::default_retention);
+      c.evict();
+    });
+    writer.join();
+    evictor.join();
+
+    fstree::cache c(test_dir / "cache", cache::default_max_size, cache::default_retention);
+    EXPECT_TRUE(c.has_tree(index.root()->hash()));
+    for (const auto& inode : index) {
+      if (inode->is_file()) {
+        EXPECT_TRUE(c.has_object(inode->hash())) << inode->path();
+      }
+      else if (inode->is_directory()) {
+        EXPECT_TRUE(c.has_tree(inode->hash())) << inode->path();
+      }
+    }
+  }
+}
+
+TEST_F(CacheTest, GcSweepsUnreachableObjects) {
+  write_file("live/file", "live contents");
+  write_file("dead/file", "dead contents");
+  write_file("pinned/file", "pinned contents");
+
+  fstree::cache c(test_dir / "cache", cache::default_max_size, cache::default_retention);
+  digest live = write_tree(c, "live");
+  digest dead = write_tree(c, "dead");
+  digest pinned = write_tree(c, "pinned");
+  age_objects("cache");
+  c.pin(pinned, std::chrono::hours(1));
+
+  c.gc({live});
+
+  fstree::cache reopened(test_dir / "cache", cache::default_max_size, cache::default_retention);
+  fstree::index index;
+  ASSERT_NO_THROW(reopened.index_from_tree(live, index));
+  for (const auto& inode : index) {
+    EXPECT_TRUE(!inode->is_file() || reopened.has_object(inode->hash())) << inode->path();
+  }
+  EXPECT_TRUE(reopened.has_tree(pinned));
+  EXPECT_FALSE(reopened.has_tree(dead));
+
+  // Only the live and pinned trees and their files are left
+  EXPECT_EQ(loose_objects("cache").size(), 4u);
+}
+
+TEST_F(CacheTest, GcSweepsUnreachablePacks) {
+  write_file("live/file", "live contents");
+  write_file("dead/file", "dead contents");
+
+  // Each tree is written to its own pack
+  fstree::cache c(test_dir / "cache", cache::default_max_size, std::chrono::seconds(0));
+  c.set_pack_objects(true);
+  digest live = write_tree(c, "live");
+  digest dead = write_tree(c, "dead");
+  age_objects("cache");
+
+  c.gc({live});
+
+  fstree::cache reopened(test_dir / "cache", cache::default_max_size, cache::default_retention);
+  EXPECT_TRUE(reopened.has_tree(live));
+  EXPECT_FALSE(reopened.has_tree(dead));
+}
+
+TEST_F(CacheTest, GcKeepsObjectsUsedWithinRetention) {
+  write_file("live/file", "live contents");
+  write_file("used/file", "used contents");
+  write_file("dead/file", "dead contents");
+
+  digest live, used, dead;
+  {
+    fstree::cache c(test_dir / "cache", cache::default_max_size, cache::default_retention);
+    live = write_tree(c, "live");
+    used = write_tree(c, "used");
+    dead = write_tree(c, "dead");
+  }
+  age_objects("cache");
+
+  // Another process uses a tree that isn't recorded as a root. The use is
+  // only logged in the catalog, not on the objects.
+  {
+    fstree::cache other(test_dir / "cache", cache::default_max_size, cache::default_retention);
+    EXPECT_TRUE(other.has_tree(used));
+  }
+
+  fstree::cache c(test_dir / "cache", cache::default_max_size, cache::default_retention);
+  c.gc({live});
+  EXPECT_TRUE(c.has_tree(live));
+  EXPECT_TRUE(c.has_tree(used));
+  EXPECT_FALSE(c.has_tree(dead));
+}
+
+TEST_F(CacheTest, PullAfterEvictionByAnotherInstance) {
+  write_file("ws/file", "contents");
+  write_file("ws/dir/file", "more contents");
+
+  digest tree;
+  {
+    fstree::cache source(test_dir / "source", cache::default_max_size, cache::default_retention);
+    tree = write_tree(source, "ws");
+  }
+  cache_remote remote(test_dir / "source");
+
+  // The second pull loads the markers saved by the first
+  fstree::cache c(test_dir / "cache", cache::default_max_size, cache::default_retention);
+  for (int i = 0; i < 2; i++) {
+    fstree::index index;
+    c.pull(index, remote, tree);
+  }
+
+  // Another process evicts everything, which invalidates the markers
+  {
+    fstree::cache other(test_dir / "cache", 1, std::chrono::seconds(0));
+    other.evict();
+  }
+  ASSERT_FALSE(fs::exists(tree_object("cache", tree)));
+
+  fstree::index index;
+  c.pull(index, remote, tree);
+
+  fstree::cache reopened(test_dir / "cache", cache::default_max_size, cache::default_retention);
+  EXPECT_TRUE(reopened.has_tree(tree));
+  for (const auto& inode : index) {
+    if (inode->is_file()) {
+      EXPECT_TRUE(reopened.has_object(inode->hash())) << inode->path();
+    }
+    else if (inode->is_directory()) {
+      EXPECT_TRUE(reopened.has_tree(inode->hash())) << inode->path();
+    }
+  }
+}
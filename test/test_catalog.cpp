@@ -0,0 +1,285 @@
+#include "catalog.hpp"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <limits>
+
+using namespace fstree;
+namespace fs = std::filesystem;
+
+// Returns the next victim regardless of access times and segment sizes
+static const catalog::object* victim(const catalog& cat) {
+  return cat.victim(std::numeric_limits<catalog::time_type>::max(), std::numeric_limits<uint64_t>::max());
+}
+
+class CatalogTest : public ::testing::Test {
+ protected:
+  fs::path test_dir;
+
+  void SetUp() override {
+    test_dir = fs::temp_directory_path() / "fstree_test_catalog";
+    fs::remove_all(test_dir);
+    fs::create_directories(test_dir);
+  }
+
+  void TearDown() override { fs::remove_all(test_dir); }
+};
+
+TEST_F(CatalogTest, MissingCatalog) {
+  catalog cat(test_dir);
+  uint64_t size;
+  catalog::time_type created;
+  EXPECT_FALSE(cat.read_size(size, created));
+  EXPECT_FALSE(cat.load());
+}
+
+TEST_F(CatalogTest, SizeIncludesLog) {
+  {
+    catalog cat(test_dir);
+    cat.reset({{"aa/1.file", 100, 1}});
+    cat.compact();
+
+    cat.add("bb/2.file", 20, 2);
+    EXPECT_TRUE(cat.has_pending());
+    cat.flush();
+    EXPECT_FALSE(cat.has_pending());
+  }
+
+  catalog cat(test_dir);
+  uint64_t size;
+  catalog::time_type created;
+  ASSERT_TRUE(cat.read_size(size, created));
+  EXPECT_EQ(size, 120);
+  EXPECT_GT(created, 0);
+}
+
+TEST_F(CatalogTest, OldestFirst) {
+  catalog cat(test_dir);
+  cat.reset({{"aa/1.file", 100, 30}, {"bb/2.file", 20, 10}});
+  cat.compact();
+  cat.add("cc/3.tree", 5, 20);
+  cat.flush();
+
+  catalog loaded(test_dir);
+  ASSERT_TRUE(loaded.load());
+  EXPECT_EQ(loaded.count(), 3);
+  EXPECT_EQ(loaded.size(), 125);
+  EXPECT_EQ(victim(loaded)->path, "bb/2.file");
+
+  loaded.touch("bb/2.file", 40);
+  EXPECT_EQ(victim(loaded)->path, "cc/3.tree");
+
+  loaded.remove("cc/3.tree");
+  EXPECT_EQ(victim(loaded)->path, "aa/1.file");
+  EXPECT_EQ(loaded.size(), 120);
+
+  loaded.remove("aa/1.file");
+  loaded.remove("bb/2.file");
+  EXPECT_EQ(victim(loaded), nullptr);
+  EXPECT_EQ(loaded.size(), 0);
+}
+
+TEST_F(CatalogTest, CompactTruncatesLog) {
+  catalog cat(test_dir);
+  cat.reset({});
+  cat.compact();
+  cat.add("aa/1.file", 100, 1);
+  cat.add("aa/1.file", 100, 2);
+  cat.flush();
+  EXPECT_GT(cat.log_size(), 0);
+
+  // Objects logged twice are counted twice until loaded
+  uint64_t size;
+  catalog::time_type created;
+  ASSERT_TRUE(cat.read_size(size, created));
+  EXPECT_EQ(size, 200);
+
+  ASSERT_TRUE(cat.load());
+  EXPECT_EQ(cat.size(), 100);
+  EXPECT_EQ(victim(cat)->time, 2);
+  cat.compact();
+  EXPECT_EQ(cat.log_size(), 0);
+
+  ASSERT_TRUE(cat.read_size(size, created));
+  EXPECT_EQ(size, 100);
+}
+
+TEST_F(CatalogTest, TruncatedLog) {
+  catalog cat(test_dir);
+  cat.reset({});
+  cat.compact();
+  cat.add("aa/1.file", 100, 1);
+  cat.add("bb/2.file", 20, 2);
+  cat.flush();
+
+  // An interrupted append leaves a partial record
+  fs::resize_file(test_dir / "catalog.log", cat.log_size() - 3);
+
+  ASSERT_TRUE(cat.load());
+  EXPECT_EQ(cat.count(), 1);
+  EXPECT_EQ(cat.size(), 100);
+}
+
+TEST_F(CatalogTest, GarbageLogTail) {
+  catalog cat(test_dir);
+  cat.reset({});
+  cat.compact();
+  cat.add("aa/1.file", 100, 1);
+  cat.flush();
+  uint64_t log_size = cat.log_size();
+
+  // Add and access records with absurd path lengths end the replay
+  for (const char* garbage : {"\x01\x01\x01\xff\xff\xff\xff\xff\xff\xff\x7f", "\x02\x01\xff\xff\xff\xff\x7f"}) {
+    fs::resize_file(test_dir / "catalog.log", log_size);
+    std::ofstream(test_dir / "catalog.log", std::ios::binary | std::ios::app) << garbage;
+    ASSERT_TRUE(cat.load());
+    EXPECT_EQ(cat.count(), 1);
+    EXPECT_EQ(cat.size(), 100);
+  }
+}
+
+TEST_F(CatalogTest, AccessesUpdateTimes) {
+  catalog cat(test_dir);
+  cat.reset({{"aa/1.file", 100, 10}, {"bb/2.file", 20, 20}});
+  cat.compact();
+
+  cat.access("aa/1.file", 30);
+  cat.access("aa/1.file", 25);
+  cat.access("cc/3.file", 40);
+  cat.flush();
+
+  // Accesses don't count towards the size
+  uint64_t size;
+  catalog::time_type created;
+  ASSERT_TRUE(cat.read_size(size, created));
+  EXPECT_EQ(size, 120);
+
+  // Accesses of unknown objects are ignored
+  ASSERT_TRUE(cat.load());
+  EXPECT_EQ(cat.count(), 2);
+  EXPECT_EQ(victim(cat)->path, "bb/2.file");
+  cat.remove("bb/2.file");
+  EXPECT_EQ(victim(cat)->time, 30);
+}
+
+TEST_F(CatalogTest, ReplayAppendedRecords) {
+  catalog cat(test_dir);
+  cat.reset({{"aa/1.file", 100, 10}});
+  cat.compact();
+  ASSERT_TRUE(cat.load());
+
+  // Records appended by another process after the catalog was loaded
+  catalog other(test_dir);
+  other.add("bb/2.file", 20, 20);
+  other.access("aa/1.file", 30);
+  other.flush();
+
+  cat.replay();
+  EXPECT_EQ(cat.count(), 2);
+  EXPECT_EQ(cat.size(), 120);
+  EXPECT_EQ(victim(cat)->path, "bb/2.file");
+
+  // Records are only replayed once
+  cat.replay();
+  EXPECT_EQ(cat.size(), 120);
+}
+
+TEST_F(CatalogTest, ResetKeepsAccessTimes) {
+  catalog cat(test_dir);
+  cat.reset({{"aa/1.file", 100, 10}, {"bb/2.file", 20, 20}});
+  cat.compact();
+  cat.access("aa/1.file", 30);
+  cat.flush();
+  ASSERT_TRUE(cat.load());
+
+  // A scan finds modification times older than the logged accesses
+  cat.reset({{"aa/1.file", 100, 5}, {"cc/3.file", 1, 15}});
+  EXPECT_EQ(cat.count(), 2);
+  EXPECT_EQ(cat.size(), 101);
+  EXPECT_EQ(victim(cat)->path, "cc/3.file");
+  cat.remove("cc/3.file");
+  EXPECT_EQ(victim(cat)->time, 30);
+}
+
+TEST_F(CatalogTest, ResetKeepsLoggedTimesWithoutTable) {
+  catalog cat(test_dir);
+  cat.access("aa/1.file", 30);
+  cat.flush();
+  ASSERT_FALSE(cat.load());
+
+  // Uses are only logged, so the log has the only record of them
+  cat.reset({{"aa/1.file", 100, 5}, {"bb/2.file", 1, 15}});
+  EXPECT_EQ(victim(cat)->path, "bb/2.file");
+  cat.remove("bb/2.file");
+  EXPECT_EQ(victim(cat)->time, 30);
+
+  // The log has been applied and isn't replayed again
+  cat.replay();
+  EXPECT_EQ(cat.count(), 1);
+}
+
+TEST_F(CatalogTest, ProtectsObjectsUsedAgain) {
+  catalog cat(test_dir);
+  cat.reset({{"aa/1.file", 100, 10}, {"bb/2.file", 100, 20}, {"cc/3.file", 100, 30}});
+  cat.compact();
+  cat.access("aa/1.file", 15);
+  cat.flush();
+  ASSERT_TRUE(cat.load());
+
+  // Objects on probation go first, even if they were used later
+  EXPECT_EQ(cat.victim(100, 1000)->path, "bb/2.file");
+  EXPECT_EQ(cat.victim(25, 1000)->path, "bb/2.file");
+
+  // Only objects used before the given time are candidates
+  EXPECT_EQ(cat.victim(20, 1000)->path, "aa/1.file");
+  EXPECT_EQ(cat.victim(10, 1000), nullptr);
+
+  // Protected objects go first while they are over their limit
+  EXPECT_EQ(cat.victim(100, 50)->path, "aa/1.file");
+
+  // The protected segment is kept in the table
+  cat.compact();
+  ASSERT_TRUE(cat.load());
+  EXPECT_EQ(cat.victim(100, 50)->path, "aa/1.file");
+}
+
+TEST_F(CatalogTest, PinnedObjectsAreNotVictims) {
+  catalog cat(test_dir);
+  cat.reset({{"aa/1.file", 100, 10}, {"bb/2.file", 100, 20}});
+  cat.pin("aa/1.file");
+  cat.touch("aa/1.file", 15);
+  EXPECT_EQ(victim(cat)->path, "bb/2.file");
+  EXPECT_EQ(cat.size(), 200);
+
+  cat.remove("bb/2.file");
+  EXPECT_EQ(victim(cat), nullptr);
+
+  // Pins are not persistent
+  cat.compact();
+  ASSERT_TRUE(cat.load());
+  EXPECT_EQ(victim(cat)->path, "aa/1.file");
+}
+
+TEST_F(CatalogTest, PinsSurviveReplay) {
+  catalog cat(test_dir);
+  cat.reset({{"aa/1.file", 100, 10}, {"bb/2.file", 100, 20}});
+  cat.compact();
+  ASSERT_TRUE(cat.load());
+  cat.pin("aa/1.file");
+
+  // Another process writes the pinned object again and uses it
+  catalog other(test_dir);
+  other.add("aa/1.file", 100, 30);
+  other.access("aa/1.file", 40);
+  other.flush();
+
+  cat.replay();
+  ASSERT_NE(cat.find("aa/1.file"), nullptr);
+  EXPECT_EQ(cat.find("aa/1.file")->time, 40);
+  EXPECT_EQ(cat.find("cc/3.file"), nullptr);
+  EXPECT_EQ(victim(cat)->path, "bb/2.file");
+  cat.remove("bb/2.file");
+  EXPECT_EQ(victim(cat), nullptr);
+}
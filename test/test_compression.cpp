@@ -0,0 +1,86 @@
+#include "compression.hpp"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+using namespace fstree;
+
+static std::string random_data(size_t size) {
+  std::mt19937 rng(42);
+  std::string data(size, '\0');
+  for (auto& c : data) {
+    c = static_cast<char>(rng());
+  }
+  return data;
+}
+
+static std::string compressed(const std::string& data) {
+  std::istringstream is(data);
+  std::ostringstream os;
+  compress(is, os);
+  return os.str();
+}
+
+TEST(Compression, RoundTrip) {
+  if (!compression_supported()) GTEST_SKIP() << "zstd support is not enabled";
+
+  // Larger than the stream buffers, to cover partial reads and flushes
+  std::string data;
+  for (int i = 0; i < 100000; i++) {
+    data += "line " + std::to_string(i) + "\n";
+  }
+
+  std::string frame = compressed(data);
+  EXPECT_LT(frame.size(), data.size());
+
+  std::istringstream is(frame);
+  std::ostringstream os;
+  decompress(is, os);
+  EXPECT_EQ(os.str(), data);
+}
+
+TEST(Compression, EmptyInput) {
+  if (!compression_supported()) GTEST_SKIP() << "zstd support is not enabled";
+
+  std::istringstream is(compressed(""));
+  std::ostringstream os;
+  decompress(is, os);
+  EXPECT_EQ(os.str(), "");
+}
+
+TEST(Compression, Probe) {
+  if (!compression_supported()) GTEST_SKIP() << "zstd support is not enabled";
+
+  EXPECT_TRUE(is_compressible(std::string(64 * 1024, '\0')));
+  EXPECT_FALSE(is_compressible(random_data(64 * 1024)));
+  EXPECT_FALSE(is_compressible(""));
+}
+
+TEST(Compression, CorruptInput) {
+  if (!compression_supported()) GTEST_SKIP() << "zstd support is not enabled";
+
+  std::string frame = compressed(std::string(64 * 1024, 'x'));
+
+  std::istringstream truncated(frame.substr(0, frame.size() - 4));
+  std::ostringstream os;
+  EXPECT_THROW(decompress(truncated, os), std::runtime_error);
+
+  std::istringstream garbage(random_data(1024));
+  EXPECT_THROW(decompress(garbage, os), std::runtime_error);
+
+  std::istringstream empty("");
+  EXPECT_THROW(decompress(empty, os), std::runtime_error);
+}
+
+TEST(Compression, Unsupported) {
+  if (compression_supported()) GTEST_SKIP() << "zstd support is enabled";
+
+  std::istringstream is("data");
+  std::ostringstream os;
+  EXPECT_THROW(compress(is, os), std::runtime_error);
+  EXPECT_FALSE(is_compressible(std::string(1024, '\0')));
+}
@@ -0,0 +1,89 @@
+#include "filesystem.hpp"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+using namespace fstree;
+namespace fs = std::filesystem;
+
+class CopyFileTest : public ::testing::Test {
+ protected:
+  fs::path test_dir;
+
+  void SetUp() override {
+    test_dir = fs::temp_directory_path() / "fstree_test_copy_file";
+    fs::remove_all(test_dir);
+    fs::create_directories(test_dir);
+  }
+
+  void TearDown() override { fs::remove_all(test_dir); }
+
+  void write(const fs::path& path, const std::string& data) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(data.data(), data.size());
+  }
+
+  std::string read(const fs::path& path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  }
+};
+
+TEST_F(CopyFileTest, AutomaticReplacesDestination) {
+  std::string data(300000, 'x');
+  write(test_dir / "from", data);
+  write(test_dir / "to", std::string(500000, 'y'));
+
+  copy_method used = copy_file(test_dir / "from", test_dir / "to", copy_method::automatic);
+  EXPECT_NE(used, copy_method::automatic);
+  EXPECT_EQ(read(test_dir / "to"), data);
+}
+
+TEST_F(CopyFileTest, Buffered) {
+  std::string data(600000, 'z');
+  write(test_dir / "from", data);
+
+  EXPECT_EQ(copy_file(test_dir / "from", test_dir / "to", copy_method::buffered), copy_method::buffered);
+  EXPECT_EQ(read(test_dir / "to"), data);
+}
+
+TEST_F(CopyFileTest, EmptyFile) {
+  write(test_dir / "from", "");
+  write(test_dir / "to", "stale");
+
+  copy_file(test_dir / "from", test_dir / "to", copy_method::automatic);
+  EXPECT_EQ(fs::file_size(test_dir / "to"), 0);
+}
+
+TEST_F(CopyFileTest, CloneCopiesOrFails) {
+  // Clones depend on the filesystem of the temporary directory
+  write(test_dir / "from", "data");
+  try {
+    EXPECT_EQ(copy_file(test_dir / "from", test_dir / "to", copy_method::clone), copy_method::clone);
+    EXPECT_EQ(read(test_dir / "to"), "data");
+  }
+  catch (const std::runtime_error& e) {
+    EXPECT_NE(std::string(e.what()).find("clone"), std::string::npos) << e.what();
+  }
+}
+
+#ifdef __linux__
+TEST_F(CopyFileTest, CopyRange) {
+  // Larger than a single buffered chunk, on the same filesystem
+  std::string data(700000, 'r');
+  write(test_dir / "from", data);
+  write(test_dir / "to", "stale");
+
+  EXPECT_EQ(copy_file(test_dir / "from", test_dir / "to", copy_method::copy_range), copy_method::copy_range);
+  EXPECT_EQ(read(test_dir / "to"), data);
+}
+#endif
+
+TEST_F(CopyFileTest, MissingSource) {
+  EXPECT_THROW(copy_file(test_dir / "missing", test_dir / "to", copy_method::automatic), std::runtime_error);
+}
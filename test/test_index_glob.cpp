@@ -10,6 +10,7 @@
 #include <fstream>
 #include <set>
 #include <string>
+#include <thread>
 #include <vector>
 
 using namespace fstree;
@@ -372,3 +373,129 @@ TEST_F(IndexGlobTest, WildcardInDir_MatchesDirComponent) {
   EXPECT_EQ(result.count("src456/lib.cpp"),  1);
   EXPECT_EQ(result.count("other/foo.cpp"),   0);
 }
+
+// ---------------------------------------------------------------------------
+// Basename / extension lookups
+// ---------------------------------------------------------------------------
+
+TEST_F(IndexGlobTest, Lookup_DoubleStarBasename) {
+  CreateFile("CMakeLists.txt");
+  CreateFile("src/CMakeLists.txt");
+  CreateFile("src/lib/CMakeLists.txt");
+  CreateFile("src/lib/CMakeLists.txt.in");
+
+  auto idx = BuildIndex();
+  auto result = Paths(idx.glob("**/CMakeLists.txt"));
+
+  EXPECT_EQ(result.size(), 3u);
+  EXPECT_EQ(result.count("CMakeLists.txt"),             1);
+  EXPECT_EQ(result.count("src/CMakeLists.txt"),         1);
+  EXPECT_EQ(result.count("src/lib/CMakeLists.txt"),     1);
+  EXPECT_EQ(result.count("src/lib/CMakeLists.txt.in"),  0);
+}
+
+TEST_F(IndexGlobTest, Lookup_BasenameMatchesDirectory) {
+  CreateFile("a/build/x.o");
+  CreateFile("b/build");
+
+  auto idx = BuildIndex();
+  auto result = Paths(idx.glob("build"));
+
+  EXPECT_EQ(result.size(), 2u);
+  EXPECT_EQ(result.count("a/build"), 1);
+  EXPECT_EQ(result.count("b/build"), 1);
+}
+
+TEST_F(IndexGlobTest, Lookup_ExtensionWithPrefix) {
+  CreateFile("lib/libfoo.so");
+  CreateFile("lib/foo.so");
+  CreateFile("lib/libfoo.so.1");
+
+  auto idx = BuildIndex();
+  auto result = Paths(idx.glob("lib*.so"));
+
+  EXPECT_EQ(result.size(), 1u);
+  EXPECT_EQ(result.count("lib/libfoo.so"), 1);
+}
+
+TEST_F(IndexGlobTest, Lookup_MultiDotSuffix) {
+  CreateFile("dist/a.tar.gz");
+  CreateFile("dist/b.gz");
+  CreateFile("dist/c.tar");
+
+  auto idx = BuildIndex();
+  auto result = Paths(idx.glob("**/*.tar.gz"));
+
+  EXPECT_EQ(result.size(), 1u);
+  EXPECT_EQ(result.count("dist/a.tar.gz"), 1);
+}
+
+TEST_F(IndexGlobTest, Lookup_AnchoredDoubleStar) {
+  CreateFile("top.h");
+  CreateFile("include/foo.h");
+
+  auto idx = BuildIndex();
+  auto result = Paths(idx.glob("/**/*.h"));
+
+  EXPECT_EQ(result.count("top.h"),         1);
+  EXPECT_EQ(result.count("include/foo.h"), 1);
+}
+
+TEST_F(IndexGlobTest, Lookup_InvalidatedByRefresh) {
+  CreateFile("src/main.cpp");
+
+  fstree::glob_list ignores;
+  fstree::index idx(test_dir, ignores);
+  idx.refresh();
+  EXPECT_EQ(Paths(idx.glob("*.cpp")).size(), 1u);
+
+  CreateFile("src/lib.cpp");
+  idx.refresh();
+  auto result = Paths(idx.glob("*.cpp"));
+
+  EXPECT_EQ(result.size(), 2u);
+  EXPECT_EQ(result.count("src/lib.cpp"), 1);
+}
+
+TEST_F(IndexGlobTest, Lookup_MatchesRecursiveOrder) {
+  CreateFile("b.txt");
+  CreateFile("a/z.txt");
+  CreateFile("a/b/c.txt");
+  CreateFile("a/y.txt");
+  CreateFile("c/d/e.txt");
+  CreateFile("a.txt");
+
+  auto idx = BuildIndex();
+
+  // '*.txt' is answered from the lookup tables, '*.tx?' by walking the tree
+  auto lookup = idx.glob("*.txt");
+  auto walk = idx.glob("*.tx?");
+
+  std::vector<std::string> lookup_paths, walk_paths;
+  for (const auto& n : lookup) lookup_paths.push_back(NormalizePath(n->path()));
+  for (const auto& n : walk) walk_paths.push_back(NormalizePath(n->path()));
+
+  EXPECT_EQ(lookup_paths.size(), 6u);
+  EXPECT_EQ(lookup_paths, walk_paths);
+}
+
+TEST_F(IndexGlobTest, Lookup_ConcurrentGlobs) {
+  for (int i = 0; i < 50; i++) {
+    CreateFile("dir" + std::to_string(i % 5) + "/file" + std::to_string(i) + ".txt");
+  }
+
+  auto idx = BuildIndex();
+
+  std::vector<std::thread> threads;
+  std::vector<size_t> counts(8);
+  for (size_t t = 0; t < counts.size(); t++) {
+    threads.emplace_back([&idx, &counts, t]() { counts[t] = idx.glob("*.txt").size(); });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  for (size_t count : counts) {
+    EXPECT_EQ(count, 50u);
+  }
+}
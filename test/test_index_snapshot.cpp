@@ -0,0 +1,90 @@
+#include "index.hpp"
+#include "index_snapshot.hpp"
+#include "inode_arena.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace fstree;
+namespace fs = std::filesystem;
+
+static const std::string g_hash_a = "sha1:0000000000000000000000000000000000000001";
+static const std::string g_hash_b = "sha1:0000000000000000000000000000000000000002";
+
+static file_status regular_file() { return file_status(fs::file_type::regular, fs::perms::owner_read); }
+
+static void add_file(fstree::index& idx, const std::string& path, inode::time_type mtime, const std::string& hash) {
+  idx.push_back(idx.root()->arena()->make(path, regular_file(), mtime, 0, "", digest::parse(hash)));
+}
+
+TEST(IndexSnapshot, Columns) {
+  fstree::index idx;
+  add_file(idx, "a", 1, g_hash_a);
+  add_file(idx, "b/c", 2, g_hash_b);
+  add_file(idx, "b/d", 3, g_hash_a);
+
+  index_snapshot snapshot(idx.begin(), idx.end());
+  ASSERT_EQ(snapshot.size(), 3);
+  EXPECT_EQ(snapshot.path(0), "a");
+  EXPECT_EQ(snapshot.path(1), "b/c");
+  EXPECT_EQ(snapshot.path(2), "b/d");
+  EXPECT_EQ(snapshot.last_write_time(1), 2);
+  EXPECT_EQ(snapshot.hash(1), digest::parse(g_hash_b));
+  EXPECT_TRUE(snapshot.status(2).is_regular());
+  EXPECT_EQ(snapshot.node(2), idx.begin()[2].get());
+
+  EXPECT_EQ(snapshot.lower_bound(""), 0);
+  EXPECT_EQ(snapshot.lower_bound("b"), 1);
+  EXPECT_EQ(snapshot.lower_bound("b/d"), 2);
+  EXPECT_EQ(snapshot.lower_bound("c"), 3);
+}
+
+TEST(IndexSnapshot, CopyMetadata) {
+  fstree::index current;
+  add_file(current, "a", 0, g_hash_a);
+  add_file(current, "b", 0, g_hash_a);
+  add_file(current, "d", 0, g_hash_a);
+
+  fstree::index other;
+  add_file(other, "a", 10, g_hash_a);
+  add_file(other, "b", 20, g_hash_b);
+  add_file(other, "c", 30, g_hash_a);
+  add_file(other, "d", 40, g_hash_a);
+
+  current.copy_metadata(other);
+
+  std::vector<inode::time_type> mtimes;
+  for (const auto& inode : current) {
+    mtimes.push_back(inode->last_write_time());
+  }
+  EXPECT_EQ(mtimes, (std::vector<inode::time_type>{10, 0, 40}));
+}
+
+TEST(IndexSnapshot, CopyMetadataPartitioned) {
+  // Large enough to be split into several partitions
+  const size_t count = 100000;
+
+  fstree::index current;
+  fstree::index other;
+  char name[32];
+  for (size_t i = 0; i < count; i++) {
+    std::snprintf(name, sizeof(name), "dir/%08zu", i);
+    add_file(current, name, 0, g_hash_a);
+    // Every third entry is missing from the other index, every fifth has another hash
+    if (i % 3 != 0) {
+      add_file(other, name, inode::time_type(i), i % 5 == 0 ? g_hash_b : g_hash_a);
+    }
+  }
+
+  current.copy_metadata(other);
+
+  size_t i = 0;
+  for (const auto& inode : current) {
+    bool copied = i % 3 != 0 && i % 5 != 0;
+    EXPECT_EQ(inode->last_write_time(), copied ? inode::time_type(i) : 0) << inode->path();
+    i++;
+  }
+}
@@ -579,3 +579,48 @@ TEST_F(DirectoryIteratorTest, InodeChildren) {
     EXPECT_EQ(child_paths.count("dir/file1.txt"), 1);
     EXPECT_EQ(child_paths.count("dir/subdir"), 1);
 }
+
+TEST_F(DirectoryIteratorTest, InodesOutliveIterator) {
+    CreateFile("dir/file.txt");
+
+    inode::ptr file_inode = nullptr;
+    {
+        glob_list ignores;
+        sorted_directory_iterator it(test_dir, ignores);
+        for (const auto& inode : it) {
+            if (NormalizePath(inode->path()) == "dir/file.txt") {
+                file_inode = inode;
+            }
+        }
+        ASSERT_NE(file_inode, nullptr);
+        EXPECT_EQ(file_inode->arena(), it.arena().get());
+    }
+
+    // The arena is kept alive by the remaining reference
+    ASSERT_NE(file_inode->parent(), nullptr);
+    EXPECT_EQ(NormalizePath(file_inode->parent()->path()), "dir");
+    EXPECT_EQ(NormalizePath(file_inode->path()), "dir/file.txt");
+}
+
+TEST_F(DirectoryIteratorTest, ComparePathMatchesStringOrder) {
+    CreateFile("a/b");
+    CreateFile("a-b");
+    CreateFile("a.b/c");
+    CreateFile("ab");
+
+    glob_list ignores;
+    sorted_directory_iterator it(test_dir, ignores);
+
+    std::vector<inode::ptr> inodes(it.begin(), it.end());
+    ASSERT_EQ(inodes.size(), 6);
+
+    for (const auto& a : inodes) {
+        for (const auto& b : inodes) {
+            int expected = a->path().compare(b->path());
+            int actual = a->compare_path(*b);
+            EXPECT_EQ(expected < 0, actual < 0) << a->path() << " " << b->path();
+            EXPECT_EQ(expected == 0, actual == 0) << a->path() << " " << b->path();
+        }
+        EXPECT_EQ(a->compare_path(a->path()), 0);
+    }
+}
@@ -0,0 +1,104 @@
+#include "hash.hpp"
+#include "index.hpp"
+#include "inode_arena.hpp"
+#include "manifest.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace fstree;
+namespace fs = std::filesystem;
+
+static const std::string g_hash_a = "sha1:0000000000000000000000000000000000000001";
+static const std::string g_hash_b = "sha1:0000000000000000000000000000000000000002";
+
+static file_status regular_file() { return file_status(fs::file_type::regular, fs::perms::owner_read); }
+static file_status directory() { return file_status(fs::file_type::directory, fs::perms::owner_all); }
+
+// Sets the hash of a directory from its serialized tree object
+static void hash_tree(inode& tree) {
+  std::ostringstream os(std::ios::binary);
+  os << tree;
+  tree.set_hash(hashsum_hex(os.view()));
+}
+
+// Builds the tree "a/b", "a/c/d", "e" and returns its hash
+static digest build_tree(fstree::index& idx) {
+  auto arena = idx.root()->arena();
+  std::string sep(1, static_cast<char>(fs::path::preferred_separator));
+  auto a = arena->make("a", directory(), 0, 0, "");
+  auto b = arena->make("a" + sep + "b", regular_file(), 0, 0, "", digest::parse(g_hash_a));
+  auto c = arena->make("a" + sep + "c", directory(), 0, 0, "");
+  auto d = arena->make("a" + sep + "c" + sep + "d", regular_file(), 0, 0, "", digest::parse(g_hash_b));
+  auto e = arena->make("e", regular_file(), 0, 0, "", digest::parse(g_hash_b));
+
+  c->add_child(d);
+  a->add_child(b);
+  a->add_child(c);
+  idx.root()->add_child(a);
+  idx.root()->add_child(e);
+
+  hash_tree(*c);
+  hash_tree(*a);
+  hash_tree(*idx.root());
+  return idx.root()->hash();
+}
+
+static std::vector<std::string> paths(const fstree::index& idx) {
+  std::vector<std::string> result;
+  for (const auto& inode : idx) {
+    result.push_back(inode->path());
+  }
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+TEST(Manifest, RoundTrip) {
+  fstree::index source;
+  digest tree = build_tree(source);
+
+  std::stringstream stream(std::ios::in | std::ios::out | std::ios::binary);
+  write_manifest(stream, *source.root());
+
+  fstree::index loaded;
+  std::vector<digest> visited;
+  read_manifest(stream, tree, loaded, [&](const digest& hash, std::string_view) { visited.push_back(hash); });
+
+  std::string sep(1, static_cast<char>(fs::path::preferred_separator));
+  std::vector<std::string> expected = {"a", "a" + sep + "b", "a" + sep + "c", "a" + sep + "c" + sep + "d", "e"};
+  EXPECT_EQ(paths(loaded), expected);
+  EXPECT_EQ(loaded.root()->hash(), tree);
+  EXPECT_EQ(visited.size(), 3);
+  EXPECT_EQ(visited[0], tree);
+}
+
+TEST(Manifest, RejectsOtherTree) {
+  fstree::index source;
+  build_tree(source);
+
+  std::stringstream stream(std::ios::in | std::ios::out | std::ios::binary);
+  write_manifest(stream, *source.root());
+
+  fstree::index loaded;
+  EXPECT_THROW(read_manifest(stream, digest::parse(g_hash_a), loaded), std::runtime_error);
+}
+
+TEST(Manifest, RejectsCorruptTree) {
+  fstree::index source;
+  digest tree = build_tree(source);
+
+  std::ostringstream os(std::ios::binary);
+  write_manifest(os, *source.root());
+  std::string data = os.str();
+
+  // Flip a byte in the last tree object, which holds the digest of "a/c/d"
+  data[data.size() - 10] ^= 1;
+
+  std::istringstream stream(data, std::ios::binary);
+  fstree::index loaded;
+  EXPECT_THROW(read_manifest(stream, tree, loaded), std::runtime_error);
+}
@@ -0,0 +1,235 @@
+#include "pack_store.hpp"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+using namespace fstree;
+namespace fs = std::filesystem;
+
+class PackStoreTest : public ::testing::Test {
+ protected:
+  fs::path test_dir;
+
+  void SetUp() override {
+    test_dir = fs::temp_directory_path() / "fstree_test_pack_store";
+    fs::remove_all(test_dir);
+    fs::create_directories(test_dir / "tmp");
+  }
+
+  void TearDown() override { fs::remove_all(test_dir); }
+
+  size_t count_packs() {
+    size_t count = 0;
+    for (const auto& entry : fs::directory_iterator(test_dir / "pack")) {
+      count += entry.path().extension() == ".pack";
+    }
+    return count;
+  }
+};
+
+static digest make_hash(int n) {
+  std::string hex(40, '0');
+  std::string suffix = std::to_string(n);
+  hex.replace(hex.size() - suffix.size(), suffix.size(), suffix);
+  return digest::parse("sha1:" + hex);
+}
+
+TEST_F(PackStoreTest, WriteFlushRead) {
+  pack_store packs(test_dir / "pack", test_dir / "tmp");
+  std::string data;
+
+  packs.write(make_hash(1), pack_store::kind::file, "hello");
+  packs.write(make_hash(2), pack_store::kind::tree, "world");
+
+  // Pending objects are visible before the flush
+  EXPECT_TRUE(packs.contains(make_hash(1), pack_store::kind::file));
+  EXPECT_FALSE(packs.contains(make_hash(1), pack_store::kind::tree));
+  ASSERT_TRUE(packs.read(make_hash(2), pack_store::kind::tree, data));
+  EXPECT_EQ(data, "world");
+
+  packs.flush();
+  EXPECT_EQ(count_packs(), 1);
+
+  ASSERT_TRUE(packs.read(make_hash(1), pack_store::kind::file, data));
+  EXPECT_EQ(data, "hello");
+  EXPECT_FALSE(packs.read(make_hash(3), pack_store::kind::file, data));
+}
+
+TEST_F(PackStoreTest, Reopen) {
+  {
+    pack_store packs(test_dir / "pack", test_dir / "tmp");
+    packs.write(make_hash(1), pack_store::kind::file, "hello");
+  }
+
+  pack_store packs(test_dir / "pack", test_dir / "tmp");
+  std::string data;
+  ASSERT_TRUE(packs.read(make_hash(1), pack_store::kind::file, data));
+  EXPECT_EQ(data, "hello");
+}
+
+TEST_F(PackStoreTest, LookupsSeePacksOfOtherStores) {
+  pack_store reader(test_dir / "pack", test_dir / "tmp", true);
+  pack_store writer(test_dir / "pack", test_dir / "tmp");
+  std::string data;
+
+  for (int i = 1; i <= 2; i++) {
+    EXPECT_FALSE(reader.contains(make_hash(i), pack_store::kind::file));
+    writer.write(make_hash(i), pack_store::kind::file, "object " + std::to_string(i));
+    writer.flush();
+
+    ASSERT_TRUE(reader.read(make_hash(i), pack_store::kind::file, data));
+    EXPECT_EQ(data, "object " + std::to_string(i));
+    EXPECT_EQ(reader.names().size(), i);
+  }
+}
+
+TEST_F(PackStoreTest, ConsolidateAndEvict) {
+  pack_store packs(test_dir / "pack", test_dir / "tmp");
+  for (int i = 1; i <= 10; i++) {
+    packs.write(make_hash(i), pack_store::kind::file, std::to_string(i));
+    packs.flush();
+  }
+  EXPECT_EQ(count_packs(), 10);
+
+  // Nothing is evicted within the retention period, but small packs are merged
+  packs.evict(0, std::chrono::hours(1));
+  EXPECT_EQ(count_packs(), 1);
+  for (int i = 1; i <= 10; i++) {
+    std::string data;
+    ASSERT_TRUE(packs.read(make_hash(i), pack_store::kind::file, data));
+    EXPECT_EQ(data, std::to_string(i));
+  }
+
+  EXPECT_EQ(packs.evict(0, std::chrono::seconds(0)), 0);
+  EXPECT_EQ(count_packs(), 0);
+  EXPECT_FALSE(packs.contains(make_hash(1), pack_store::kind::file));
+}
+
+TEST_F(PackStoreTest, VisitAndQuarantine) {
+  pack_store packs(test_dir / "pack", test_dir / "tmp");
+  packs.write(make_hash(1), pack_store::kind::file, "hello");
+  packs.write(make_hash(2), pack_store::kind::tree, "world");
+  packs.flush();
+
+  auto names = packs.names();
+  ASSERT_EQ(names.size(), 1);
+
+  std::string visited;
+  ASSERT_TRUE(packs.visit(names[0], [&](const digest& hash, pack_store::kind kind, std::string_view data) {
+    EXPECT_EQ(hash, kind == pack_store::kind::file ? make_hash(1) : make_hash(2));
+    visited += data;
+  }));
+  EXPECT_EQ(visited, "helloworld");
+  EXPECT_FALSE(packs.visit("pack-missing", [](const digest&, pack_store::kind, std::string_view) {}));
+
+  fs::create_directories(test_dir / "quarantine");
+  packs.quarantine(names[0], test_dir / "quarantine");
+  EXPECT_TRUE(packs.names().empty());
+  EXPECT_EQ(count_packs(), 0);
+  EXPECT_TRUE(fs::exists(test_dir / "quarantine" / (names[0] + ".pack")));
+
+  std::string data;
+  EXPECT_FALSE(packs.read(make_hash(1), pack_store::kind::file, data));
+}
+
+TEST_F(PackStoreTest, CorruptFanoutIsRejected) {
+  std::string name;
+  {
+    pack_store packs(test_dir / "pack", test_dir / "tmp");
+    packs.write(make_hash(1), pack_store::kind::file, "hello");
+    packs.write(make_hash(2), pack_store::kind::file, "world");
+    packs.flush();
+    name = packs.names().at(0);
+  }
+
+  // Raise a fanout slot above the entry count, as a flipped bit would
+  {
+    std::fstream index(test_dir / "pack" / (name + ".idx"), std::ios::in | std::ios::out | std::ios::binary);
+    index.seekp(8 + 10 * sizeof(uint32_t));
+    uint32_t bound = 1000;
+    index.write(reinterpret_cast<const char*>(&bound), sizeof(bound));
+  }
+
+  // The pack is skipped instead of being searched out of bounds
+  pack_store packs(test_dir / "pack", test_dir / "tmp");
+  EXPECT_TRUE(packs.names().empty());
+  std::string data;
+  EXPECT_FALSE(packs.read(make_hash(1), pack_store::kind::file, data));
+}
+
+TEST_F(PackStoreTest, ReadOnly) {
+  std::string name;
+  {
+    pack_store packs(test_dir / "pack", test_dir / "tmp");
+    packs.write(make_hash(1), pack_store::kind::file, "hello");
+    packs.flush();
+    name = packs.names().at(0);
+  }
+
+  fs::path pack_file = test_dir / "pack" / (name + ".pack");
+  auto old = fs::file_time_type::clock::now() - std::chrono::hours(2);
+  fs::last_write_time(pack_file, old);
+
+  // Reads don't record access times, and nothing is written or removed
+  pack_store packs(test_dir / "pack", test_dir / "tmp", true);
+  std::string data;
+  ASSERT_TRUE(packs.read(make_hash(1), pack_store::kind::file, data));
+  EXPECT_EQ(data, "hello");
+  EXPECT_TRUE(packs.contains(make_hash(1), pack_store::kind::file));
+  EXPECT_EQ(fs::last_write_time(pack_file), old);
+
+  EXPECT_THROW(packs.write(make_hash(2), pack_store::kind::file, "world"), std::runtime_error);
+  EXPECT_THROW(packs.evict(0, std::chrono::seconds(0)), std::runtime_error);
+  EXPECT_EQ(count_packs(), 1);
+}
+
+TEST_F(PackStoreTest, VisitRejectsUnsortedEntries) {
+  pack_store packs(test_dir / "pack", test_dir / "tmp");
+  packs.write(make_hash(1), pack_store::kind::file, "hello");
+  packs.write(make_hash(2), pack_store::kind::file, "world");
+  packs.flush();
+  std::string name = packs.names().at(0);
+
+  // Swap the two index entries, which lookups can then miss
+  fs::path index_path = test_dir / "pack" / (name + ".idx");
+  std::string index;
+  {
+    std::ifstream file(index_path, std::ios::binary);
+    index.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  }
+  size_t entries = 8 + 256 * sizeof(uint32_t);
+  size_t entry_size = (index.size() - entries) / 2;
+  std::string first = index.substr(entries, entry_size);
+  index.replace(entries, entry_size, index.substr(entries + entry_size, entry_size));
+  index.replace(entries + entry_size, entry_size, first);
+  std::ofstream(index_path, std::ios::binary | std::ios::trunc) << index;
+
+  pack_store reopened(test_dir / "pack", test_dir / "tmp");
+  EXPECT_THROW(reopened.visit(name, [](const digest&, pack_store::kind, std::string_view) {}), std::runtime_error);
+}
+
+TEST_F(PackStoreTest, EvictSparesKeptPacks) {
+  pack_store packs(test_dir / "pack", test_dir / "tmp");
+  for (int i = 1; i <= 3; i++) {
+    packs.write(make_hash(i), pack_store::kind::file, std::to_string(i));
+    packs.flush();
+  }
+
+  // Only the pack holding the kept object survives
+  auto keep = [](const digest& hash, pack_store::kind kind) {
+    return hash == make_hash(2) && kind == pack_store::kind::file;
+  };
+  EXPECT_GT(packs.evict(0, std::chrono::seconds(0), keep), 0);
+  EXPECT_EQ(count_packs(), 1);
+
+  std::string data;
+  EXPECT_TRUE(packs.read(make_hash(2), pack_store::kind::file, data));
+  EXPECT_FALSE(packs.read(make_hash(1), pack_store::kind::file, data));
+  EXPECT_FALSE(packs.read(make_hash(3), pack_store::kind::file, data));
+}
@@ -0,0 +1,60 @@
+#include "inode_arena.hpp"
+#include "tree_cache.hpp"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+
+using namespace fstree;
+namespace fs = std::filesystem;
+
+static file_status regular_file() { return file_status(fs::file_type::regular, fs::perms::owner_read); }
+
+static digest make_hash(int n) {
+  std::string hex(40, '0');
+  std::string suffix = std::to_string(n);
+  hex.replace(hex.size() - suffix.size(), suffix.size(), suffix);
+  return digest::parse("sha1:" + hex);
+}
+
+static std::shared_ptr<const tree_object> make_tree(int files) {
+  inode_arena::ptr arena(new inode_arena());
+  auto root = arena->make();
+  for (int i = 0; i < files; i++) {
+    root->add_child(arena->make("file" + std::to_string(i), regular_file(), 0, 0, "", make_hash(i + 1)));
+  }
+  return std::make_shared<const tree_object>(*root);
+}
+
+TEST(TreeCache, MaterializeUnderDirectory) {
+  auto object = make_tree(2);
+  ASSERT_EQ(object->entries().size(), 2);
+  EXPECT_EQ(object->entries()[1].name, "file1");
+
+  inode_arena::ptr arena(new inode_arena());
+  auto dir = arena->make("a/b", file_status(fs::file_type::directory, fs::perms::none), 0, 0, "");
+  object->materialize(*dir);
+
+  std::string sep(1, static_cast<char>(fs::path::preferred_separator));
+  ASSERT_EQ(dir->end() - dir->begin(), 2);
+  EXPECT_EQ(dir->begin()[0]->path(), "a/b" + sep + "file0");
+  EXPECT_EQ(dir->begin()[1]->hash(), make_hash(2));
+  EXPECT_EQ(dir->begin()[1]->parent().get(), dir.get());
+}
+
+TEST(TreeCache, EvictsLeastRecentlyUsed) {
+  auto object = make_tree(1);
+  tree_cache trees(object->memory_size() * 2);
+
+  trees.put(make_hash(1), object);
+  trees.put(make_hash(2), make_tree(1));
+  EXPECT_EQ(trees.get(make_hash(1)), object);
+
+  // The second tree is now the least recently used one
+  trees.put(make_hash(3), make_tree(1));
+  EXPECT_NE(trees.get(make_hash(1)), nullptr);
+  EXPECT_EQ(trees.get(make_hash(2)), nullptr);
+  EXPECT_NE(trees.get(make_hash(3)), nullptr);
+  EXPECT_EQ(trees.size(), object->memory_size() * 2);
+}
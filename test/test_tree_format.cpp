@@ -0,0 +1,250 @@
+#include "inode.hpp"
+#include "inode_arena.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+using namespace fstree;
+namespace fs = std::filesystem;
+
+static const std::string g_hash = "sha1:0123456789abcdef0123456789abcdef01234567";
+
+// Builds a tree with a file, a directory and a symlink
+static inode::ptr make_tree(const inode_arena::ptr& arena) {
+  inode::ptr root = arena->make();
+  root->add_child(arena->make("file", file_status(fs::file_type::regular, fs::perms::owner_read), 0, 0, "",
+                              digest::parse(g_hash)));
+  root->add_child(arena->make("dir", file_status(fs::file_type::directory, fs::perms::owner_all), 0, 0, "",
+                              digest::parse(g_hash)));
+  root->add_child(arena->make("link", file_status(fs::file_type::symlink, fs::perms::all), 0, 0, "file", digest()));
+  return root;
+}
+
+template <typename T>
+static void write_raw(std::ostream& os, T value) {
+  os.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void write_raw_string(std::ostream& os, const std::string& str) {
+  write_raw<uint64_t>(os, str.size());
+  os.write(str.data(), str.size());
+}
+
+static void expect_tree(const inode::ptr& root) {
+  std::vector<inode*> children(root->begin(), root->end());
+  ASSERT_EQ(children.size(), 3);
+
+  EXPECT_EQ(children[0]->name(), "file");
+  EXPECT_TRUE(children[0]->is_file());
+  EXPECT_EQ(children[0]->permissions(), fs::perms::owner_read);
+  EXPECT_EQ(children[0]->hash(), digest::parse(g_hash));
+
+  EXPECT_EQ(children[1]->name(), "dir");
+  EXPECT_TRUE(children[1]->is_directory());
+
+  EXPECT_EQ(children[2]->name(), "link");
+  EXPECT_TRUE(children[2]->is_symlink());
+  EXPECT_EQ(children[2]->target(), "file");
+  EXPECT_TRUE(children[2]->hash().empty());
+}
+
+TEST(TreeFormat, RoundTrip) {
+  auto arena = make_intrusive<inode_arena>();
+  std::stringstream stream;
+  stream << *make_tree(arena);
+
+  inode::ptr root = arena->make();
+  stream >> *root;
+  expect_tree(root);
+}
+
+TEST(TreeFormat, ReadsVersion1) {
+  std::stringstream stream;
+  write_raw<uint16_t>(stream, 0x3eee);
+  write_raw<uint16_t>(stream, 1);
+
+  write_raw_string(stream, "file");
+  write_raw_string(stream, g_hash);
+  write_raw<uint32_t>(stream, file_status(fs::file_type::regular, fs::perms::owner_read));
+
+  write_raw_string(stream, "dir");
+  write_raw_string(stream, g_hash);
+  write_raw<uint32_t>(stream, file_status(fs::file_type::directory, fs::perms::owner_all));
+
+  write_raw_string(stream, "link");
+  write_raw_string(stream, "");
+  write_raw<uint32_t>(stream, file_status(fs::file_type::symlink, fs::perms::all));
+  write_raw_string(stream, "file");
+
+  auto arena = make_intrusive<inode_arena>();
+  inode::ptr root = arena->make();
+  stream >> *root;
+  expect_tree(root);
+}
+
+TEST(TreeFormat, Version2IsSmaller) {
+  auto arena = make_intrusive<inode_arena>();
+  std::stringstream stream;
+  stream << *make_tree(arena);
+
+  // 4 byte header, and 1 + 4 + 1 + 20 + 4 + 1 bytes for the file entry alone
+  EXPECT_LT(stream.str().size(), 100);
+}
+
+TEST(TreeFormat, RejectsUnknownVersion) {
+  std::stringstream stream;
+  write_raw<uint16_t>(stream, 0x3eee);
+  write_raw<uint16_t>(stream, 99);
+
+  auto arena = make_intrusive<inode_arena>();
+  inode::ptr root = arena->make();
+  EXPECT_THROW(stream >> *root, std::runtime_error);
+}
+
+TEST(TreeFormat, RejectsTruncatedEntry) {
+  auto arena = make_intrusive<inode_arena>();
+  std::stringstream stream;
+  stream << *make_tree(arena);
+
+  std::string data = stream.str();
+  std::stringstream truncated(data.substr(0, data.size() - 2));
+  inode::ptr root = arena->make();
+  EXPECT_THROW(truncated >> *root, std::runtime_error);
+}
+
+TEST(TreeFormat, RejectsLengthBeyondTree) {
+  auto arena = make_intrusive<inode_arena>();
+
+  // A name claiming a terabyte, in both formats
+  std::stringstream v1;
+  write_raw<uint16_t>(v1, 0x3eee);
+  write_raw<uint16_t>(v1, 1);
+  write_raw<uint64_t>(v1, uint64_t(1) << 40);
+  v1 << "name";
+  inode::ptr root = arena->make();
+  EXPECT_THROW(v1 >> *root, std::runtime_error);
+
+  std::stringstream v2;
+  write_raw<uint16_t>(v2, 0x3eee);
+  write_raw<uint16_t>(v2, 2);
+  v2 << "\x80\x80\x80\x80\x80\x20" << "name";
+  root = arena->make();
+  EXPECT_THROW(v2 >> *root, std::runtime_error);
+}
+
+TEST(TreeFormat, SmallTreesAreNotSharded) {
+  auto arena = make_intrusive<inode_arena>();
+  inode::ptr tree = make_tree(arena);
+
+  std::ostringstream plain, written;
+  plain << *tree;
+  size_t shards = 0;
+  write_tree(written, *tree, [&](const digest&, std::string_view) { shards++; });
+
+  EXPECT_EQ(shards, 0);
+  EXPECT_EQ(written.str(), plain.str());
+  EXPECT_FALSE(is_sharded_tree(written.str()));
+}
+
+TEST(TreeFormat, ShardedRoundTrip) {
+  auto arena = make_intrusive<inode_arena>();
+  inode::ptr tree = arena->make();
+  const size_t count = 5000;
+  for (size_t i = 0; i < count; i++) {
+    tree->add_child(arena->make("f" + std::to_string(i), file_status(fs::file_type::regular, fs::perms::owner_read), 0,
+                                0, "", digest::parse(g_hash)));
+  }
+  tree->sort();
+
+  std::map<std::string, std::string> objects;
+  std::ostringstream index;
+  write_tree(index, *tree, [&](const digest& hash, std::string_view data) { objects[hash.string()] = data; });
+  ASSERT_TRUE(is_sharded_tree(index.str()));
+  EXPECT_GT(objects.size(), 1);
+
+  // Plain reads reject the shard index
+  inode::ptr plain = arena->make();
+  std::istringstream plain_stream(index.str());
+  EXPECT_THROW(plain_stream >> *plain, std::runtime_error);
+
+  inode::ptr root = arena->make();
+  std::vector<digest> shards;
+  std::istringstream stream(index.str());
+  read_tree(stream, *root, shards);
+  ASSERT_EQ(shards.size(), objects.size());
+  EXPECT_FALSE(root->has_children());
+
+  for (const auto& shard : shards) {
+    std::vector<digest> nested;
+    std::istringstream shard_stream(objects.at(shard.string()));
+    read_tree(shard_stream, *root, nested);
+    EXPECT_TRUE(nested.empty());
+  }
+  root->sort();
+
+  ASSERT_EQ(size_t(root->end() - root->begin()), count);
+  for (size_t i = 0; i < count; i++) {
+    EXPECT_EQ(root->begin()[i]->name(), tree->begin()[i]->name());
+  }
+}
+
+TEST(TreeFormat, SizesAndTotals) {
+  auto arena = make_intrusive<inode_arena>();
+  inode::ptr tree = arena->make();
+  tree->add_child(arena->make("file", file_status(fs::file_type::regular, fs::perms::owner_read), 0, 1000, "",
+                              digest::parse(g_hash)));
+  inode::ptr dir = arena->make("dir", file_status(fs::file_type::directory, fs::perms::owner_all), 0, 4096, "",
+                               digest::parse(g_hash));
+  dir->set_size(300000);
+  dir->set_file_count(42);
+  tree->add_child(dir);
+
+  std::stringstream stream;
+  stream << *tree;
+
+  inode::ptr root = arena->make();
+  stream >> *root;
+  std::vector<inode*> children(root->begin(), root->end());
+  ASSERT_EQ(children.size(), 2);
+  EXPECT_EQ(children[0]->size(), 1000);
+  EXPECT_EQ(children[1]->size(), 300000);
+  EXPECT_EQ(children[1]->file_count(), 42);
+
+  root->update_totals();
+  EXPECT_EQ(root->size(), 301000);
+  EXPECT_EQ(root->file_count(), 43);
+}
+
+TEST(TreeFormat, InlineData) {
+  auto arena = make_intrusive<inode_arena>();
+  inode::ptr tree = arena->make();
+  inode::ptr file = arena->make("__init__.py", file_status(fs::file_type::regular, fs::perms::owner_read), 0, 6, "",
+                                digest::parse(g_hash));
+  file->set_inline_data("pass\n\n");
+  tree->add_child(file);
+  tree->add_child(arena->make("empty", file_status(fs::file_type::regular, fs::perms::owner_read), 0, 0, "",
+                              digest::parse(g_hash)));
+
+  // Inline contents are not a symlink target
+  EXPECT_TRUE(file->has_inline_data());
+  EXPECT_EQ(file->target(), "");
+
+  std::stringstream stream;
+  stream << *tree;
+
+  inode::ptr root = arena->make();
+  stream >> *root;
+  std::vector<inode*> children(root->begin(), root->end());
+  ASSERT_EQ(children.size(), 2);
+  EXPECT_TRUE(children[0]->has_inline_data());
+  EXPECT_EQ(children[0]->inline_data(), "pass\n\n");
+  EXPECT_EQ(children[0]->size(), 6);
+  EXPECT_EQ(children[0]->target(), "");
+  EXPECT_FALSE(children[1]->has_inline_data());
+  EXPECT_EQ(children[1]->inline_data(), "");
+}